@@ -0,0 +1,523 @@
+/*
+ * File: adns.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the asynchronous DNS engine. Queries are
+ *      built in DNS wire format, sent on a connected non-blocking UDP
+ *      socket, and matched to their answers by transaction ID. An
+ *      epoll instance waits for answers; queries whose timer runs
+ *      out are retransmitted up to ADNS_TRIES times. With a deadline
+ *      the first resend is a hedge, sent as soon as a query is slower
+ *      than most answers so far, and the transaction IDs are kept so
+ *      whichever copy is answered first wins.
+ *
+ *      A name takes one slot but two queries, A and AAAA, each with
+ *      its own transaction ID. Addresses are kept in binary as they
+ *      come off the wire; the slot finishes once both are answered,
+ *      or with what it has when its last try runs out.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "util.h"
+#include "hist.h"
+#include "stats.h"
+#include "adns.h"
+
+/* Define macros:
+- DNS_HEADER: Size of the DNS header
+- DNS_NAME_MAX: Longest encoded domain name
+- DNS_PACKET_MAX: Largest UDP answer we read
+- QUERY_MAX: Largest query we build (header + name + type + class)
+- DNS_TYPE_A / DNS_TYPE_AAAA / DNS_CLASS_IN: The record types and class we ask for
+- NUM_TYPES: Num of queries per name; index 0 asks for A, 1 for AAAA */
+#define DNS_HEADER 12
+#define DNS_NAME_MAX 255
+#define DNS_PACKET_MAX 4096
+#define QUERY_MAX (DNS_HEADER + DNS_NAME_MAX + 4)
+#define DNS_TYPE_A 1
+#define DNS_TYPE_AAAA 28
+#define DNS_CLASS_IN 1
+#define NUM_TYPES 2
+
+static const int query_types[NUM_TYPES] = {DNS_TYPE_A, DNS_TYPE_AAAA};
+
+/* An outstanding name
+- used: 1 if this slot holds a name
+- id: Transaction ID of each query
+- answered: Bit per query that has its answer
+- tries: Num of times the unanswered queries have been sent
+- start: When the name was first sent, in ms
+- deadline: When to retransmit or give up, in ms
+- ctx: The pointer given to adns_submit()
+- len: Length of each packet
+- packet: The queries in wire format
+- found/num_found: Addresses from each query's answer
+- ttl: Shortest TTL seen
+- name: The domain name */
+struct query{
+	int used;
+	uint16_t id[NUM_TYPES];
+	int answered;
+	int tries;
+	long start;
+	long deadline;
+	void *ctx;
+	size_t len;
+	unsigned char packet[NUM_TYPES][QUERY_MAX];
+	struct ip_addr found[NUM_TYPES][UTIL_MAX_ADDRS];
+	int num_found[NUM_TYPES];
+	uint32_t ttl;
+	char name[DNS_NAME_MAX + 1];
+};
+
+/* The engine
+- fd: Connected UDP socket
+- epfd: epoll instance watching fd
+- max_inflight: Num of query slots
+- pending: Num of slots in use
+- queries: The query slots
+- free_slots: Stack of unused slot indexes
+- by_id: Slot index + 1 for each transaction ID; 0 if the ID is unused
+- rng: State of the transaction ID generator
+- deadline_ms: Time a name may take; 0 for none
+- quantile: Hedge percentile, as a fraction
+- latency: Time every answered name took, in ms */
+struct adns{
+	int fd;
+	int epfd;
+	int max_inflight;
+	int pending;
+	struct query *queries;
+	int *free_slots;
+	uint16_t *by_id;
+	uint32_t rng;
+	adns_callback cb;
+	void *arg;
+	int deadline_ms;
+	double quantile;
+	struct hist latency;
+};
+
+static long now_ms(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static uint16_t next_id(struct adns *a){
+	/* xorshift32 */
+	a->rng ^= a->rng << 13;
+	a->rng ^= a->rng >> 17;
+	a->rng ^= a->rng << 5;
+	return (uint16_t)a->rng;
+}
+
+/* Encode name as a DNS question for a record of type; returns its length, 0 if name is not encodable */
+static size_t encode_question(const char *name, int type, unsigned char *buf){
+	size_t len = strlen(name);
+	size_t out = 0;
+
+	/* Drop the root label */
+	if(len > 0 && name[len - 1] == '.'){
+		len--;
+	}
+	if(len == 0 || len + 2 > DNS_NAME_MAX){
+		return 0;
+	}
+
+	while(len > 0){
+		const char *dot = memchr(name, '.', len);
+		size_t label = dot ? (size_t)(dot - name) : len;
+		if(label == 0 || label > 63){
+			return 0;
+		}
+		buf[out++] = (unsigned char)label;
+		memcpy(buf + out, name, label);
+		out += label;
+		name += label;
+		len -= label;
+		if(dot){
+			name++;
+			len--;
+		}
+	}
+	buf[out++] = 0;
+	buf[out++] = (unsigned char)(type >> 8);
+	buf[out++] = (unsigned char)type;
+	buf[out++] = 0;
+	buf[out++] = DNS_CLASS_IN;
+	return out;
+}
+
+/* Compare two encoded names ignoring the case of their letters; returns 0 if equal */
+static int question_cmp(const unsigned char *x, const unsigned char *y, size_t len){
+	for(size_t i = 0; i < len; i++){
+		if(tolower(x[i]) != tolower(y[i])){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Skip an encoded name at off; returns the offset after it, 0 if malformed */
+static size_t skip_name(const unsigned char *buf, size_t n, size_t off){
+	while(off < n){
+		if(buf[off] == 0){
+			return off + 1;
+		}
+		if((buf[off] & 0xC0) == 0xC0){
+			return off + 2 <= n ? off + 2 : 0;
+		}
+		off += buf[off] + 1;
+	}
+	return 0;
+}
+
+/* Send the queries of q that are still unanswered */
+static int send_query(struct adns *a, struct query *q){
+	for(int t = 0; t < NUM_TYPES; t++){
+		if(!(q->answered & 1 << t) && send(a->fd, q->packet[t], q->len, 0) < 0
+			&& errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNREFUSED){
+			return -1;
+		}
+	}
+	long now = now_ms();
+	if(q->tries++ == 0){
+		q->start = now;
+	}
+	q->deadline = now + ADNS_TIMEOUT_MS;
+	if(a->deadline_ms > 0){
+		/* Hedge the first send at the percentile, and never wait past the deadline */
+		if(q->tries == 1 && a->latency.count >= ADNS_MIN_SAMPLES){
+			long hedge = q->start + (long)hist_quantile(&a->latency, a->quantile) + 1;
+			q->deadline = hedge < q->deadline ? hedge : q->deadline;
+		}
+		if(q->start + a->deadline_ms < q->deadline){
+			q->deadline = q->start + a->deadline_ms;
+		}
+	}
+	return 0;
+}
+
+/* Report the addresses a slot has, IPv4 first, and free it; timed_out
+ * tells a slot given up at its deadline
+ */
+static void finish(struct adns *a, int slot, int timed_out){
+	struct query *q = &a->queries[slot];
+	struct adns_result res;
+
+	res.name = q->name;
+	res.ctx = q->ctx;
+	res.addrs.num = 0;
+	for(int t = 0; t < NUM_TYPES; t++){
+		for(int i = 0; i < q->num_found[t] && res.addrs.num < UTIL_MAX_ADDRS; i++){
+			res.addrs.addrs[res.addrs.num++] = q->found[t][i];
+		}
+	}
+	res.addrs.timed_out = timed_out && res.addrs.num == 0;
+	res.status = res.addrs.num > 0 ? UTIL_SUCCESS : res.addrs.timed_out ? UTIL_TIMEOUT : UTIL_FAILURE;
+	res.ttl = res.addrs.num > 0 ? q->ttl : 0;
+	a->cb(a->arg, &res);
+
+	for(int t = 0; t < NUM_TYPES; t++){
+		if(!(q->answered & 1 << t)){
+			a->by_id[q->id[t]] = 0;
+		}
+	}
+	q->used = 0;
+	a->free_slots[a->max_inflight - a->pending] = slot;
+	a->pending--;
+}
+
+/* Match an answer to its query and keep every address of the asked type in it; returns 1 if a name finished */
+static int handle_answer(struct adns *a, const unsigned char *buf, size_t n){
+	size_t qlen, off;
+	int ancount;
+
+	if(n < DNS_HEADER){
+		return 0;
+	}
+
+	/* Find the query by transaction ID; late or duplicate answers are dropped */
+	uint16_t id = (uint16_t)(buf[0] << 8 | buf[1]);
+	if(a->by_id[id] == 0){
+		return 0;
+	}
+	int slot = a->by_id[id] - 1;
+	struct query *q = &a->queries[slot];
+	int t = q->id[0] == id ? 0 : 1;
+	int type = query_types[t];
+	size_t addr_len = type == DNS_TYPE_A ? 4 : 16;
+
+	/* Must be a response that echoes our question */
+	qlen = q->len - DNS_HEADER;
+	if(!(buf[2] & 0x80) || (buf[4] << 8 | buf[5]) != 1 || n < DNS_HEADER + qlen
+		|| question_cmp(buf + DNS_HEADER, q->packet[t] + DNS_HEADER, qlen) != 0){
+		return 0;
+	}
+
+	/* Walk the answer section for records of the asked type; CNAMEs come first and are skipped */
+	if((buf[3] & 0x0F) == 0){
+		ancount = buf[6] << 8 | buf[7];
+		off = DNS_HEADER + qlen;
+		for(int i = 0; i < ancount; i++){
+			off = skip_name(buf, n, off);
+			if(off == 0 || off + 10 > n){
+				break;
+			}
+			int rtype = buf[off] << 8 | buf[off + 1];
+			int class = buf[off + 2] << 8 | buf[off + 3];
+			uint32_t ttl = (uint32_t)buf[off + 4] << 24 | buf[off + 5] << 16 | buf[off + 6] << 8 | buf[off + 7];
+			size_t rdlen = buf[off + 8] << 8 | buf[off + 9];
+			off += 10;
+			if(off + rdlen > n){
+				break;
+			}
+			if(rtype == type && class == DNS_CLASS_IN && rdlen == addr_len && q->num_found[t] < UTIL_MAX_ADDRS){
+				struct ip_addr *addr = &q->found[t][q->num_found[t]++];
+				memset(addr, 0, sizeof(*addr));
+				addr->family = type == DNS_TYPE_A ? AF_INET : AF_INET6;
+				memcpy(type == DNS_TYPE_A ? (void *)&addr->v4 : (void *)&addr->v6, buf + off, addr_len);
+				q->ttl = ttl < q->ttl ? ttl : q->ttl;
+			}
+			off += rdlen;
+		}
+	}
+
+	/* Late or duplicate answers to this query are dropped from now on */
+	q->answered |= 1 << t;
+	a->by_id[id] = 0;
+	if(q->answered != (1 << NUM_TYPES) - 1){
+		return 0;
+	}
+	hist_record(&a->latency, now_ms() - q->start);
+	finish(a, slot, 0);
+	return 1;
+}
+
+int adns_parse_server(const char *str, struct sockaddr_storage *addr, socklen_t *len){
+	char host[INET6_ADDRSTRLEN + 2];
+	const char *port = NULL;
+	struct addrinfo hints, *res;
+
+	/* "[addr6]:port", "addr:port", or a bare address */
+	if(str[0] == '['){
+		const char *end = strchr(str, ']');
+		if(end == NULL || (size_t)(end - str - 1) >= sizeof(host)){
+			return -1;
+		}
+		memcpy(host, str + 1, end - str - 1);
+		host[end - str - 1] = 0;
+		if(end[1] == ':'){
+			port = end + 2;
+		}
+	}
+	else{
+		const char *colon = strchr(str, ':');
+		size_t hlen = strlen(str);
+		if(colon != NULL && strchr(colon + 1, ':') == NULL){
+			hlen = colon - str;
+			port = colon + 1;
+		}
+		if(hlen >= sizeof(host)){
+			return -1;
+		}
+		memcpy(host, str, hlen);
+		host[hlen] = 0;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+	hints.ai_socktype = SOCK_DGRAM;
+	if(getaddrinfo(host, port ? port : "53", &hints, &res) != 0){
+		return -1;
+	}
+	memcpy(addr, res->ai_addr, res->ai_addrlen);
+	*len = res->ai_addrlen;
+	freeaddrinfo(res);
+	return 0;
+}
+
+struct adns *adns_create(const struct sockaddr_storage *addr, socklen_t len,
+	int max_inflight, adns_callback cb, void *arg){
+	struct epoll_event ev;
+	struct adns *a = calloc(1, sizeof(*a));
+	if(a == NULL){
+		return NULL;
+	}
+	a->fd = -1;
+	a->epfd = -1;
+	a->max_inflight = max_inflight;
+	a->cb = cb;
+	a->arg = arg;
+	a->rng = (uint32_t)time(NULL) ^ (uint32_t)(uintptr_t)a ^ 0x9E3779B9u;
+	hist_init(&a->latency);
+
+	a->queries = calloc(max_inflight, sizeof(*a->queries));
+	a->free_slots = malloc(sizeof(*a->free_slots) * max_inflight);
+	a->by_id = calloc(65536, sizeof(*a->by_id));
+	if(a->queries == NULL || a->free_slots == NULL || a->by_id == NULL){
+		adns_destroy(a);
+		return NULL;
+	}
+	for(int i = 0; i < max_inflight; i++){
+		a->free_slots[i] = max_inflight - 1 - i;
+	}
+
+	/* Connect the socket so the kernel drops datagrams from anyone but the nameserver */
+	a->fd = socket(addr->ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(a->fd < 0 || connect(a->fd, (const struct sockaddr*)addr, len) < 0){
+		adns_destroy(a);
+		return NULL;
+	}
+
+	a->epfd = epoll_create1(EPOLL_CLOEXEC);
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = a->fd;
+	if(a->epfd < 0 || epoll_ctl(a->epfd, EPOLL_CTL_ADD, a->fd, &ev) < 0){
+		adns_destroy(a);
+		return NULL;
+	}
+	return a;
+}
+
+void adns_destroy(struct adns *a){
+	if(a == NULL){
+		return;
+	}
+	if(a->epfd >= 0){
+		close(a->epfd);
+	}
+	if(a->fd >= 0){
+		close(a->fd);
+	}
+	free(a->queries);
+	free(a->free_slots);
+	free(a->by_id);
+	free(a);
+}
+
+int adns_submit(struct adns *a, const char *name, void *ctx){
+	struct adns_result res;
+	uint16_t id;
+
+	if(a->pending == a->max_inflight){
+		return -1;
+	}
+	int slot = a->free_slots[a->max_inflight - a->pending - 1];
+	struct query *q = &a->queries[slot];
+
+	/* Names that cannot be put on the wire fail at once */
+	for(int t = 0; t < NUM_TYPES; t++){
+		q->len = encode_question(name, query_types[t], q->packet[t] + DNS_HEADER);
+	}
+	if(q->len == 0){
+		memset(&res, 0, sizeof(res));
+		res.name = name;
+		res.ctx = ctx;
+		res.status = UTIL_FAILURE;
+		a->cb(a->arg, &res);
+		return 0;
+	}
+	q->len += DNS_HEADER;
+
+	for(int t = 0; t < NUM_TYPES; t++){
+		/* Pick an unused random transaction ID */
+		do{
+			id = next_id(a);
+		}while(a->by_id[id] != 0);
+
+		/* Header: ID, RD set, one question */
+		memset(q->packet[t], 0, DNS_HEADER);
+		q->packet[t][0] = id >> 8;
+		q->packet[t][1] = id & 0xFF;
+		q->packet[t][2] = 0x01;
+		q->packet[t][5] = 1;
+		q->id[t] = id;
+		q->num_found[t] = 0;
+		a->by_id[id] = slot + 1;
+	}
+
+	q->used = 1;
+	q->answered = 0;
+	q->tries = 0;
+	q->ttl = UINT32_MAX;
+	q->ctx = ctx;
+	strcpy(q->name, name);
+	a->pending++;
+
+	if(send_query(a, q) != 0){
+		finish(a, slot, 0);
+	}
+	return 0;
+}
+
+void adns_set_deadline(struct adns *a, int deadline_ms, int percentile){
+	a->deadline_ms = deadline_ms;
+	a->quantile = percentile / 100.0;
+}
+
+int adns_pending(const struct adns *a){
+	return a->pending;
+}
+
+int adns_room(const struct adns *a){
+	return a->max_inflight - a->pending;
+}
+
+int adns_poll(struct adns *a, int timeout_ms){
+	unsigned char buf[DNS_PACKET_MAX];
+	struct epoll_event ev;
+	int done = 0;
+	long now = now_ms();
+	ssize_t n;
+
+	/* Do not sleep past the earliest query timer */
+	for(int i = 0; i < a->max_inflight && a->pending > 0; i++){
+		if(a->queries[i].used && a->queries[i].deadline - now < timeout_ms){
+			timeout_ms = a->queries[i].deadline > now ? (int)(a->queries[i].deadline - now) : 0;
+		}
+	}
+
+	if(epoll_wait(a->epfd, &ev, 1, timeout_ms) > 0){
+		/* Drain every answer that is queued on the socket */
+		while((n = recv(a->fd, buf, sizeof(buf), 0)) >= 0 || errno == ECONNREFUSED || errno == EINTR){
+			if(n > 0){
+				done += handle_answer(a, buf, (size_t)n);
+			}
+		}
+	}
+
+	/* Retransmit or fail queries whose timer ran out */
+	now = now_ms();
+	for(int i = 0; i < a->max_inflight && a->pending > 0; i++){
+		struct query *q = &a->queries[i];
+		if(!q->used || q->deadline > now){
+			continue;
+		}
+		if(a->deadline_ms > 0 && now >= q->start + a->deadline_ms){
+			finish(a, i, 1);
+			done++;
+			continue;
+		}
+		if(a->deadline_ms > 0 && q->tries == 1 && now < q->start + ADNS_TIMEOUT_MS){
+			stats_count(STAT_HEDGES, 1);
+		}
+		if((a->deadline_ms == 0 && q->tries >= ADNS_TRIES) || send_query(a, q) != 0){
+			finish(a, i, 0);
+			done++;
+		}
+	}
+	return done;
+}
@@ -0,0 +1,95 @@
+/*
+ * File: adns.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains declarations of the asynchronous DNS
+ *      engine. One engine belongs to one resolver thread and keeps
+ *      many queries in flight on a single non-blocking UDP socket.
+ *      Every name is asked for its A and its AAAA records at once.
+ *
+ */
+
+#ifndef ADNS_H
+#define ADNS_H
+
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include "util.h"
+
+/* Define macros:
+- ADNS_PORT: Default nameserver port
+- ADNS_MAX_INFLIGHT: Max num of outstanding queries per engine
+- ADNS_DEFAULT_INFLIGHT: Outstanding queries per engine unless told otherwise
+- ADNS_TIMEOUT_MS: Time to wait for an answer before retransmitting
+- ADNS_TRIES: Num of times a query is sent before it fails, unless it has a deadline
+- ADNS_MIN_SAMPLES: Answers to see before the hedge percentile is trusted */
+#define ADNS_PORT 53
+#define ADNS_MAX_INFLIGHT 4096
+#define ADNS_DEFAULT_INFLIGHT 256
+#define ADNS_TIMEOUT_MS 1000
+#define ADNS_TRIES 3
+#define ADNS_MIN_SAMPLES 32
+
+/* Result of one query, handed to the callback
+- name: The domain name that was queried
+- ctx: The pointer given to adns_submit()
+- status: UTIL_SUCCESS if any address was found, UTIL_TIMEOUT if nothing was
+  answered by the deadline, else UTIL_FAILURE
+- addrs: Every IPv4 address in the answers, then every IPv6 address
+- ttl: Shortest TTL of those addresses in seconds */
+struct adns_result{
+	const char *name;
+	void *ctx;
+	int status;
+	struct addr_list addrs;
+	uint32_t ttl;
+};
+
+typedef void (*adns_callback)(void *arg, const struct adns_result *res);
+
+struct adns;
+
+/* Parse "addr", "addr:port" or "[addr6]:port" into a socket address.
+ * Returns 0 on success, -1 if the string is not a numeric address
+ */
+int adns_parse_server(const char *str, struct sockaddr_storage *addr, socklen_t *len);
+
+/* Create an engine that talks to the nameserver at addr and keeps at
+ * most max_inflight queries outstanding. cb is called with arg for
+ * every finished query. Returns NULL on failure
+ */
+struct adns *adns_create(const struct sockaddr_storage *addr, socklen_t len,
+	int max_inflight, adns_callback cb, void *arg);
+
+/* Give every query a deadline of deadline_ms from its first send, and
+ * resend its unanswered queries once it has waited longer than the
+ * running percentile (1 to 99) of this engine's answer times, instead
+ * of only after ADNS_TIMEOUT_MS. Until the deadline a query is resent
+ * every ADNS_TIMEOUT_MS however many tries that takes; a name with no
+ * address by then finishes with UTIL_TIMEOUT
+ */
+void adns_set_deadline(struct adns *a, int deadline_ms, int percentile);
+
+/* Free an engine; outstanding queries are dropped */
+void adns_destroy(struct adns *a);
+
+/* Send the queries for name. Names that cannot be encoded fail at once
+ * through the callback. Returns 0 if the query was taken, -1 if the
+ * engine already has max_inflight queries outstanding
+ */
+int adns_submit(struct adns *a, const char *name, void *ctx);
+
+/* Num of queries still outstanding */
+int adns_pending(const struct adns *a);
+
+/* Num of queries that can still be submitted */
+int adns_room(const struct adns *a);
+
+/* Wait up to timeout_ms for answers, retransmit or fail queries whose
+ * timer ran out, and call the callback for every finished query.
+ * Returns the num of queries finished
+ */
+int adns_poll(struct adns *a, int timeout_ms);
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * File: affinity.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains CPU pinning. The CPUs are read from the
+ *      process's own affinity mask rather than counted, so a run under
+ *      taskset or in a cpuset only pins to CPUs it was given.
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "affinity.h"
+
+int affinity_cpus(int *cpus, int max){
+	cpu_set_t set;
+	int n = 0;
+
+	if(sched_getaffinity(0, sizeof(set), &set) == 0){
+		for(int cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++){
+			if(CPU_ISSET(cpu, &set)){
+				cpus[n++] = cpu;
+			}
+		}
+	}
+	if(n == 0){
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		for(; n < max && (n < online || n == 0); n++){
+			cpus[n] = n;
+		}
+	}
+	return n;
+}
+
+int affinity_pin(int cpu){
+	cpu_set_t set;
+
+	if(cpu < 0 || cpu >= CPU_SETSIZE){
+		return -1;
+	}
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 ? 0 : -1;
+}
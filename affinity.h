@@ -0,0 +1,25 @@
+/*
+ * File: affinity.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains declarations of CPU pinning for the per-core
+ *      pipelines. A thread pinned here passes its CPU on to every
+ *      thread it creates afterwards, so pinning a pipeline's first
+ *      thread pins the whole pipeline, the log writer and the backend's
+ *      threads included.
+ *
+ */
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+/* Store the CPUs this process may run on in cpus, at most max of them,
+ * in ascending order. Returns the num stored, at least 1 once max > 0;
+ * if they cannot be read, the first max CPUs online are assumed
+ */
+int affinity_cpus(int *cpus, int max);
+
+/* Pin the calling thread to cpu. Returns 0, or -1 */
+int affinity_pin(int cpu);
+
+#endif
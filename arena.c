@@ -0,0 +1,165 @@
+/*
+ * File: arena.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the name arena. Every slab is aligned to its
+ *      own size, so the slab a name lives in is its address with the
+ *      low bits cleared; views only need to carry the name pointer.
+ *
+ *      A slab's refcount starts at SLAB_BIAS while its producer fills
+ *      it, so consumers can release names before the producer knows
+ *      how many it will put there. Retiring the slab trades the bias
+ *      for the real count; whoever takes the count to zero puts the
+ *      slab back on the free list.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "queue.h"
+#include "arena.h"
+
+/* Define macros:
+- SLAB_BIAS: Refcount of a slab its producer is still filling */
+#define SLAB_BIAS (1L << 40)
+
+/* A slab; names follow the header
+- refs: Names not yet released, plus SLAB_BIAS until retired
+- used: Bytes handed out, header included
+- names: Names copied in; only the producer touches it
+- next: Next slab on the free list */
+struct slab{
+	_Alignas(CACHE_LINE) atomic_long refs;
+	size_t used;
+	size_t names;
+	struct slab *next;
+};
+
+struct arena{
+	pthread_mutex_t lock;
+	struct slab *free_list;
+	size_t num_slabs;
+};
+
+static struct slab *slab_of(const char *name){
+	return (struct slab *)((uintptr_t)name & ~(uintptr_t)(ARENA_SLAB_SIZE - 1));
+}
+
+static void recycle(struct arena *a, struct slab *s){
+	pthread_mutex_lock(&a->lock);
+	s->next = a->free_list;
+	a->free_list = s;
+	pthread_mutex_unlock(&a->lock);
+}
+
+static struct slab *take_slab(struct arena *a){
+	pthread_mutex_lock(&a->lock);
+	struct slab *s = a->free_list;
+	if(s != NULL){
+		a->free_list = s->next;
+	}
+	else if((s = aligned_alloc(ARENA_SLAB_SIZE, ARENA_SLAB_SIZE)) != NULL){
+		a->num_slabs++;
+	}
+	pthread_mutex_unlock(&a->lock);
+
+	if(s == NULL){
+		perror("Error allocating name slab");
+		exit(EXIT_FAILURE);
+	}
+	atomic_store_explicit(&s->refs, SLAB_BIAS, memory_order_relaxed);
+	s->used = sizeof(*s);
+	s->names = 0;
+	return s;
+}
+
+struct arena *arena_create(void){
+	struct arena *a = calloc(1, sizeof(*a));
+	if(a == NULL){
+		return NULL;
+	}
+	pthread_mutex_init(&a->lock, NULL);
+	return a;
+}
+
+void arena_destroy(struct arena *a){
+	if(a == NULL){
+		return;
+	}
+	while(a->free_list != NULL){
+		struct slab *next = a->free_list->next;
+		free(a->free_list);
+		a->free_list = next;
+	}
+	pthread_mutex_destroy(&a->lock);
+	free(a);
+}
+
+const char *arena_copy(struct arena *a, struct slab **s, const char *name, size_t len){
+	/* Keep even an empty name strictly inside the slab, or slab_of() would find the next one */
+	if(*s != NULL && (*s)->used + len >= ARENA_SLAB_SIZE){
+		arena_retire(a, s);
+	}
+	if(*s == NULL){
+		*s = take_slab(a);
+	}
+
+	char *copy = (char *)*s + (*s)->used;
+	memcpy(copy, name, len);
+	(*s)->used += len;
+	(*s)->names++;
+	return copy;
+}
+
+void arena_retire(struct arena *a, struct slab **s){
+	if(*s == NULL){
+		return;
+	}
+	/* Consumers may already have released some names; swap the bias for the real count */
+	long delta = (long)(*s)->names - SLAB_BIAS;
+	if(atomic_fetch_add_explicit(&(*s)->refs, delta, memory_order_acq_rel) + delta == 0){
+		recycle(a, *s);
+	}
+	*s = NULL;
+}
+
+static void release_run(struct arena *a, struct slab *s, long n){
+	if(atomic_fetch_sub_explicit(&s->refs, n, memory_order_acq_rel) == n){
+		recycle(a, s);
+	}
+}
+
+void arena_release(struct arena *a, const struct name_view *views, size_t n){
+	struct slab *run = NULL;
+	long run_len = 0;
+
+	for(size_t i = 0; i < n; i++){
+		if(!views[i].owned){
+			continue;
+		}
+		struct slab *s = slab_of(views[i].name);
+		if(s != run){
+			if(run != NULL){
+				release_run(a, run, run_len);
+			}
+			run = s;
+			run_len = 0;
+		}
+		run_len++;
+	}
+	if(run != NULL){
+		release_run(a, run, run_len);
+	}
+}
+
+size_t arena_slabs(struct arena *a){
+	pthread_mutex_lock(&a->lock);
+	size_t n = a->num_slabs;
+	pthread_mutex_unlock(&a->lock);
+	return n;
+}
@@ -0,0 +1,50 @@
+/*
+ * File: arena.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains declarations of the name arena. Names read
+ *      from streams are packed back to back into fixed-size slabs
+ *      instead of being malloc'd one by one. A slab goes back on the
+ *      free list once its producer has moved on and consumers have
+ *      released every name in it.
+ *
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#include "queue.h"
+
+/* Define macros:
+- ARENA_SLAB_SIZE: Size of a slab; a power of two, so a name's slab is found from its address */
+#define ARENA_SLAB_SIZE (64 * 1024)
+
+struct arena;
+struct slab;
+
+/* Create an empty arena; returns NULL if out of memory */
+struct arena *arena_create(void);
+
+/* Free an arena and all its slabs; every name must have been released */
+void arena_destroy(struct arena *a);
+
+/* Copy len bytes of name into the producer's slab *s and return the
+ * copy. When *s is NULL or full, it is retired and a fresh slab taken.
+ * len must be less than MAX_NAME_LENGTH
+ */
+const char *arena_copy(struct arena *a, struct slab **s, const char *name, size_t len);
+
+/* Retire the producer's slab *s once the producer is done with it */
+void arena_retire(struct arena *a, struct slab **s);
+
+/* Release the names of the n views that are in the arena. Runs of
+ * names from one slab are released with a single atomic operation
+ */
+void arena_release(struct arena *a, const struct name_view *views, size_t n);
+
+/* Num of slabs allocated so far */
+size_t arena_slabs(struct arena *a);
+
+#endif
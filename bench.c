@@ -0,0 +1,239 @@
+/*
+ * File: bench.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the benchmark driver. It runs the whole
+ *      program in-process through run_lookup() for every combination
+ *      of requesters, resolvers, queue depth and batch size, with
+ *      warmup runs and repetitions, and writes one CSV row per
+ *      combination to stdout:
+ *
+ *      requesters,resolvers,queue_depth,batch_size,names_per_sec,p50_us,p99_us
+ *
+ *      Times come from the monotonic clock inside run_lookup(), and
+ *      every column is the mean over the repetitions. performance.py
+ *      plots the file.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "multi-lookup.h"
+
+/* Define macros:
+- MAX_VALUES: Num of values a list option may hold
+- DEFAULT_WARMUPS: Unmeasured runs per combination unless -w is given
+- DEFAULT_REPS: Measured runs per combination unless -n is given
+- DEFAULT_MOCK: Mock backend latency unless -m is given */
+#define MAX_VALUES 64
+#define DEFAULT_WARMUPS 1
+#define DEFAULT_REPS 3
+#define DEFAULT_MOCK "fixed:100"
+
+/* A list option, e.g. "1-4,8,16" */
+struct values{
+	int num;
+	int v[MAX_VALUES];
+};
+
+static void usage(char *str){
+	printf("Usage: %s [-r <requesters>] [-s <resolvers>] [-d <queue depths>] [-b <batch sizes>] [-w <warmups>] [-n <reps>]"
+		" [-m <mock latency>] [-c <cache MB>] <data file>...<data file>\n", str);
+	printf("Lists are comma-separated values and ranges, e.g. 1-4,8,16\n");
+	exit(1);
+}
+
+/* Parse a list option into v; exit on anything but positive integers and ranges */
+static void get_values(char *str, struct values *v, char *what){
+	char *p = str;
+	v->num = 0;
+	while(*p){
+		char *end;
+		long lo = strtol(p, &end, 10), hi = lo;
+		if(end == p || lo <= 0){
+			break;
+		}
+		if(*end == '-'){
+			p = end + 1;
+			hi = strtol(p, &end, 10);
+			if(end == p || hi < lo){
+				break;
+			}
+		}
+		for(long i = lo; i <= hi && v->num < MAX_VALUES; i++){
+			v->v[v->num++] = (int)i;
+		}
+		if(*end == ','){
+			end++;
+		}
+		else if(*end != 0){
+			break;
+		}
+		p = end;
+	}
+	if(*p != 0 || v->num == 0){
+		printf("<%s> must be a list of positive integers and ranges, e.g. 1-4,8\n", what);
+		exit(1);
+	}
+}
+
+static int get_count(char *str, char *what){
+	for(char *p = str; *p; p++){
+		if(!isdigit((unsigned char)*p)){
+			printf("<%s> must be an integer\n", what);
+			exit(1);
+		}
+	}
+	return atoi(str);
+}
+
+/* Run the program once with stdout silenced; exit if it fails */
+static void run_once(char **args, int num_args, char *serviced, char *results, struct lookup_report *report){
+	int fd, saved;
+
+	/* The program opens its logs with "r+", so they must exist; empty them */
+	if(truncate(serviced, 0) != 0 || truncate(results, 0) != 0){
+		perror("Error truncating the logs");
+		exit(1);
+	}
+
+	fflush(stdout);
+	saved = dup(STDOUT_FILENO);
+	fd = open("/dev/null", O_WRONLY);
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+
+	int status = run_lookup(num_args, args, report);
+
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	if(status != 0){
+		printf("Run failed with status %d\n", status);
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv){
+	struct values requesters = {3, {1, 2, 4}};
+	struct values resolvers = {4, {1, 2, 4, 8}};
+	struct values depths = {1, {16384}};
+	struct values batches = {1, {16}};
+	int warmups = DEFAULT_WARMUPS;
+	int reps = DEFAULT_REPS;
+	char *mock = DEFAULT_MOCK;
+	char *cache_mb = NULL;
+	int opt;
+
+	while((opt = getopt(argc, argv, "r:s:d:b:w:n:m:c:")) != -1){
+		switch(opt){
+			case 'r':
+				get_values(optarg, &requesters, "requesters");
+				break;
+			case 's':
+				get_values(optarg, &resolvers, "resolvers");
+				break;
+			case 'd':
+				get_values(optarg, &depths, "queue depths");
+				break;
+			case 'b':
+				get_values(optarg, &batches, "batch sizes");
+				break;
+			case 'w':
+				warmups = get_count(optarg, "warmups");
+				break;
+			case 'n':
+				reps = get_count(optarg, "reps");
+				break;
+			case 'm':
+				mock = optarg;
+				break;
+			case 'c':
+				cache_mb = optarg;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if(optind >= argc || reps == 0){
+		usage(argv[0]);
+	}
+	int num_files = argc - optind;
+
+	/* Logs for the runs */
+	char serviced[] = "/tmp/bench-serviced-XXXXXX";
+	char results[] = "/tmp/bench-results-XXXXXX";
+	int fd1 = mkstemp(serviced), fd2 = mkstemp(results);
+	if(fd1 < 0 || fd2 < 0){
+		perror("Error creating the logs");
+		exit(1);
+	}
+	close(fd1);
+	close(fd2);
+
+	/* Command line of one run: options, then <# requester> <# resolver> <logs> <data files> */
+	char req[16], res[16], depth[16], batch[16];
+	char **args = malloc(sizeof(*args) * (num_files + 16));
+	int num_args = 0;
+	args[num_args++] = "multi-lookup";
+	args[num_args++] = "-m";
+	args[num_args++] = mock;
+	args[num_args++] = "-d";
+	args[num_args++] = depth;
+	args[num_args++] = "-b";
+	args[num_args++] = batch;
+	if(cache_mb != NULL){
+		args[num_args++] = "-c";
+		args[num_args++] = cache_mb;
+	}
+	args[num_args++] = req;
+	args[num_args++] = res;
+	args[num_args++] = serviced;
+	args[num_args++] = results;
+	for(int i = 0; i < num_files; i++){
+		args[num_args++] = argv[optind + i];
+	}
+	args[num_args] = NULL;
+
+	printf("requesters,resolvers,queue_depth,batch_size,names_per_sec,p50_us,p99_us\n");
+	for(int a = 0; a < requesters.num; a++){
+		for(int b = 0; b < resolvers.num; b++){
+			for(int c = 0; c < depths.num; c++){
+				for(int d = 0; d < batches.num; d++){
+					snprintf(req, sizeof(req), "%d", requesters.v[a]);
+					snprintf(res, sizeof(res), "%d", resolvers.v[b]);
+					snprintf(depth, sizeof(depth), "%d", depths.v[c]);
+					snprintf(batch, sizeof(batch), "%d", batches.v[d]);
+
+					/* run_lookup() shifts its argv, so every run gets a fresh copy */
+					char *run_args[num_args + 1];
+					struct lookup_report r;
+					double rate = 0, p50 = 0, p99 = 0;
+
+					for(int i = 0; i < warmups + reps; i++){
+						memcpy(run_args, args, sizeof(run_args));
+						run_once(run_args, num_args, serviced, results, &r);
+						if(i >= warmups){
+							rate += r.seconds > 0 ? r.names / r.seconds : 0;
+							p50 += r.p50_ns / 1e3;
+							p99 += r.p99_ns / 1e3;
+						}
+					}
+					printf("%d,%d,%d,%d,%.0f,%.1f,%.1f\n", requesters.v[a], resolvers.v[b], depths.v[c], batches.v[d],
+						rate / reps, p50 / reps, p99 / reps);
+					fflush(stdout);
+				}
+			}
+		}
+	}
+
+	unlink(serviced);
+	unlink(results);
+	free(args);
+	return 0;
+}
@@ -0,0 +1,440 @@
+/*
+ * File: cache.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the sharded resolution cache. A name is
+ *      hashed once; the top bits pick the shard and the low bits pick
+ *      the bucket inside it, so threads looking up different names
+ *      rarely touch the same lock.
+ *
+ *      A snapshot is a results file (results.h) whose records carry
+ *      their expiry time. Loading it only maps it, so a cache of
+ *      millions of names is ready at once; answers move into memory
+ *      one by one as they are asked for.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "util.h"
+#include "queue.h"
+#include "results.h"
+#include "cache.h"
+
+/* Define macros:
+- SHARD_BITS: log2(CACHE_SHARDS)
+- INITIAL_BUCKETS: Num of buckets of an empty shard
+- SAVE_BUF_SIZE: Size of the buffer records are encoded into when saving
+- MAX_PATH: Longest snapshot path, temporary suffix included */
+#define SHARD_BITS 6
+#define INITIAL_BUCKETS 64
+#define SAVE_BUF_SIZE (64 * 1024)
+#define MAX_PATH 4096
+
+/* A cached answer
+- next: Next entry in the same bucket
+- newer/older: Neighbours in the shard's LRU list
+- hash: Hash of the lowercased name
+- expires: Wall-clock time the entry goes stale
+- name: The domain name; stored right after the addresses
+- num_addrs: Num of addresses; 0 for a cached failure
+- addrs: The addresses, binary, so an entry is only as big as its answer */
+struct cache_entry{
+	struct cache_entry *next;
+	struct cache_entry *newer;
+	struct cache_entry *older;
+	uint64_t hash;
+	time_t expires;
+	char *name;
+	int num_addrs;
+	struct ip_addr addrs[];
+};
+
+/* One shard; each sits on its own cache lines
+- lock: Guards everything in this shard
+- buckets: Chained hash table
+- newest/oldest: Ends of the LRU list
+- max_bytes: This shard's share of the memory cap */
+struct shard{
+	_Alignas(CACHE_LINE) pthread_mutex_t lock;
+	struct cache_entry **buckets;
+	size_t num_buckets;
+	struct cache_entry *newest;
+	struct cache_entry *oldest;
+	size_t entries;
+	size_t bytes;
+	size_t max_bytes;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t warm_hits;
+	uint64_t evictions;
+};
+
+/* The cache
+- shards: The entries in memory
+- warm: 1 if snapshot holds a loaded snapshot
+- snapshot: Mapped snapshot; read-only, so it is never locked */
+struct cache{
+	struct shard shards[CACHE_SHARDS];
+	int warm;
+	struct results_db snapshot;
+};
+
+static struct shard *get_shard(struct cache *c, uint64_t hash){
+	return &c->shards[hash >> (64 - SHARD_BITS)];
+}
+
+static size_t entry_bytes(const struct cache_entry *e){
+	return sizeof(*e) + e->num_addrs * sizeof(e->addrs[0]) + strlen(e->name) + 1;
+}
+
+static struct cache_entry **find_slot(struct shard *s, const char *name, uint64_t hash){
+	struct cache_entry **pe = &s->buckets[hash & (s->num_buckets - 1)];
+	while(*pe != NULL && ((*pe)->hash != hash || strcasecmp((*pe)->name, name) != 0)){
+		pe = &(*pe)->next;
+	}
+	return pe;
+}
+
+static void lru_unlink(struct shard *s, struct cache_entry *e){
+	if(e->newer){
+		e->newer->older = e->older;
+	}
+	else{
+		s->newest = e->older;
+	}
+	if(e->older){
+		e->older->newer = e->newer;
+	}
+	else{
+		s->oldest = e->newer;
+	}
+}
+
+static void lru_push(struct shard *s, struct cache_entry *e){
+	e->newer = NULL;
+	e->older = s->newest;
+	if(s->newest){
+		s->newest->newer = e;
+	}
+	s->newest = e;
+	if(s->oldest == NULL){
+		s->oldest = e;
+	}
+}
+
+/* Unlink e from its bucket and the LRU list and free it */
+static void remove_entry(struct shard *s, struct cache_entry *e){
+	struct cache_entry **pe = find_slot(s, e->name, e->hash);
+	*pe = e->next;
+	lru_unlink(s, e);
+	s->entries--;
+	s->bytes -= entry_bytes(e);
+	free(e);
+}
+
+/* Double the bucket array once the shard holds more entries than buckets */
+static void grow(struct shard *s){
+	size_t n = s->num_buckets * 2;
+	struct cache_entry **buckets = calloc(n, sizeof(*buckets));
+	if(buckets == NULL){
+		return;
+	}
+	for(size_t i = 0; i < s->num_buckets; i++){
+		struct cache_entry *e = s->buckets[i];
+		while(e != NULL){
+			struct cache_entry *next = e->next;
+			e->next = buckets[e->hash & (n - 1)];
+			buckets[e->hash & (n - 1)] = e;
+			e = next;
+		}
+	}
+	free(s->buckets);
+	s->buckets = buckets;
+	s->num_buckets = n;
+}
+
+struct cache *cache_create(size_t max_bytes){
+	struct cache *c = aligned_alloc(CACHE_LINE, sizeof(*c));
+	if(c == NULL){
+		return NULL;
+	}
+	for(int i = 0; i < CACHE_SHARDS; i++){
+		struct shard *s = &c->shards[i];
+		memset(s, 0, sizeof(*s));
+		pthread_mutex_init(&s->lock, NULL);
+		s->num_buckets = INITIAL_BUCKETS;
+		s->buckets = calloc(s->num_buckets, sizeof(*s->buckets));
+		s->max_bytes = max_bytes / CACHE_SHARDS;
+		if(s->buckets == NULL){
+			for(int j = 0; j < i; j++){
+				free(c->shards[j].buckets);
+			}
+			free(c);
+			return NULL;
+		}
+	}
+	c->warm = 0;
+	memset(&c->snapshot, 0, sizeof(c->snapshot));
+	return c;
+}
+
+void cache_destroy(struct cache *c){
+	if(c == NULL){
+		return;
+	}
+	for(int i = 0; i < CACHE_SHARDS; i++){
+		struct shard *s = &c->shards[i];
+		struct cache_entry *e = s->newest;
+		while(e != NULL){
+			struct cache_entry *older = e->older;
+			free(e);
+			e = older;
+		}
+		free(s->buckets);
+		pthread_mutex_destroy(&s->lock);
+	}
+	results_close(&c->snapshot);
+	free(c);
+}
+
+int cache_get(struct cache *c, const char *name, struct addr_list *addrs){
+	uint64_t hash = hash_name(name);
+	struct shard *s = get_shard(c, hash);
+	int found = -1;
+
+	pthread_mutex_lock(&s->lock);
+	struct cache_entry *e = *find_slot(s, name, hash);
+	if(e != NULL && e->expires <= time(NULL)){
+		/* Stale; drop it and treat the lookup as a miss */
+		remove_entry(s, e);
+		e = NULL;
+	}
+	if(e != NULL){
+		addrs->num = e->num_addrs;
+		addrs->timed_out = 0;
+		memcpy(addrs->addrs, e->addrs, e->num_addrs * sizeof(e->addrs[0]));
+		lru_unlink(s, e);
+		lru_push(s, e);
+		s->hits++;
+		found = 0;
+	}
+	else if(!c->warm){
+		s->misses++;
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	/* Missed in memory; an unexpired answer in the snapshot is a hit and moves into memory */
+	if(found != 0 && c->warm){
+		int64_t expires;
+		time_t now = time(NULL);
+		if(results_find(&c->snapshot, name, addrs, &expires) == 0 && expires > now){
+			cache_put(c, name, addrs, expires - now);
+			found = 0;
+		}
+		pthread_mutex_lock(&s->lock);
+		if(found == 0){
+			s->hits++;
+			s->warm_hits++;
+		}
+		else{
+			s->misses++;
+		}
+		pthread_mutex_unlock(&s->lock);
+	}
+	return found;
+}
+
+void cache_put(struct cache *c, const char *name, const struct addr_list *addrs, uint32_t ttl){
+	uint64_t hash = hash_name(name);
+	struct shard *s = get_shard(c, hash);
+	size_t len = strlen(name);
+	size_t addr_bytes = addrs->num * sizeof(addrs->addrs[0]);
+
+	/* A lookup that timed out says nothing about the name, and an entry that could never fit is not cached */
+	if(addrs->timed_out || sizeof(struct cache_entry) + addr_bytes + len + 1 > s->max_bytes){
+		return;
+	}
+
+	struct cache_entry *e = malloc(sizeof(*e) + addr_bytes + len + 1);
+	if(e == NULL){
+		return;
+	}
+	e->hash = hash;
+	e->expires = time(NULL) + ttl;
+	e->num_addrs = addrs->num;
+	memcpy(e->addrs, addrs->addrs, addr_bytes);
+	e->name = (char *)e->addrs + addr_bytes;
+	memcpy(e->name, name, len + 1);
+
+	pthread_mutex_lock(&s->lock);
+
+	/* Replace an older answer for the same name */
+	struct cache_entry *old = *find_slot(s, name, hash);
+	if(old != NULL){
+		remove_entry(s, old);
+	}
+
+	/* Evict least recently used entries until the new one fits */
+	while(s->oldest != NULL && s->bytes + entry_bytes(e) > s->max_bytes){
+		remove_entry(s, s->oldest);
+		s->evictions++;
+	}
+
+	if(s->entries >= s->num_buckets){
+		grow(s);
+	}
+	struct cache_entry **bucket = &s->buckets[hash & (s->num_buckets - 1)];
+	e->next = *bucket;
+	*bucket = e;
+	lru_push(s, e);
+	s->entries++;
+	s->bytes += entry_bytes(e);
+
+	pthread_mutex_unlock(&s->lock);
+}
+
+/* 1 if name has an unexpired entry in memory */
+static int fresh_in_memory(struct cache *c, const char *name, time_t now){
+	uint64_t hash = hash_name(name);
+	struct shard *s = get_shard(c, hash);
+	pthread_mutex_lock(&s->lock);
+	struct cache_entry *e = *find_slot(s, name, hash);
+	int fresh = e != NULL && e->expires > now;
+	pthread_mutex_unlock(&s->lock);
+	return fresh;
+}
+
+int cache_load(struct cache *c, const char *path){
+	if(results_open(path, &c->snapshot) != 0){
+		return -1;
+	}
+	if(!(c->snapshot.flags & RESULTS_EXPIRES)){
+		results_close(&c->snapshot);
+		errno = EINVAL;
+		return -1;
+	}
+	c->warm = 1;
+	return 0;
+}
+
+/* Records on their way to a snapshot file */
+struct save_buf{
+	int fd;
+	int failed;
+	size_t len;
+	char data[SAVE_BUF_SIZE];
+};
+
+static void save_flush(struct save_buf *b){
+	char *p = b->data;
+	while(b->len > 0 && !b->failed){
+		ssize_t wrote = write(b->fd, p, b->len);
+		if(wrote < 0){
+			b->failed = errno != EINTR;
+			continue;
+		}
+		p += wrote;
+		b->len -= wrote;
+	}
+	b->len = 0;
+}
+
+static void save_record(struct save_buf *b, const char *name, const struct addr_list *addrs, int64_t expires){
+	if(b->len + RESULTS_RECORD_MAX > SAVE_BUF_SIZE){
+		save_flush(b);
+	}
+	b->len += results_encode_expiring(b->data + b->len, name, addrs, expires);
+}
+
+int cache_save(struct cache *c, const char *path){
+	char tmp[MAX_PATH];
+	struct addr_list addrs;
+	time_t now = time(NULL);
+	struct save_buf *b;
+
+	if(strlen(path) + 5 > MAX_PATH || (b = malloc(sizeof(*b))) == NULL){
+		return -1;
+	}
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	b->fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	b->failed = b->fd < 0 || results_begin(b->fd) != 0;
+	b->len = 0;
+
+	/* What is in memory is the newest answer of every name it holds */
+	for(int i = 0; i < CACHE_SHARDS && !b->failed; i++){
+		struct shard *s = &c->shards[i];
+		pthread_mutex_lock(&s->lock);
+		for(struct cache_entry *e = s->newest; e != NULL; e = e->older){
+			if(e->expires > now){
+				addrs.num = e->num_addrs;
+				addrs.timed_out = 0;
+				memcpy(addrs.addrs, e->addrs, e->num_addrs * sizeof(e->addrs[0]));
+				save_record(b, e->name, &addrs, e->expires);
+			}
+		}
+		pthread_mutex_unlock(&s->lock);
+	}
+
+	/* Carry over the rest of the old snapshot, stale entries included, so a later run can refresh them */
+	uint64_t pos = 0;
+	const char *name;
+	int64_t expires;
+	while(c->warm && !b->failed && results_next(&c->snapshot, &pos, &name, &addrs, &expires) == 0){
+		if(expires > now - CACHE_KEEP_STALE && !fresh_in_memory(c, name, now)){
+			save_record(b, name, &addrs, expires);
+		}
+	}
+	save_flush(b);
+
+	int ret = b->failed || results_finish(b->fd, RESULTS_EXPIRES) != 0 ? -1 : 0;
+	if(b->fd >= 0 && close(b->fd) != 0){
+		ret = -1;
+	}
+	if(ret == 0 && rename(tmp, path) != 0){
+		ret = -1;
+	}
+	if(ret != 0 && b->fd >= 0){
+		unlink(tmp);
+	}
+	free(b);
+	return ret;
+}
+
+size_t cache_stale_names(struct cache *c, uint64_t *pos, const char **names, size_t n){
+	size_t found = 0;
+	const char *name;
+	int64_t expires;
+	time_t now = time(NULL);
+
+	while(c->warm && found < n && results_next(&c->snapshot, pos, &name, NULL, &expires) == 0){
+		if(expires <= now && !fresh_in_memory(c, name, now)){
+			names[found++] = name;
+		}
+	}
+	return found;
+}
+
+void cache_get_stats(struct cache *c, struct cache_stats *st){
+	memset(st, 0, sizeof(*st));
+	for(int i = 0; i < CACHE_SHARDS; i++){
+		struct shard *s = &c->shards[i];
+		pthread_mutex_lock(&s->lock);
+		st->hits += s->hits;
+		st->misses += s->misses;
+		st->warm_hits += s->warm_hits;
+		st->evictions += s->evictions;
+		st->entries += s->entries;
+		st->bytes += s->bytes;
+		pthread_mutex_unlock(&s->lock);
+	}
+}
@@ -0,0 +1,97 @@
+/*
+ * File: cache.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains declarations of the resolution cache that
+ *      sits in front of dnslookup(). The table is split into
+ *      CACHE_SHARDS independently locked shards; every entry has a
+ *      TTL and each shard evicts its least recently used entries to
+ *      stay under its share of the memory cap.
+ *
+ *      The cache can be saved to a snapshot file at exit and loaded
+ *      from it at start. A loaded snapshot is only mapped, not read:
+ *      a name that misses in memory is looked up in the snapshot's
+ *      index and, if its answer has not expired, copied into memory.
+ *
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Define macros:
+- CACHE_SHARDS: Num of shards; must be a power of two
+- CACHE_DEFAULT_MB: Memory cap of the cache unless told otherwise
+- CACHE_DEFAULT_TTL: TTL of an answer whose real TTL is unknown (getaddrinfo())
+- CACHE_NEGATIVE_TTL: TTL of a failed lookup
+- CACHE_KEEP_STALE: Seconds an expired snapshot entry is kept in the next snapshot, to be refreshed by a later run */
+#define CACHE_SHARDS 64
+#define CACHE_DEFAULT_MB 64
+#define CACHE_DEFAULT_TTL 300
+#define CACHE_NEGATIVE_TTL 30
+#define CACHE_KEEP_STALE 86400
+
+/* Counters summed over all shards
+- hits: Lookups answered from the cache
+- misses: Lookups that were not in the cache or had expired
+- warm_hits: Hits answered from the loaded snapshot
+- evictions: Entries dropped to stay under the memory cap
+- entries: Entries currently in the cache
+- bytes: Memory charged to those entries */
+struct cache_stats{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t warm_hits;
+	uint64_t evictions;
+	uint64_t entries;
+	uint64_t bytes;
+};
+
+struct cache;
+struct addr_list;
+
+/* Create a cache that holds at most max_bytes of entries.
+ * Returns NULL if out of memory
+ */
+struct cache *cache_create(size_t max_bytes);
+
+/* Free a cache and all its entries */
+void cache_destroy(struct cache *c);
+
+/* Look up name. On a hit, copy its addresses (none for a cached
+ * failure) into addrs and return 0; return -1 on a miss
+ */
+int cache_get(struct cache *c, const char *name, struct addr_list *addrs);
+
+/* Insert or refresh name; addrs holds none for a failed lookup. A
+ * lookup that timed out is not cached
+ */
+void cache_put(struct cache *c, const char *name, const struct addr_list *addrs, uint32_t ttl);
+
+/* Map the snapshot at path so lookups that miss in memory consult it.
+ * Call before the cache is shared. Returns 0, or -1 if path cannot be
+ * read or is not a snapshot, and the cache stays cold
+ */
+int cache_load(struct cache *c, const char *path);
+
+/* Write every unexpired entry, plus the loaded snapshot's entries not
+ * in memory and expired less than CACHE_KEEP_STALE ago, to a snapshot
+ * at path. The file is written beside path and renamed over it.
+ * Returns 0, or -1 on failure
+ */
+int cache_save(struct cache *c, const char *path);
+
+/* Find up to n names of the loaded snapshot, from *pos on, whose
+ * answer has expired and is not fresh in memory, and move *pos on;
+ * *pos is 0 to start. Names point into the snapshot and stay valid
+ * until cache_destroy(). Returns the num found; 0 once the snapshot
+ * is exhausted
+ */
+size_t cache_stale_names(struct cache *c, uint64_t *pos, const char **names, size_t n);
+
+/* Sum the counters of all shards */
+void cache_get_stats(struct cache *c, struct cache_stats *s);
+
+#endif
@@ -0,0 +1,694 @@
+/*
+ * File: dedup.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the dedup pre-pass. A partition file is a run
+ *      of records, each an 8-byte line num, a 4-byte length and the
+ *      line's bytes. The partitions that end up being deduplicated (the
+ *      leaves) are kept in the order they were done in, since that is
+ *      the order of their names in the names file and in the log: the
+ *      fan-out pass rebuilds each leaf's table from its records, which
+ *      puts every name at the same index again, and reads that many
+ *      answers off the log.
+ *
+ *      In ordered mode a range is loaded whole to be written in order,
+ *      so the ranges are sized from the budget, and one that still
+ *      comes out over it is split DEDUP_FANOUT ways by line num and its
+ *      parts are written one after another.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "dedup.h"
+
+/* Define macros:
+- MIN_INDEX: Slots of a table's index to begin with
+- MIN_POOL: Bytes of a table's text to begin with
+- IO_SIZE: Buffer size of the files read and written in bulk */
+#define MIN_INDEX 1024
+#define MIN_POOL (64 * 1024)
+#define IO_SIZE (1 << 20)
+
+/* A partition
+- f/off: The file, unlinked, and where its records start in it
+- level: 0 for a partition of the input, one more than its parent's for a split one
+- num_lines: Records in it
+- num_names: Distinct lines in it, once deduplicated */
+struct dedup_part{
+	FILE *f;
+	off_t off;
+	int level;
+	uint64_t num_lines;
+	uint64_t num_names;
+};
+
+/* A run of lines of the output in ordered mode
+- f: The answers of its lines, as records
+- first/num_lines: The lines it covers
+- bytes: What loading it takes: the answers, and where each one starts */
+struct dedup_range{
+	FILE *f;
+	uint64_t first;
+	uint64_t num_lines;
+	size_t bytes;
+};
+
+/* A distinct line
+- hash: hash_line() of it
+- off/len: Where its text is in the table's pool */
+struct dedup_entry{
+	uint64_t hash;
+	size_t off;
+	uint32_t len;
+};
+
+/* Table of the distinct lines of a partition
+- entries/num/cap: The lines, in the order first seen
+- pool/pool_len/pool_cap: Their text
+- index/mask: Open-addressing index of the entries by hash; UINT32_MAX is empty */
+struct dedup_table{
+	struct dedup_entry *entries;
+	uint32_t num;
+	uint32_t cap;
+	char *pool;
+	size_t pool_len;
+	size_t pool_cap;
+	uint32_t *index;
+	uint64_t mask;
+};
+
+/* The pre-pass
+- path: Temporary files are made as <path>.dedup.XXXXXX
+- budget: Bytes a table may take before its partition is split
+- parts/num_parts: Partitions of the input
+- leaves/num_leaves/cap_leaves: Partitions deduplicated, in order
+- spill: File the leaves of split partitions are moved to, so there are never more files open than partitions of the input
+- names/log: The names file and the log of its answers
+- table: Table reused by every partition
+- line/line_cap: Buffer records are read into
+- stats: What it did */
+struct dedup{
+	char *path;
+	size_t budget;
+	struct dedup_part *parts;
+	int num_parts;
+	struct dedup_part *leaves;
+	int num_leaves;
+	int cap_leaves;
+	FILE *spill;
+	FILE *names;
+	FILE *log;
+	struct dedup_table table;
+	char *line;
+	size_t line_cap;
+	struct dedup_stats stats;
+};
+
+/* Mix a 64-bit value so every bit of the result depends on every bit of x */
+static uint64_t mix(uint64_t x){
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+/* Map a mixed value onto 0..n-1 with a multiply rather than a divide */
+static uint64_t reduce(uint64_t x, uint64_t n){
+	return (uint64_t)(((unsigned __int128)x * n) >> 64);
+}
+
+/* FNV-1a of a line, mixed */
+static uint64_t hash_line(const char *line, size_t len){
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for(size_t i = 0; i < len; i++){
+		h = (h ^ (unsigned char)line[i]) * 0x100000001b3ULL;
+	}
+	return mix(h);
+}
+
+/* Partition of a line among n at level; each level hashes with its own seed, so a split spreads a partition out */
+static uint64_t part_of(uint64_t hash, int level, uint64_t n){
+	return reduce(mix(hash + (level + 1ULL) * 0x9e3779b97f4a7c15ULL), n);
+}
+
+/* Make an unlinked temporary file next to d->path */
+static FILE *temp_file(struct dedup *d){
+	size_t len = strlen(d->path) + sizeof(".dedup.XXXXXX");
+	char *path = malloc(len);
+	FILE *f = NULL;
+	int fd;
+
+	if(path == NULL){
+		return NULL;
+	}
+	snprintf(path, len, "%s.dedup.XXXXXX", d->path);
+	if((fd = mkstemp(path)) >= 0){
+		unlink(path);
+		if((f = fdopen(fd, "w+")) == NULL){
+			close(fd);
+		}
+	}
+	free(path);
+	return f;
+}
+
+static int write_record(FILE *f, uint64_t line_num, const char *line, uint32_t len){
+	if(fwrite(&line_num, sizeof(line_num), 1, f) != 1 || fwrite(&len, sizeof(len), 1, f) != 1
+		|| fwrite(line, 1, len, f) != len){
+		return -1;
+	}
+	return 0;
+}
+
+/* Read the next record into d->line. Returns 0, or -1 at the end of f */
+static int read_record(struct dedup *d, FILE *f, uint64_t *line_num, uint32_t *len){
+	if(fread(line_num, sizeof(*line_num), 1, f) != 1 || fread(len, sizeof(*len), 1, f) != 1){
+		return -1;
+	}
+	if(*len > d->line_cap || d->line == NULL){
+		char *line = realloc(d->line, *len + 1);
+		if(line == NULL){
+			return -1;
+		}
+		d->line = line;
+		d->line_cap = *len + 1;
+	}
+	return fread(d->line, 1, *len, f) == *len ? 0 : -1;
+}
+
+/* Bytes the lines in t take, the index at its most empty included; the table is reused, so this and not what it holds on to is what counts */
+static size_t table_bytes(struct dedup_table *t){
+	return t->pool_len + (size_t)t->num * (sizeof(*t->entries) + 2 * sizeof(*t->index));
+}
+
+static void table_clear(struct dedup_table *t){
+	t->num = 0;
+	t->pool_len = 0;
+	if(t->index != NULL){
+		memset(t->index, 0xff, (t->mask + 1) * sizeof(*t->index));
+	}
+}
+
+static void table_free(struct dedup_table *t){
+	free(t->entries);
+	free(t->pool);
+	free(t->index);
+	memset(t, 0, sizeof(*t));
+}
+
+/* Keep the index of t at most half full. Returns 0, or -1 if out of memory */
+static int grow_index(struct dedup_table *t){
+	uint64_t mask = t->mask ? t->mask * 2 + 1 : MIN_INDEX - 1;
+	uint32_t *index = malloc((mask + 1) * sizeof(*index));
+
+	if(index == NULL){
+		return -1;
+	}
+	memset(index, 0xff, (mask + 1) * sizeof(*index));
+	for(uint32_t i = 0; i < t->num; i++){
+		uint64_t j = t->entries[i].hash & mask;
+		while(index[j] != UINT32_MAX){
+			j = (j + 1) & mask;
+		}
+		index[j] = i;
+	}
+	free(t->index);
+	t->index = index;
+	t->mask = mask;
+	return 0;
+}
+
+/* Find line in t, adding it if it is new. Returns its index, or -1 if out of memory */
+static int64_t table_add(struct dedup_table *t, const char *line, uint32_t len){
+	uint64_t hash = hash_line(line, len);
+	uint64_t j;
+
+	if(t->index == NULL && grow_index(t) != 0){
+		return -1;
+	}
+	for(j = hash & t->mask; t->index[j] != UINT32_MAX; j = (j + 1) & t->mask){
+		struct dedup_entry *e = &t->entries[t->index[j]];
+		if(e->hash == hash && e->len == len && memcmp(t->pool + e->off, line, len) == 0){
+			return t->index[j];
+		}
+	}
+
+	if(t->num == t->cap){
+		uint32_t cap = t->cap ? t->cap * 2 : MIN_INDEX;
+		struct dedup_entry *entries = realloc(t->entries, cap * sizeof(*entries));
+		if(entries == NULL){
+			return -1;
+		}
+		t->entries = entries;
+		t->cap = cap;
+	}
+	if(t->pool_len + len > t->pool_cap){
+		size_t cap = t->pool_cap ? t->pool_cap * 2 : MIN_POOL;
+		while(cap < t->pool_len + len){
+			cap *= 2;
+		}
+		char *pool = realloc(t->pool, cap);
+		if(pool == NULL){
+			return -1;
+		}
+		t->pool = pool;
+		t->pool_cap = cap;
+	}
+	memcpy(t->pool + t->pool_len, line, len);
+	t->entries[t->num].hash = hash;
+	t->entries[t->num].off = t->pool_len;
+	t->entries[t->num].len = len;
+	t->pool_len += len;
+	t->index[j] = t->num;
+	if(++t->num * 2 > t->mask && grow_index(t) != 0){
+		return -1;
+	}
+	return t->num - 1;
+}
+
+/* Fill d->table with the distinct lines of part, stopping early if stop_over and it outgrows the budget.
+ * Returns 0, 1 if it stopped, or -1 */
+static int load_part(struct dedup *d, struct dedup_part *part, int stop_over){
+	uint64_t line_num;
+	uint32_t len;
+
+	table_clear(&d->table);
+	if(fseeko(part->f, part->off, SEEK_SET) != 0){
+		return -1;
+	}
+	for(uint64_t i = 0; i < part->num_lines; i++){
+		if(read_record(d, part->f, &line_num, &len) != 0 || table_add(&d->table, d->line, len) < 0){
+			return -1;
+		}
+		if(stop_over && table_bytes(&d->table) > d->budget){
+			table_free(&d->table);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Move the records of part to the end of d->spill, and close its own file. Returns 0, or -1 */
+static int move_part(struct dedup *d, struct dedup_part *part){
+	uint64_t line_num;
+	uint32_t len;
+	off_t off;
+
+	if((off = ftello(d->spill)) < 0 || fseeko(part->f, part->off, SEEK_SET) != 0){
+		return -1;
+	}
+	for(uint64_t i = 0; i < part->num_lines; i++){
+		if(read_record(d, part->f, &line_num, &len) != 0 || write_record(d->spill, line_num, d->line, len) != 0){
+			return -1;
+		}
+	}
+	fclose(part->f);
+	part->f = d->spill;
+	part->off = off;
+	return 0;
+}
+
+/* Spill part into DEDUP_FANOUT partitions one level down, and close it. Returns 0, or -1 */
+static int split_part(struct dedup *d, struct dedup_part *part, struct dedup_part *children){
+	uint64_t line_num;
+	uint32_t len;
+
+	for(int i = 0; i < DEDUP_FANOUT; i++){
+		children[i].off = 0;
+		children[i].level = part->level + 1;
+		children[i].num_lines = children[i].num_names = 0;
+		if((children[i].f = temp_file(d)) == NULL){
+			while(i-- > 0){
+				fclose(children[i].f);
+			}
+			return -1;
+		}
+	}
+	int ret = fseeko(part->f, part->off, SEEK_SET);
+	for(uint64_t i = 0; i < part->num_lines && ret == 0; i++){
+		if(read_record(d, part->f, &line_num, &len) != 0){
+			ret = -1;
+			break;
+		}
+		struct dedup_part *c = &children[part_of(hash_line(d->line, len), part->level + 1, DEDUP_FANOUT)];
+		ret = write_record(c->f, line_num, d->line, len);
+		c->num_lines++;
+	}
+	for(int i = 0; i < DEDUP_FANOUT; i++){
+		if(fflush(children[i].f) != 0){
+			ret = -1;
+		}
+	}
+	if(ret != 0){
+		for(int i = 0; i < DEDUP_FANOUT; i++){
+			fclose(children[i].f);
+		}
+		return -1;
+	}
+	fclose(part->f);
+	part->f = NULL;
+	d->stats.splits++;
+	return 0;
+}
+
+/* Deduplicate part, or the partitions it is split into, appending their distinct lines to the names file. Returns 0, or -1 */
+static int finish_part(struct dedup *d, struct dedup_part *part){
+	int ret = load_part(d, part, part->level < DEDUP_MAX_LEVEL);
+
+	if(ret == 1){
+		struct dedup_part children[DEDUP_FANOUT];
+		if(split_part(d, part, children) != 0){
+			return -1;
+		}
+		for(int i = 0; i < DEDUP_FANOUT; i++){
+			if(finish_part(d, &children[i]) != 0){
+				while(++i < DEDUP_FANOUT){
+					fclose(children[i].f);
+				}
+				return -1;
+			}
+		}
+		return 0;
+	}
+	if(ret != 0){
+		return -1;
+	}
+
+	for(uint32_t i = 0; i < d->table.num; i++){
+		struct dedup_entry *e = &d->table.entries[i];
+		if(fwrite(d->table.pool + e->off, 1, e->len, d->names) != e->len || putc('\n', d->names) == EOF){
+			return -1;
+		}
+	}
+	if(d->num_leaves == d->cap_leaves){
+		int cap = d->cap_leaves ? d->cap_leaves * 2 : DEDUP_MAX_PARTITIONS;
+		struct dedup_part *leaves = realloc(d->leaves, cap * sizeof(*leaves));
+		if(leaves == NULL){
+			return -1;
+		}
+		d->leaves = leaves;
+		d->cap_leaves = cap;
+	}
+	if(part->level > 0 && move_part(d, part) != 0){
+		return -1;
+	}
+	part->num_names = d->table.num;
+	d->leaves[d->num_leaves++] = *part;
+	part->f = NULL;
+	d->stats.names += part->num_names;
+	d->stats.partitions++;
+	return 0;
+}
+
+struct dedup *dedup_create(const char *path, size_t budget, size_t input_bytes){
+	struct dedup *d = calloc(1, sizeof(*d));
+
+	if(d == NULL || (d->path = strdup(path)) == NULL){
+		free(d);
+		return NULL;
+	}
+	d->budget = budget;
+
+	/* A distinct line takes about twice its size in a table, so that is what the partitions are sized for */
+	d->num_parts = budget > 0 ? (int)((input_bytes * 2 + budget - 1) / budget) : 1;
+	d->num_parts = d->num_parts < 1 ? 1 : d->num_parts > DEDUP_MAX_PARTITIONS ? DEDUP_MAX_PARTITIONS : d->num_parts;
+	if((d->parts = calloc(d->num_parts, sizeof(*d->parts))) == NULL){
+		dedup_destroy(d);
+		return NULL;
+	}
+	for(int i = 0; i < d->num_parts; i++){
+		if((d->parts[i].f = temp_file(d)) == NULL){
+			dedup_destroy(d);
+			return NULL;
+		}
+	}
+	return d;
+}
+
+int dedup_add(struct dedup *d, const char *line, size_t len){
+	struct dedup_part *part = &d->parts[part_of(hash_line(line, len), 0, d->num_parts)];
+
+	if(len > UINT32_MAX || write_record(part->f, d->stats.lines, line, (uint32_t)len) != 0){
+		return -1;
+	}
+	part->num_lines++;
+	d->stats.lines++;
+	return 0;
+}
+
+int dedup_finish(struct dedup *d, int *names_fd, int *log_fd){
+	if((d->names = temp_file(d)) == NULL || (d->log = temp_file(d)) == NULL || (d->spill = temp_file(d)) == NULL){
+		return -1;
+	}
+	setvbuf(d->names, NULL, _IOFBF, IO_SIZE);
+	for(int i = 0; i < d->num_parts; i++){
+		if(fflush(d->parts[i].f) != 0 || finish_part(d, &d->parts[i]) != 0){
+			return -1;
+		}
+	}
+
+	/* Split partitions were closed; the leaves own the rest */
+	free(d->parts);
+	d->parts = NULL;
+	table_free(&d->table);
+	if(fflush(d->names) != 0 || fflush(d->spill) != 0){
+		return -1;
+	}
+	*names_fd = fileno(d->names);
+	*log_fd = fileno(d->log);
+	return 0;
+}
+
+/* Cover num_lines lines from first with at most n ranges of equal num of lines. Returns the num of ranges made,
+  or -1 */
+static int make_ranges(struct dedup *d, struct dedup_range *ranges, int n, uint64_t first, uint64_t num_lines){
+	uint64_t per = (num_lines + n - 1) / n;
+	int made = 0;
+
+	per = per < 1 ? 1 : per;
+	for(uint64_t at = 0; at < num_lines; at += per, made++){
+		ranges[made].first = first + at;
+		ranges[made].num_lines = num_lines - at < per ? num_lines - at : per;
+		ranges[made].bytes = 0;
+		if((ranges[made].f = temp_file(d)) == NULL){
+			while(made-- > 0){
+				fclose(ranges[made].f);
+			}
+			return -1;
+		}
+	}
+	return made;
+}
+
+/* Spill the answer of line_num to its range among those made by make_ranges(). Returns 0, or -1 */
+static int spill_answer(struct dedup_range *ranges, uint64_t line_num, const char *s, uint32_t n){
+	struct dedup_range *r = &ranges[(line_num - ranges[0].first) / ranges[0].num_lines];
+
+	r->bytes += n + sizeof(uint64_t);
+	return write_record(r->f, line_num, s, n);
+}
+
+/* Write the lines of r to out in input order; a range over the budget is split and its parts written in turn.
+  Returns 0, or -1 */
+static int write_range(struct dedup *d, struct dedup_range *r, FILE *out){
+	uint64_t line_num;
+	uint32_t len;
+	int ret = 0;
+
+	if(fflush(r->f) != 0){
+		return -1;
+	}
+	rewind(r->f);
+	if(r->bytes > d->budget && r->num_lines > 1){
+		struct dedup_range parts[DEDUP_FANOUT];
+		int num = make_ranges(d, parts, DEDUP_FANOUT, r->first, r->num_lines);
+		if(num < 0){
+			return -1;
+		}
+		while(ret == 0 && read_record(d, r->f, &line_num, &len) == 0){
+			ret = spill_answer(parts, line_num, d->line, len);
+		}
+		for(int i = 0; i < num; i++){
+			if(ret == 0){
+				ret = write_range(d, &parts[i], out);
+			}
+			fclose(parts[i].f);
+		}
+		return ret;
+	}
+
+	/* Read the range into buf, noting where each line's answer starts */
+	uint64_t *at = malloc(r->num_lines * sizeof(*at));
+	char *buf = malloc(r->bytes + 1);
+	size_t used = 0;
+	if(at == NULL || buf == NULL){
+		ret = -1;
+	}
+	while(ret == 0 && read_record(d, r->f, &line_num, &len) == 0){
+		memcpy(buf + used, d->line, len);
+		at[line_num - r->first] = used;
+		used += len;
+	}
+
+	/* Every answer ends on its newline */
+	for(uint64_t i = 0; ret == 0 && i < r->num_lines; i++){
+		char *s = buf + at[i];
+		size_t n = (char *)memchr(s, '\n', buf + used - s) - s + 1;
+		if(fwrite(s, 1, n, out) != n){
+			ret = -1;
+		}
+	}
+	free(at);
+	free(buf);
+	return ret;
+}
+
+int dedup_fanout(struct dedup *d, int fd, int ordered){
+	FILE *out = NULL;
+	struct dedup_range *ranges = NULL;
+	int num_ranges = 0, ret = 0, dup_fd;
+	char *answer = NULL;
+	size_t answer_cap = 0;
+	size_t *starts = NULL;
+
+	if((dup_fd = dup(fd)) < 0 || (out = fdopen(dup_fd, "w")) == NULL){
+		if(dup_fd >= 0){
+			close(dup_fd);
+		}
+		return -1;
+	}
+	setvbuf(out, NULL, _IOFBF, IO_SIZE);
+
+	/* In ordered mode the answers are spilled by ranges of line nums, sized from the budget by the mean answer in
+	  the log; write_range() splits any that still come out over it */
+	if(ordered && d->stats.lines > 0){
+		off_t log_bytes = fseeko(d->log, 0, SEEK_END) == 0 ? ftello(d->log) : -1;
+		double mean = d->stats.names > 0 && log_bytes > 0 ? (double)log_bytes / d->stats.names : 0;
+		double bytes = d->stats.lines * (mean + sizeof(uint64_t));
+		double want = d->budget > 0 ? bytes / d->budget + 1 : 1;
+		num_ranges = want < DEDUP_MAX_PARTITIONS ? (int)want : DEDUP_MAX_PARTITIONS;
+		if((ranges = calloc(num_ranges, sizeof(*ranges))) == NULL
+			|| (num_ranges = make_ranges(d, ranges, num_ranges, 0, d->stats.lines)) < 0){
+			num_ranges = 0;
+			ret = -1;
+		}
+	}
+	rewind(d->log);
+
+	for(int k = 0; k < d->num_leaves && ret == 0; k++){
+		struct dedup_part *leaf = &d->leaves[k];
+		size_t used = 0;
+		uint64_t line_num;
+		uint32_t len;
+
+		/* The same records give the same table, so name i of the leaf is answered by its i-th line of the log */
+		size_t *s = realloc(starts, (leaf->num_names + 1) * sizeof(*starts));
+		if(s == NULL || load_part(d, leaf, 0) != 0){
+			starts = s != NULL ? s : starts;
+			ret = -1;
+			break;
+		}
+		starts = s;
+		for(uint64_t i = 0; i < leaf->num_names; i++){
+			ssize_t n = getline(&d->line, &d->line_cap, d->log);
+			if(n <= 0 || d->line[n - 1] != '\n'){
+				ret = -1;
+				break;
+			}
+			if(used + n > answer_cap){
+				size_t cap = answer_cap ? answer_cap * 2 : IO_SIZE;
+				while(cap < used + n){
+					cap *= 2;
+				}
+				char *a = realloc(answer, cap);
+				if(a == NULL){
+					ret = -1;
+					break;
+				}
+				answer = a;
+				answer_cap = cap;
+			}
+			starts[i] = used;
+			memcpy(answer + used, d->line, n);
+			used += n;
+		}
+		starts[leaf->num_names] = used;
+
+		/* Hand every line of the leaf its name's answer */
+		if(fseeko(leaf->f, leaf->off, SEEK_SET) != 0){
+			ret = -1;
+		}
+		for(uint64_t j = 0; ret == 0 && j < leaf->num_lines; j++){
+			int64_t i;
+			if(read_record(d, leaf->f, &line_num, &len) != 0 || (i = table_add(&d->table, d->line, len)) < 0){
+				ret = -1;
+				break;
+			}
+			const char *s = answer + starts[i];
+			size_t n = starts[i + 1] - starts[i];
+			if(ordered){
+				ret = spill_answer(ranges, line_num, s, (uint32_t)n);
+			}
+			else if(fwrite(s, 1, n, out) != n){
+				ret = -1;
+			}
+		}
+	}
+
+	for(int r = 0; r < num_ranges && ret == 0; r++){
+		ret = write_range(d, &ranges[r], out);
+	}
+	if(fclose(out) != 0){
+		ret = -1;
+	}
+	for(int r = 0; r < num_ranges; r++){
+		fclose(ranges[r].f);
+	}
+	free(ranges);
+	free(answer);
+	free(starts);
+	table_free(&d->table);
+	return ret;
+}
+
+void dedup_get_stats(struct dedup *d, struct dedup_stats *s){
+	*s = d->stats;
+}
+
+void dedup_destroy(struct dedup *d){
+	if(d == NULL){
+		return;
+	}
+	for(int i = 0; d->parts != NULL && i < d->num_parts; i++){
+		if(d->parts[i].f != NULL){
+			fclose(d->parts[i].f);
+		}
+	}
+	for(int i = 0; i < d->num_leaves; i++){
+		if(d->leaves[i].f != d->spill){
+			fclose(d->leaves[i].f);
+		}
+	}
+	if(d->spill != NULL){
+		fclose(d->spill);
+	}
+	if(d->names != NULL){
+		fclose(d->names);
+	}
+	if(d->log != NULL){
+		fclose(d->log);
+	}
+	table_free(&d->table);
+	free(d->parts);
+	free(d->leaves);
+	free(d->line);
+	free(d->path);
+	free(d);
+}
@@ -0,0 +1,83 @@
+/*
+ * File: dedup.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains declarations of the dedup pre-pass. Before
+ *      any requester starts, every input line is scanned (lowercased
+ *      and checked as it would be by a requester) and spilled to one of
+ *      a set of temporary partition files by the hash of its text, so
+ *      all copies of a line land in the same partition. Each partition
+ *      is then deduplicated on its own with a table of its distinct
+ *      lines; a partition whose table outgrows the memory budget is
+ *      split again with another hash instead. The distinct lines make
+ *      a names file that the pipelines read in place of the data files.
+ *
+ *      The resolvers write the names file's answers to a temporary log,
+ *      in its order, and the fan-out pass hands every input line the
+ *      answer of its distinct line, partition by partition. In ordered
+ *      mode the answers are spilled once more, by line number ranges,
+ *      and each range is written in input order.
+ *
+ */
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Define macros:
+- DEDUP_MAX_PARTITIONS: Partitions of the input limit; each is an open file
+- DEDUP_FANOUT: Partitions a partition over the budget is split into
+- DEDUP_MAX_LEVEL: Times a partition may be split; past that its table may outgrow the budget
+- DEDUP_REORDER_WINDOW: Reorder window of the writer when the names file is resolved without -o */
+#define DEDUP_MAX_PARTITIONS 256
+#define DEDUP_FANOUT 16
+#define DEDUP_MAX_LEVEL 4
+#define DEDUP_REORDER_WINDOW 16
+
+struct dedup;
+
+/* What a pre-pass did
+- lines: Input lines
+- names: Distinct lines among them
+- partitions: Partitions deduplicated, after splits
+- splits: Partitions split for outgrowing the budget */
+struct dedup_stats{
+	uint64_t lines;
+	uint64_t names;
+	int partitions;
+	int splits;
+};
+
+/* Start a pre-pass that keeps at most budget bytes of lines in memory
+ * at once. Its temporary files are made next to path and unlinked at
+ * once. input_bytes is the size of the input, or a guess; it sets the
+ * num of partitions. Returns NULL on failure
+ */
+struct dedup *dedup_create(const char *path, size_t budget, size_t input_bytes);
+
+/* Add the next input line, as scanned by reader_scan(), without its
+ * newline. Returns 0, or -1 if it could not be spilled
+ */
+int dedup_add(struct dedup *d, const char *line, size_t len);
+
+/* Deduplicate the partitions. Sets *names_fd to the names file, one
+ * distinct line per line, and *log_fd to the empty log its answers are
+ * to be written to, one line per name and in its order. Both stay
+ * open until dedup_destroy(). Returns 0, or -1
+ */
+int dedup_finish(struct dedup *d, int *names_fd, int *log_fd);
+
+/* Write the answer of every input line to fd, in input order if
+ * ordered. Call once the log is written. Returns 0, or -1
+ */
+int dedup_fanout(struct dedup *d, int fd, int ordered);
+
+/* Fill s with what the pre-pass did */
+void dedup_get_stats(struct dedup *d, struct dedup_stats *s);
+
+/* Close and free everything, temporary files included */
+void dedup_destroy(struct dedup *d);
+
+#endif
@@ -0,0 +1,175 @@
+/*
+ * File: flight.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the in-flight table. Entries only live while
+ *      their lookup is running: the leader unlinks its entry when it
+ *      publishes the answer, and the last of the leader and its
+ *      waiters to let go frees it.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "util.h"
+#include "queue.h"
+#include "stats.h"
+#include "flight.h"
+
+/* A lookup in flight
+- next: Next entry in the same shard
+- hash: Hash of the name
+- refs: Leader + waiters still holding the entry; guarded by the shard lock
+- done: Set once addrs holds the leader's answer
+- addrs: The answer; no addresses on failure
+- name: The domain name */
+struct flight_entry{
+	struct flight_entry *next;
+	uint64_t hash;
+	int refs;
+	atomic_int done;
+	struct addr_list addrs;
+	char name[];
+};
+
+/* One shard; waiters sleep on cond until a leader in the shard is done */
+struct flight_shard{
+	_Alignas(CACHE_LINE) pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct flight_entry *head;
+};
+
+struct flight{
+	struct flight_shard shards[FLIGHT_SHARDS];
+	atomic_ulong coalesced;
+};
+
+static struct flight_shard *get_shard(struct flight *f, uint64_t hash){
+	return &f->shards[hash & (FLIGHT_SHARDS - 1)];
+}
+
+/* Drop one reference to e; the caller holds the shard lock */
+static void release(struct flight_entry *e){
+	if(--e->refs == 0){
+		free(e);
+	}
+}
+
+struct flight *flight_create(void){
+	struct flight *f = aligned_alloc(CACHE_LINE, sizeof(*f));
+	if(f == NULL){
+		return NULL;
+	}
+	for(int i = 0; i < FLIGHT_SHARDS; i++){
+		pthread_mutex_init(&f->shards[i].lock, NULL);
+		pthread_cond_init(&f->shards[i].cond, NULL);
+		f->shards[i].head = NULL;
+	}
+	atomic_init(&f->coalesced, 0);
+	return f;
+}
+
+void flight_destroy(struct flight *f){
+	if(f == NULL){
+		return;
+	}
+	for(int i = 0; i < FLIGHT_SHARDS; i++){
+		pthread_mutex_destroy(&f->shards[i].lock);
+		pthread_cond_destroy(&f->shards[i].cond);
+	}
+	free(f);
+}
+
+struct flight_entry *flight_join(struct flight *f, const char *name){
+	uint64_t hash = hash_name(name);
+	struct flight_shard *s = get_shard(f, hash);
+	struct flight_entry *e;
+
+	pthread_mutex_lock(&s->lock);
+	for(e = s->head; e != NULL; e = e->next){
+		if(e->hash == hash && strcasecmp(e->name, name) == 0){
+			/* Someone is already looking this name up; wait for them */
+			e->refs++;
+			atomic_fetch_add_explicit(&f->coalesced, 1, memory_order_relaxed);
+			pthread_mutex_unlock(&s->lock);
+			return e;
+		}
+	}
+
+	/* First to claim the name; become its leader. If out of memory, lead without an entry */
+	size_t len = strlen(name);
+	e = malloc(sizeof(*e) + len + 1);
+	if(e != NULL){
+		e->hash = hash;
+		e->refs = 1;
+		atomic_init(&e->done, 0);
+		e->addrs.num = 0;
+		memcpy(e->name, name, len + 1);
+		e->next = s->head;
+		s->head = e;
+	}
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+void flight_done(struct flight *f, const char *name, const struct addr_list *addrs){
+	uint64_t hash = hash_name(name);
+	struct flight_shard *s = get_shard(f, hash);
+
+	pthread_mutex_lock(&s->lock);
+	for(struct flight_entry **pe = &s->head; *pe != NULL; pe = &(*pe)->next){
+		struct flight_entry *e = *pe;
+		if(e->hash == hash && strcasecmp(e->name, name) == 0){
+			/* Later claimants start a new lookup (or hit the cache) */
+			*pe = e->next;
+			e->addrs = *addrs;
+			atomic_store_explicit(&e->done, 1, memory_order_release);
+			pthread_cond_broadcast(&s->cond);
+			release(e);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+void flight_wait(struct flight *f, struct flight_entry *e, struct addr_list *addrs){
+	struct flight_shard *s = get_shard(f, e->hash);
+
+	pthread_mutex_lock(&s->lock);
+	while(!atomic_load_explicit(&e->done, memory_order_acquire)){
+		pthread_cond_wait(&s->cond, &s->lock);
+		stats_count(STAT_WAKEUPS, 1);
+	}
+	*addrs = e->addrs;
+	release(e);
+	pthread_mutex_unlock(&s->lock);
+}
+
+int flight_poll(struct flight *f, struct flight_entry *e, struct addr_list *addrs){
+	if(!atomic_load_explicit(&e->done, memory_order_acquire)){
+		return -1;
+	}
+	struct flight_shard *s = get_shard(f, e->hash);
+	pthread_mutex_lock(&s->lock);
+	*addrs = e->addrs;
+	release(e);
+	pthread_mutex_unlock(&s->lock);
+	return 0;
+}
+
+void flight_leave(struct flight *f, struct flight_entry *e){
+	struct flight_shard *s = get_shard(f, e->hash);
+	pthread_mutex_lock(&s->lock);
+	release(e);
+	pthread_mutex_unlock(&s->lock);
+}
+
+uint64_t flight_coalesced(struct flight *f){
+	return atomic_load_explicit(&f->coalesced, memory_order_relaxed);
+}
@@ -0,0 +1,56 @@
+/*
+ * File: flight.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains declarations of the in-flight table that
+ *      coalesces concurrent lookups of the same hostname. The first
+ *      resolver to claim a name looks it up; resolvers that claim the
+ *      same name meanwhile wait for that answer instead of sending
+ *      their own query.
+ *
+ */
+
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Define macros:
+- FLIGHT_SHARDS: Num of independently locked shards; must be a power of two */
+#define FLIGHT_SHARDS 64
+
+struct flight;
+struct flight_entry;
+struct addr_list;
+
+/* Create an empty in-flight table; returns NULL if out of memory */
+struct flight *flight_create(void);
+
+/* Free an in-flight table; no lookup may still be in flight */
+void flight_destroy(struct flight *f);
+
+/* Claim name. Returns NULL if the caller is the leader and must look
+ * the name up and call flight_done(); otherwise returns the lookup to
+ * wait on with flight_wait() or flight_poll()
+ */
+struct flight_entry *flight_join(struct flight *f, const char *name);
+
+/* Publish the leader's answer for name (no addresses on failure) and wake its waiters */
+void flight_done(struct flight *f, const char *name, const struct addr_list *addrs);
+
+/* Block until the leader is done and copy its answer into addrs */
+void flight_wait(struct flight *f, struct flight_entry *e, struct addr_list *addrs);
+
+/* Non-blocking flight_wait(). Returns 0 and copies the answer if the
+ * leader is done, -1 if it is still looking the name up
+ */
+int flight_poll(struct flight *f, struct flight_entry *e, struct addr_list *addrs);
+
+/* Drop a claim that flight_join() returned without waiting for its answer */
+void flight_leave(struct flight *f, struct flight_entry *e);
+
+/* Num of lookups that waited on another resolver instead of querying */
+uint64_t flight_coalesced(struct flight *f);
+
+#endif
@@ -0,0 +1,352 @@
+/*
+ * File: hedge.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the hedging backend. Lookup threads are
+ *      started as jobs queue up and stay for the rest of the run; a
+ *      job is shared by the resolver waiting on it and every task
+ *      queued for it, and is freed by whoever lets go of it last, so a
+ *      resolver can walk away at its deadline without waiting for a
+ *      call it cannot cancel.
+ *
+ *      The lookup threads are detached. shutdown() waits for the last
+ *      of them to leave, busy ones once their call returns, before it
+ *      frees the state and shuts the wrapped backend down, so none is
+ *      ever left calling into a freed backend.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "util.h"
+#include "hist.h"
+#include "stats.h"
+#include "hedge.h"
+
+/* A resolver waiting on a batch
+- cond: Signalled when its last name is answered
+- remaining: Names of the batch without an answer */
+struct hedge_batch{
+	pthread_cond_t cond;
+	int remaining;
+};
+
+/* A name being looked up
+- batch: The resolver waiting on it; NULL once the resolver has left
+- refs: The resolver plus every task queued or running for it
+- done: Set by the first answer
+- hedged: Set once a second task has been queued
+- start: When the resolver queued it
+- status/addrs: The first answer
+- ns: Time from start to the first answer
+- name: The domain name */
+struct hedge_job{
+	struct hedge_batch *batch;
+	int refs;
+	int done;
+	int hedged;
+	unsigned long long start;
+	int status;
+	unsigned long long ns;
+	struct addr_list addrs;
+	char name[];
+};
+
+/* One request for a job; a hedged job has two */
+struct hedge_task{
+	struct hedge_task *next;
+	struct hedge_job *job;
+};
+
+/* The hedging state
+- backend/state: The wrapped backend
+- deadline_ns: Time a resolver waits for a batch
+- quantile: Hedge percentile, as a fraction
+- lock: Guards everything below and every job
+- work: Idle lookup threads wait here for tasks
+- left: Signalled when the last lookup thread leaves after shutdown()
+- head/tail/queued: Tasks not yet taken
+- workers/idle: Lookup threads, and those without a task
+- closing: Set by shutdown()
+- latency: Time to the first answer of every job, in ns */
+struct hedge{
+	const struct resolver_backend *backend;
+	void *state;
+	unsigned long long deadline_ns;
+	double quantile;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t left;
+	struct hedge_task *head;
+	struct hedge_task *tail;
+	int queued;
+	int workers;
+	int idle;
+	int closing;
+	struct hist latency;
+};
+
+static unsigned long long now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Drop one reference to job; the caller holds the lock */
+static void put_job(struct hedge_job *job){
+	if(--job->refs == 0){
+		free(job);
+	}
+}
+
+/* Queue a task for job; the caller holds the lock */
+static int queue_task(struct hedge *h, struct hedge_job *job){
+	struct hedge_task *t = malloc(sizeof(*t));
+	if(t == NULL){
+		return -1;
+	}
+	t->next = NULL;
+	t->job = job;
+	job->refs++;
+	if(h->tail){
+		h->tail->next = t;
+	}
+	else{
+		h->head = t;
+	}
+	h->tail = t;
+	h->queued++;
+	return 0;
+}
+
+static void destroy(struct hedge *h){
+	while(h->head != NULL){
+		struct hedge_task *t = h->head;
+		h->head = t->next;
+		put_job(t->job);
+		free(t);
+	}
+	h->backend->shutdown(h->state);
+	pthread_mutex_destroy(&h->lock);
+	pthread_cond_destroy(&h->work);
+	pthread_cond_destroy(&h->left);
+	free(h);
+}
+
+static void *worker_main(void *arg){
+	struct hedge *h = arg;
+	struct addr_list addrs;
+
+	pthread_mutex_lock(&h->lock);
+	while(1){
+		while(h->head == NULL && !h->closing){
+			pthread_cond_wait(&h->work, &h->lock);
+		}
+		if(h->head == NULL){
+			break;
+		}
+		struct hedge_task *t = h->head;
+		struct hedge_job *job = t->job;
+		h->head = t->next;
+		if(h->head == NULL){
+			h->tail = NULL;
+		}
+		h->queued--;
+		free(t);
+
+		/* Answered by the other task, or nobody is waiting any more */
+		if(job->done || job->batch == NULL){
+			put_job(job);
+			continue;
+		}
+
+		h->idle--;
+		pthread_mutex_unlock(&h->lock);
+		int status = h->backend->resolve(h->state, job->name, &addrs);
+		pthread_mutex_lock(&h->lock);
+		h->idle++;
+
+		/* First answer wins; a late one still tells how long lookups take */
+		if(!job->done){
+			job->done = 1;
+			job->ns = now_ns() - job->start;
+			hist_record(&h->latency, job->ns);
+			if(job->batch != NULL){
+				job->status = status;
+				job->addrs = addrs;
+				if(status != UTIL_SUCCESS){
+					job->addrs.num = 0;
+				}
+				if(--job->batch->remaining == 0){
+					pthread_cond_signal(&job->batch->cond);
+				}
+			}
+		}
+		put_job(job);
+	}
+
+	h->idle--;
+	if(--h->workers == 0){
+		pthread_cond_signal(&h->left);
+	}
+	pthread_mutex_unlock(&h->lock);
+	return NULL;
+}
+
+/* Start lookup threads until every queued task has one; the caller holds the lock */
+static void add_workers(struct hedge *h){
+	pthread_attr_t attr;
+	pthread_t tid;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	while(h->queued > h->idle && h->workers < HEDGE_MAX_WORKERS){
+		if(pthread_create(&tid, &attr, worker_main, h) != 0){
+			break;
+		}
+		h->workers++;
+		h->idle++;
+	}
+	pthread_attr_destroy(&attr);
+}
+
+static int hedge_init(void **state, const char *options){
+	(void)state;
+	(void)options;
+	fprintf(stderr, "The hedge backend is set up with hedge_wrap()\n");
+	return UTIL_FAILURE;
+}
+
+static void hedge_resolve_batch(void *state, const char **hostnames, struct addr_list **addrs, int *status,
+	unsigned long long *ns, int n){
+	struct hedge *h = state;
+	struct hedge_job *jobs[n];
+	struct hedge_batch b;
+	pthread_condattr_t attr;
+	unsigned long long start = now_ns(), hedge_at = 0, deadline = start + h->deadline_ns;
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&b.cond, &attr);
+	pthread_condattr_destroy(&attr);
+	b.remaining = 0;
+
+	pthread_mutex_lock(&h->lock);
+	if(h->latency.count >= HEDGE_MIN_SAMPLES){
+		hedge_at = start + hist_quantile(&h->latency, h->quantile);
+	}
+	for(int i = 0; i < n; i++){
+		size_t len = strlen(hostnames[i]);
+		struct hedge_job *job = jobs[i] = malloc(sizeof(*job) + len + 1);
+		if(job == NULL){
+			continue;
+		}
+		job->batch = &b;
+		job->refs = 1;
+		job->done = 0;
+		job->hedged = 0;
+		job->start = start;
+		memcpy(job->name, hostnames[i], len + 1);
+		if(queue_task(h, job) != 0){
+			put_job(job);
+			jobs[i] = NULL;
+			continue;
+		}
+		b.remaining++;
+	}
+	add_workers(h);
+	pthread_cond_broadcast(&h->work);
+
+	/* Wait for the answers; hedge the slow names once, and give up on the rest at the deadline */
+	while(b.remaining > 0){
+		unsigned long long now = now_ns();
+		if(now >= deadline){
+			break;
+		}
+		if(hedge_at != 0 && now >= hedge_at){
+			for(int i = 0; i < n; i++){
+				if(jobs[i] != NULL && !jobs[i]->done && !jobs[i]->hedged && queue_task(h, jobs[i]) == 0){
+					jobs[i]->hedged = 1;
+					stats_count(STAT_HEDGES, 1);
+				}
+			}
+			add_workers(h);
+			pthread_cond_broadcast(&h->work);
+			hedge_at = 0;
+		}
+		unsigned long long until = hedge_at != 0 && hedge_at < deadline ? hedge_at : deadline;
+		struct timespec ts = {(time_t)(until / 1000000000ULL), (long)(until % 1000000000ULL)};
+		pthread_cond_timedwait(&b.cond, &h->lock, &ts);
+	}
+
+	for(int i = 0; i < n; i++){
+		struct hedge_job *job = jobs[i];
+		if(job != NULL && job->done){
+			status[i] = job->status;
+			ns[i] = job->ns;
+			*addrs[i] = job->addrs;
+		}
+		else{
+			status[i] = job != NULL ? UTIL_TIMEOUT : UTIL_FAILURE;
+			ns[i] = job != NULL ? now_ns() - start : 0;
+			memset(addrs[i], 0, sizeof(*addrs[i]));
+			addrs[i]->timed_out = job != NULL;
+		}
+		if(job != NULL){
+			job->batch = NULL;
+			put_job(job);
+		}
+	}
+	pthread_mutex_unlock(&h->lock);
+	pthread_cond_destroy(&b.cond);
+}
+
+static int hedge_resolve(void *state, const char *hostname, struct addr_list *addrs){
+	int status;
+	unsigned long long ns;
+	hedge_resolve_batch(state, &hostname, &addrs, &status, &ns, 1);
+	return status;
+}
+
+static void hedge_shutdown(void *state){
+	struct hedge *h = state;
+
+	/* Idle lookup threads leave at once, busy ones after their call */
+	pthread_mutex_lock(&h->lock);
+	h->closing = 1;
+	pthread_cond_broadcast(&h->work);
+	while(h->workers > 0){
+		pthread_cond_wait(&h->left, &h->lock);
+	}
+	pthread_mutex_unlock(&h->lock);
+	destroy(h);
+}
+
+const struct resolver_backend hedge_backend = {
+	"hedge",
+	hedge_init,
+	hedge_resolve,
+	hedge_resolve_batch,
+	hedge_shutdown
+};
+
+int hedge_wrap(const struct resolver_backend *backend, void *state, int deadline_ms, int percentile, void **hedged){
+	struct hedge *h = calloc(1, sizeof(*h));
+	if(h == NULL){
+		return UTIL_FAILURE;
+	}
+	h->backend = backend;
+	h->state = state;
+	h->deadline_ns = (unsigned long long)deadline_ms * 1000000ULL;
+	h->quantile = percentile / 100.0;
+	pthread_mutex_init(&h->lock, NULL);
+	pthread_cond_init(&h->work, NULL);
+	pthread_cond_init(&h->left, NULL);
+	hist_init(&h->latency);
+	*hedged = h;
+	return UTIL_SUCCESS;
+}
@@ -0,0 +1,47 @@
+/*
+ * File: hedge.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the declaration of the hedging backend, which
+ *      puts deadlines on a blocking backend. It wraps another backend:
+ *      each name of a batch becomes a job for a pool of lookup
+ *      threads, and the resolver only waits for the answers. A name
+ *      still unanswered once the batch has taken longer than the
+ *      running <percentile> of lookup latency gets a second job, and
+ *      the first answer wins. A name unanswered at the deadline comes
+ *      back as UTIL_TIMEOUT and the resolver moves on; a lookup thread
+ *      stuck in a call finishes it in the background and its answer
+ *      is dropped. shutdown() waits for those calls to return.
+ *
+ *      The mock's delay follows from the name, so against it a second
+ *      job is never faster; hedging pays off against real resolvers
+ *      and lossy networks.
+ *
+ */
+
+#ifndef HEDGE_H
+#define HEDGE_H
+
+#include "util.h"
+
+/* Define macros:
+- HEDGE_MAX_WORKERS: Most lookup threads; jobs queue beyond that
+- HEDGE_MIN_SAMPLES: Lookups to see before the percentile is trusted and anything is hedged
+- HEDGE_DEFAULT_PERCENTILE: Hedge percentile unless told otherwise */
+#define HEDGE_MAX_WORKERS 256
+#define HEDGE_MIN_SAMPLES 32
+#define HEDGE_DEFAULT_PERCENTILE 95
+
+/* The hedging backend; it is set up with hedge_wrap(), not init() */
+extern const struct resolver_backend hedge_backend;
+
+/* Wrap backend, already set up with state, in deadlines of deadline_ms
+ * and hedging at percentile (1 to 99). The hedging backend owns state
+ * from now on and shuts backend down with its own shutdown(), which
+ * returns only once no lookup thread is calling into backend, so
+ * whatever backend depends on may be torn down after it. Stores
+ * the hedging state in *hedged; returns UTIL_SUCCESS or UTIL_FAILURE
+ */
+int hedge_wrap(const struct resolver_backend *backend, void *state, int deadline_ms, int percentile, void **hedged);
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * File: hist.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the latency histogram. Values below
+ *      2^HIST_SUB_BITS get a bucket each; above that, the top bit of a
+ *      value picks its power of two and the next HIST_SUB_BITS bits
+ *      pick the bucket within it.
+ *
+ */
+
+#include <string.h>
+
+#include "hist.h"
+
+#define SUB_COUNT (1 << HIST_SUB_BITS)
+
+static int bucket_of(uint64_t value){
+	if(value < SUB_COUNT){
+		return (int)value;
+	}
+	int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+	return ((shift + 1) << HIST_SUB_BITS) + (int)((value >> shift) & (SUB_COUNT - 1));
+}
+
+/* Middle of the range of values that land in bucket b */
+static uint64_t value_of(int b){
+	if(b < SUB_COUNT){
+		return b;
+	}
+	int shift = (b >> HIST_SUB_BITS) - 1;
+	uint64_t low = (uint64_t)(SUB_COUNT + (b & (SUB_COUNT - 1))) << shift;
+	return low + (((uint64_t)1 << shift) >> 1);
+}
+
+void hist_init(struct hist *h){
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+void hist_record(struct hist *h, uint64_t value){
+	h->buckets[bucket_of(value)]++;
+	h->count++;
+	h->sum += value;
+	if(value < h->min){
+		h->min = value;
+	}
+	if(value > h->max){
+		h->max = value;
+	}
+}
+
+void hist_merge(struct hist *dst, const struct hist *src){
+	for(int i = 0; i < HIST_BUCKETS; i++){
+		dst->buckets[i] += src->buckets[i];
+	}
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if(src->min < dst->min){
+		dst->min = src->min;
+	}
+	if(src->max > dst->max){
+		dst->max = src->max;
+	}
+}
+
+uint64_t hist_quantile(const struct hist *h, double q){
+	if(h->count == 0){
+		return 0;
+	}
+	uint64_t rank = (uint64_t)(q * (h->count - 1)) + 1;
+	uint64_t seen = 0;
+	for(int i = 0; i < HIST_BUCKETS; i++){
+		seen += h->buckets[i];
+		if(seen >= rank){
+			/* The bucket's middle, but never outside what was actually recorded */
+			uint64_t v = value_of(i);
+			return v < h->min ? h->min : v > h->max ? h->max : v;
+		}
+	}
+	return h->max;
+}
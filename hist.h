@@ -0,0 +1,50 @@
+/*
+ * File: hist.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains declarations of the latency histogram. It is
+ *      log-linear like an HDR histogram: every power of two is split
+ *      into 2^HIST_SUB_BITS equal buckets, so any value is kept to
+ *      within about 6% with a fixed, small table and no allocation.
+ *      Each thread records into its own histogram; they are merged
+ *      when the numbers are reported.
+ *
+ */
+
+#ifndef HIST_H
+#define HIST_H
+
+#include <stdint.h>
+
+/* Define macros:
+- HIST_SUB_BITS: log2 of the num of buckets per power of two
+- HIST_BUCKETS: Num of buckets needed to cover every uint64_t */
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+/* A histogram
+- count: Num of values recorded
+- sum: Sum of the values
+- min/max: Smallest and largest value
+- buckets: Num of values per bucket */
+struct hist{
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t buckets[HIST_BUCKETS];
+};
+
+/* Empty a histogram */
+void hist_init(struct hist *h);
+
+/* Record one value */
+void hist_record(struct hist *h, uint64_t value);
+
+/* Add everything recorded in src to dst */
+void hist_merge(struct hist *dst, const struct hist *src);
+
+/* Value at quantile q (0 to 1); 0 if nothing was recorded */
+uint64_t hist_quantile(const struct hist *h, double q);
+
+#endif
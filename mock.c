@@ -0,0 +1,207 @@
+/*
+ * File: mock.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the mock resolver backend. Like the dns
+ *      backend, it blocks on one name after another, so a batch takes
+ *      the sum of its names' delays.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "mock.h"
+
+/* Latency distributions */
+enum mock_dist{
+	MOCK_FIXED,
+	MOCK_UNIFORM,
+	MOCK_LONGTAIL
+};
+
+/* State of the mock backend
+- dist: Latency distribution
+- a/b: fixed: the delay; uniform: min and max; longtail: median and alpha
+- fail: Fraction of names that fail
+- seed: Mixed into every hash */
+struct mock{
+	enum mock_dist dist;
+	double a;
+	double b;
+	double fail;
+	uint64_t seed;
+};
+
+/* splitmix64 finalizer; spreads a hash over all 64 bits */
+static uint64_t mix(uint64_t x){
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+/* A uniform number in [0, 1) */
+static double unit(uint64_t x){
+	return (x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Delay of a name in us */
+static double delay_us(const struct mock *m, uint64_t h){
+	double u = unit(mix(h));
+	switch(m->dist){
+		case MOCK_UNIFORM:
+			return m->a + u * (m->b - m->a);
+		case MOCK_LONGTAIL:{
+			/* Pareto with the given median: xm = median / 2^(1/alpha) */
+			double xm = m->a / pow(2.0, 1.0 / m->b);
+			double d = xm / pow(1.0 - u, 1.0 / m->b);
+			return d < m->a * MOCK_TAIL_CAP ? d : m->a * MOCK_TAIL_CAP;
+		}
+		default:
+			return m->a;
+	}
+}
+
+/* Fill in the answer for a name with hash h, a 10.x.y.z and an fdxx:: address; returns UTIL_SUCCESS or UTIL_FAILURE */
+static int answer(const struct mock *m, uint64_t h, struct addr_list *addrs){
+	uint64_t x = mix(h ^ 0x5bd1e995ULL);
+	uint64_t y = mix(x);
+	memset(addrs, 0, sizeof(*addrs));
+	if(unit(x) < m->fail){
+		return UTIL_FAILURE;
+	}
+	addrs->addrs[0].family = AF_INET;
+	addrs->addrs[0].v4.s_addr = htonl(10U << 24 | (uint32_t)(x >> 40));
+	addrs->addrs[1].family = AF_INET6;
+	addrs->addrs[1].v6.s6_addr[0] = 0xfd;
+	for(int i = 1; i < 8; i++){
+		addrs->addrs[1].v6.s6_addr[i] = (uint8_t)(y >> (8 * i));
+	}
+	addrs->addrs[1].v6.s6_addr[15] = 1;
+	addrs->num = 2;
+	return UTIL_SUCCESS;
+}
+
+static unsigned long long now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_us(double us){
+	struct timespec ts;
+	ts.tv_sec = (time_t)(us / 1e6);
+	ts.tv_nsec = (long)((us - ts.tv_sec * 1e6) * 1e3);
+	while(nanosleep(&ts, &ts) != 0){
+	}
+}
+
+/* Parse "<latency>[,fail=<rate>][,seed=<n>]" into m; returns 0, or -1 if it is malformed */
+static int parse(struct mock *m, const char *options){
+	char *end;
+	const char *opt;
+
+	m->fail = 0;
+	m->seed = 0;
+	if(strncmp(options, "fixed:", 6) == 0){
+		m->dist = MOCK_FIXED;
+		m->a = strtod(options + 6, &end);
+		m->b = m->a;
+	}
+	else if(strncmp(options, "uniform:", 8) == 0){
+		m->dist = MOCK_UNIFORM;
+		m->a = strtod(options + 8, &end);
+		if(*end != '-'){
+			return -1;
+		}
+		m->b = strtod(end + 1, &end);
+	}
+	else if(strncmp(options, "longtail:", 9) == 0){
+		m->dist = MOCK_LONGTAIL;
+		m->a = strtod(options + 9, &end);
+		m->b = MOCK_DEFAULT_ALPHA;
+		if(*end == ':'){
+			m->b = strtod(end + 1, &end);
+		}
+		if(m->b <= 0){
+			return -1;
+		}
+	}
+	else{
+		return -1;
+	}
+	if(m->a < 0 || (m->dist == MOCK_UNIFORM && m->b < m->a)){
+		return -1;
+	}
+
+	/* The rest are ",key=value" pairs */
+	for(opt = end; *opt == ','; opt = end){
+		if(strncmp(opt, ",fail=", 6) == 0){
+			m->fail = strtod(opt + 6, &end);
+			if(m->fail < 0 || m->fail > 1){
+				return -1;
+			}
+		}
+		else if(strncmp(opt, ",seed=", 6) == 0){
+			m->seed = strtoull(opt + 6, &end, 10);
+		}
+		else{
+			return -1;
+		}
+		if(end == opt + 6){
+			return -1;
+		}
+	}
+	return *opt == 0 ? 0 : -1;
+}
+
+static int mock_init(void **state, const char *options){
+	struct mock *m = malloc(sizeof(*m));
+	if(m == NULL){
+		return UTIL_FAILURE;
+	}
+	if(options == NULL || parse(m, options) != 0){
+		fprintf(stderr, "Mock backend options must be fixed:<us>, uniform:<us>-<us> or longtail:<us>[:<alpha>],"
+			" optionally followed by ,fail=<rate> and ,seed=<n>\n");
+		free(m);
+		return UTIL_FAILURE;
+	}
+	*state = m;
+	return UTIL_SUCCESS;
+}
+
+static int mock_resolve(void *state, const char *hostname, struct addr_list *addrs){
+	struct mock *m = state;
+	uint64_t h = hash_name(hostname) ^ m->seed;
+	sleep_us(delay_us(m, h));
+	return answer(m, h, addrs);
+}
+
+static void mock_resolve_batch(void *state, const char **hostnames, struct addr_list **addrs,
+	int *status, unsigned long long *ns, int n){
+	unsigned long long start = now_ns();
+	for(int i = 0; i < n; i++){
+		status[i] = mock_resolve(state, hostnames[i], addrs[i]);
+		unsigned long long end = now_ns();
+		ns[i] = end - start;
+		start = end;
+	}
+}
+
+static void mock_shutdown(void *state){
+	free(state);
+}
+
+const struct resolver_backend mock_backend = {
+	"mock",
+	mock_init,
+	mock_resolve,
+	mock_resolve_batch,
+	mock_shutdown
+};
@@ -0,0 +1,32 @@
+/*
+ * File: mock.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the declaration of the mock resolver
+ *      backend. It answers every name with a synthetic 10.x.y.z and
+ *      fdxx:: address after a synthetic delay, without touching the
+ *      network, so runs on any machine can be compared.
+ *
+ *      Options are "<latency>[,fail=<rate>][,seed=<n>]", times in us:
+ *      - fixed:<us>
+ *      - uniform:<min us>-<max us>
+ *      - longtail:<median us>[:<alpha>] (Pareto; alpha defaults to 1.5)
+ *      Delay, address and failure all follow from a hash of the name
+ *      and the seed, so the same input gives the same run every time.
+ *
+ */
+
+#ifndef MOCK_H
+#define MOCK_H
+
+#include "util.h"
+
+/* Define macros:
+- MOCK_DEFAULT_ALPHA: Shape of the long-tail distribution unless given
+- MOCK_TAIL_CAP: Longest long-tail delay, in multiples of the median */
+#define MOCK_DEFAULT_ALPHA 1.5
+#define MOCK_TAIL_CAP 1000
+
+extern const struct resolver_backend mock_backend;
+
+#endif
@@ -4,9 +4,29 @@
 - ctype.h: Allows isdigit()
 - string.h: Allows strlen()
 - pthread.h: Allows usage of pthreads
-- unistd.h: Allows gettid()
+- unistd.h: Allows gettid() and getopt()
 - sys/syscall.h: Allows syscall()
-- util.h: Allows dns_lookup() */
+- stdatomic.h: Allows atomic counters
+- time.h: Allows clock_gettime() and nanosleep()
+- util.h: Allows dns_lookup()
+- queue.h: Allows the lock-free ring buffer
+- adns.h: Allows the asynchronous DNS engine
+- cache.h: Allows the resolution cache
+- flight.h: Allows coalescing of concurrent lookups of one name
+- reader.h: Allows mmap'd, chunked reading of data files and scanning of their lines
+- steal.h: Allows work stealing of chunks between producers
+- writer.h: Allows the log-writer thread
+- arena.h: Allows slab storage of names read from streams
+- mock.h: Allows the mock resolver backend
+- hist.h: Allows latency histograms
+- stats.h: Allows per-stage latency histograms and counters
+- hedge.h: Allows deadlines and hedged requests for blocking lookups
+- server.h: Allows the daemon's socket and client mode
+- zone.h: Allows the compiled local zone database
+- affinity.h: Allows pinning each pipeline to a CPU
+- dedup.h: Allows the dedup pre-pass over the data files
+- procs.h: Allows resolving in worker processes over shared-memory rings
+- multi-lookup.h: Declares run_lookup() for the benchmark driver */
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
@@ -14,45 +34,100 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <sys/syscall.h>
-#include <sys/time.h>
+#include <stdatomic.h>
+#include <time.h>
 #include "util.h"
+#include "queue.h"
+#include "adns.h"
+#include "cache.h"
+#include "flight.h"
+#include "reader.h"
+#include "steal.h"
+#include "writer.h"
+#include "arena.h"
+#include "mock.h"
+#include "hist.h"
+#include "stats.h"
+#include "hedge.h"
+#include "server.h"
+#include "zone.h"
+#include "affinity.h"
+#include "dedup.h"
+#include "procs.h"
+#include "multi-lookup.h"
 
 /* Define macros:
 - gettid(): Allows gettid()
-- MAX_NAME_LENGTH: Domain name length limit
-- MAX_PRODUCE: Num producer threads limit
-- MAX_CONSUMER: Num consumer threads limit
 - MAX_DATA_FILES: Num data files limit
 - MAX_ARGUMENTS: Num argc limit
-- BUFFER_SIZE: Size of shared memory buffer */
+- DEFAULT_BUFFER_SIZE: Num of names the shared buffer holds unless -d is given
+- MAX_BUFFER_SIZE: Shared buffer size limit
+- MAX_BATCH_SIZE: Batch size limit
+- DEFAULT_BATCH_SIZE: Names moved per ring operation unless -b is given
+- ASYNC_POLL_MS: Longest wait of an async resolver that has nothing else to do
+- CONTROL_INTERVAL_MS: Time between two samples of the adaptive resolver pool's controller
+- SHRINK_SAMPLES: Num of samples in a row the buffer must be nearly empty before the pool shrinks
+- CPU_BOUND_NS: Mean lookup time under which resolvers are busy on the CPU rather than waiting,
+  so the pool does not grow past the num of cores
+- CLIENT_READ_SIZE: Bytes a requester reads from a daemon client at once; longer lines are too long anyway
+- MAX_PIPELINES: Pipelines limit
+- MERGE_BUF_SIZE: Bytes copied at once when the pipelines' logs are merged */
 #define gettid() syscall(SYS_gettid)
-#define MAX_NAME_LENGTH 1025
-#define MAX_PRODUCER 5
-#define MAX_CONSUMER 10
 #define MAX_DATA_FILES 10
 #define MAX_ARGUMENTS 15
-#define BUFFER_SIZE 20
+#define DEFAULT_BUFFER_SIZE 16384
+#define MAX_BUFFER_SIZE (1 << 22)
+#define MAX_BATCH_SIZE 1024
+#define DEFAULT_BATCH_SIZE 16
+#define ASYNC_POLL_MS 100
+#define CONTROL_INTERVAL_MS 50
+#define SHRINK_SAMPLES 4
+#define CPU_BOUND_NS 100000
+#define CLIENT_READ_SIZE (64 * 1024)
+#define MAX_PIPELINES 1024
+#define MERGE_BUF_SIZE (1 << 20)
 
 /* Synchronization tools:
-- condition variable
-- mutex lock */
-pthread_cond_t full = PTHREAD_COND_INITIALIZER;
-pthread_cond_t empty = PTHREAD_COND_INITIALIZER;
-pthread_mutex_t mutex_p = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t mutex_c = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t mutex_temp = PTHREAD_MUTEX_INITIALIZER;
+- Data files, streams included, are handed out as chunks by work stealing (steal.c)
+- The buffer itself is a lock-free ring (queue.c)
+- Resolvers hand full output buffers to the log-writer thread (writer.c)
+- With -P, each pipeline has all of the above to itself (struct pipeline)
+- With -u, the data files are deduplicated before any thread starts (dedup.c)
+- With -w, lookups go over two lock-free rings in shared memory to worker processes (procs.c) */
 
 /* README
-- To compile: gcc multi-lookup.c util.c -o multi-lookup -pthread -Wall -Wextra
+- To compile: gcc multi-lookup.c util.c queue.c adns.c cache.c flight.c reader.c steal.c writer.c arena.c mock.c hist.c stats.c results.c hedge.c server.c zone.c affinity.c dedup.c procs.c -o multi-lookup -pthread -Wall -Wextra -lm -lrt
 	- pthread: Allows usage of pthreads
-- To run: valgrind ./multi-lookup <# requester> <# resolver> <requester log> <resolver log> <data file>...<data file>
+	- lm: Allows pow() for the mock backend's long-tail latency
+	- lrt: Allows shm_open() on glibc before 2.34
+- To run: valgrind ./multi-lookup [-b <batch size>] [-n <nameserver>] [-q <queries in flight>] [-c <cache MB>] [-o <reorder window>] [-d <queue depth>] [-a <min resolver>:<max resolver>] [-m <mock latency>] [-j <stats file>] [-f <format>] [-p <cache file>] [-t <deadline ms>[:<hedge percentile>]] [-z <zone db>] [-P <pipelines>] [-u <dedup MB>] [-w <resolver processes>] <# requester> <# resolver> <requester log> <resolver log> <data file>...<data file>
 	- valgrind: Checks for memory leaks
-	- <# requester>: Num of producer threads
-	- <# resolver>: Num of consumer threads
+	- <batch size>: Num of names moved through the buffer per synchronization
+	- <nameserver>: Resolve with the async engine against addr[:port] instead of getaddrinfo()
+	- <queries in flight>: Max outstanding async queries per resolver thread
+	- <cache MB>: Memory cap of the resolution cache; 0 turns the cache off
+	- <reorder window>: Write <resolver log> in input order, holding back at most this many chunks
+	- <queue depth>: Num of names the shared buffer holds
+	- <min resolver>:<max resolver>: Grow and shrink the resolver threads between these bounds as the buffer fills and drains
+	- <mock latency>: Resolve with the mock backend instead of getaddrinfo(), e.g. uniform:100-2000,fail=0.01 (see mock.h)
+	- <stats file>: Write per-stage latency histograms and counters to this file as JSON at exit; SIGUSR1 writes a live snapshot
+	- <deadline ms>[:<hedge percentile>]: Give up on a lookup after this long and write TIMEOUT for it; one slower than the running percentile (default 95) of lookups gets a duplicate request, and the first answer wins
+	- <zone db>: Answer the names in this database, compiled by zone-compile from a hosts-style file, before the cache and the resolver
+	- <pipelines>: Run this many independent pipelines, each with its own buffer, requesters, resolvers, cache and writer over a run of the chunks, pinned to a CPU; their logs are merged at the end
+	- <resolver processes>: Look names up in this many forked worker processes, handed the names over a lock-free ring in shared memory, instead of in the resolver threads
+	- <dedup MB>: Deduplicate the data files first, with at most this much memory, spilling to temporary files next to <resolver log>; each distinct name is resolved once, and its answer written for every line it is on
+	- <cache file>: Load the resolution cache from this snapshot at start, refresh its expired names in the background, and save the cache to it at exit
+	- <format>: text (default) writes "name,addr,..." lines to <resolver log>; binary writes an indexed results file for results-lookup (see results.h)
+	- <# requester>: Num of producer threads; with -P, per pipeline
+	- <# resolver>: Num of consumer threads; with -a, the num to start with; with -P, per pipeline
 	- <requester log>: Write producer status info into this file
 	- <resolver log>: Write consumer status info into this file
-	- <data file>: Files that contain domain names
-- Example: valgrind ./multi-lookup 1 1 serviced.txt results.txt names1.txt names2.txt names3.txt names4.txt names5.txt */
+	- <data file>: Files that contain domain names; "-" reads names from stdin
+- Example: valgrind ./multi-lookup 1 1 serviced.txt results.txt names1.txt names2.txt names3.txt names4.txt names5.txt
+- Daemon: ./multi-lookup -S <socket> [options] <# requester> <# resolver> <requester log>
+	- Serve names sent over the Unix domain socket <socket> until SIGINT or SIGTERM; each requester reads one client at a time
+- Client: ./multi-lookup -C <socket> <data file>...<data file>
+	- Send the data files to the daemon at <socket> and print its answers */
 
 
 
@@ -69,21 +144,78 @@ pthread_mutex_t mutex_temp = PTHREAD_MUTEX_INITIALIZER;
 /* Helper functions
 
 - usage()
-	- Input: argv[0] and argc
+	- Input: argv[0], argc, and the num of arguments needed
 	- Print ERROR and EXIT if not enough arguments
 
+- get_batch_size()
+	- Input: optarg of -b and MAX_BATCH_SIZE
+	- Print ERROR and EXIT if optarg is not an int, is 0, or exceeds max
+	- Return <batch size>
+
+- get_nameserver()
+	- Input: optarg of -n and the address to fill
+	- Print ERROR and EXIT if optarg is not a numeric addr[:port]
+
+- get_num_inflight()
+	- Input: optarg of -q and ADNS_MAX_INFLIGHT
+	- Print ERROR and EXIT if optarg is not an int, is 0, or exceeds max
+	- Return <queries in flight>
+
+- get_cache_size()
+	- Input: optarg of -c
+	- Print ERROR and EXIT if optarg is not an int
+	- Return <cache MB>
+
+- get_reorder_window()
+	- Input: optarg of -o
+	- Print ERROR and EXIT if optarg is not an int or is 0
+	- Return <reorder window>
+
+- get_queue_depth()
+	- Input: optarg of -d and MAX_BUFFER_SIZE
+	- Print ERROR and EXIT if optarg is not an int, is 0, or exceeds max
+	- Return <queue depth>
+
+- get_pool_range()
+	- Input: optarg of -a and the bounds to fill
+	- Print ERROR and EXIT if optarg is not two positive ints min:max with min <= max
+
+- get_deadline()
+	- Input: optarg of -t and the deadline and percentile to fill
+	- Print ERROR and EXIT if optarg is not a positive int, optionally followed by :<int from 1 to 99>
+
+- get_num_pipelines()
+	- Input: optarg of -P and MAX_PIPELINES
+	- Print ERROR and EXIT if optarg is not an int, is 0, or exceeds max
+	- Return <pipelines>
+
+- get_num_procs()
+	- Input: optarg of -w and PROCS_MAX_WORKERS
+	- Print ERROR and EXIT if optarg is not an int, is 0, or exceeds max
+	- Return <resolver processes>
+
+- get_dedup_size()
+	- Input: optarg of -u
+	- Print ERROR and EXIT if optarg is not an int or is 0
+	- Return <dedup MB>
+
+- get_output_format()
+	- Input: optarg of -f
+	- Print ERROR and EXIT if optarg is not text or binary
+	- Return <format>
+
 - isnumber()
 	- Input: A string and its length
 	- Return 0 if string is int; else, return 1
 
 - get_num_producer()
-	- Input: argv[1] and MAX_PRODUCER
-	- Print ERROR and EXIT if argv[1] is not an int or exceeds max
+	- Input: argv[1]
+	- Print ERROR and EXIT if argv[1] is not a positive int
 	- Return <# requester>
 
 - get_num_consumer()
-	- Input: argv[2] and MAX_CONSUMER
-	- Print ERROR and EXIT if argv[2] is not an int or exceeds max
+	- Input: argv[2]
+	- Print ERROR and EXIT if argv[2] is not a positive int
 	- Return <# resolver>
 
 - open_producer_log()
@@ -104,15 +236,13 @@ pthread_mutex_t mutex_temp = PTHREAD_MUTEX_INITIALIZER;
 - open_data_file()
 	- argv[5] and file pointer
 	- Print ERROR if file path not valid; returns NULL
-	- Opens <data file> and returns file pointer
-
-- get_num_domains()
-	- file pointer
-	- Returns num domains in given file */
+	- Opens <data file> and returns file pointer; "-" is stdin */
 
-void usage(char *str, int num){
-	if(num < 6){
-        printf("Usage: %s <# requester> <# resolver> <requester log> <resolver log> <data file>...<data file>\n", str);
+void usage(char *str, int num, int min){
+	if(num < min){
+        printf("Usage: %s [-b <batch size>] [-n <nameserver>] [-q <queries in flight>] [-c <cache MB>] [-o <reorder window>] [-d <queue depth>] [-a <min resolver>:<max resolver>] [-m <mock latency>] [-j <stats file>] [-f <format>] [-p <cache file>] [-t <deadline ms>[:<hedge percentile>]] [-z <zone db>] [-P <pipelines>] [-u <dedup MB>] [-w <resolver processes>] <# requester> <# resolver> <requester log> <resolver log> <data file>...<data file>\n", str);
+        printf("       %s -S <socket> [options] <# requester> <# resolver> <requester log>\n", str);
+        printf("       %s -C <socket> <data file>...<data file>\n", str);
         exit(1);	
 	}
 }
@@ -127,24 +257,139 @@ int isnumber(char *str, int size){
 }
 
 int get_num_producer(char *str){
+    if(isnumber(str, strlen(str)) || atoi(str) == 0){
+    	printf("<# requester> must be a positive integer\n");
+    	exit(1);
+    }
+    return atoi(str);
+}
+
+int get_batch_size(char *str){
+    if(isnumber(str, strlen(str)) || atoi(str) == 0){
+    	printf("<batch size> must be a positive integer\n");
+    	exit(1);
+    }
+    else if(atoi(str) > MAX_BATCH_SIZE){
+    	printf("<batch size> must not exceed %d\n", MAX_BATCH_SIZE);
+    	exit(1);
+    }
+    return atoi(str);
+}
+
+void get_nameserver(char *str, struct sockaddr_storage *addr, socklen_t *len){
+    if(adns_parse_server(str, addr, len) != 0){
+    	printf("<nameserver> must be a numeric address, optionally followed by :port\n");
+    	exit(1);
+    }
+}
+
+int get_num_inflight(char *str){
+    if(isnumber(str, strlen(str)) || atoi(str) == 0){
+    	printf("<queries in flight> must be a positive integer\n");
+    	exit(1);
+    }
+    else if(atoi(str) > ADNS_MAX_INFLIGHT){
+    	printf("<queries in flight> must not exceed %d\n", ADNS_MAX_INFLIGHT);
+    	exit(1);
+    }
+    return atoi(str);
+}
+
+int get_cache_size(char *str){
     if(isnumber(str, strlen(str))){
-    	printf("<# requester> must be an integer\n");
+    	printf("<cache MB> must be an integer\n");
     	exit(1);
     }
-    else if(atoi(str) > MAX_PRODUCER){
-    	printf("<# requester> must not exceed %d\n", MAX_PRODUCER);
+    return atoi(str);
+}
+
+int get_reorder_window(char *str){
+    if(isnumber(str, strlen(str)) || atoi(str) == 0){
+    	printf("<reorder window> must be a positive integer\n");
     	exit(1);
     }
     return atoi(str);
 }
 
-int get_num_consumer(char *str){
-   	if(isnumber(str, strlen(str))){
-     	printf("<# resolver> must be an integer\n");
+int get_queue_depth(char *str){
+    if(isnumber(str, strlen(str)) || atoi(str) == 0){
+    	printf("<queue depth> must be a positive integer\n");
     	exit(1);
     }
-    else if(atoi(str) > MAX_CONSUMER){
-    	printf("<# resolver> must not exceed %d\n", MAX_CONSUMER);
+    else if(atoi(str) > MAX_BUFFER_SIZE){
+    	printf("<queue depth> must not exceed %d\n", MAX_BUFFER_SIZE);
+    	exit(1);
+    }
+    return atoi(str);
+}
+
+int get_num_pipelines(char *str){
+    if(isnumber(str, strlen(str)) || atoi(str) == 0){
+    	printf("<pipelines> must be a positive integer\n");
+    	exit(1);
+    }
+    else if(atoi(str) > MAX_PIPELINES){
+    	printf("<pipelines> must not exceed %d\n", MAX_PIPELINES);
+    	exit(1);
+    }
+    return atoi(str);
+}
+
+int get_num_procs(char *str){
+    if(isnumber(str, strlen(str)) || atoi(str) == 0){
+    	printf("<resolver processes> must be a positive integer\n");
+    	exit(1);
+    }
+    else if(atoi(str) > PROCS_MAX_WORKERS){
+    	printf("<resolver processes> must not exceed %d\n", PROCS_MAX_WORKERS);
+    	exit(1);
+    }
+    return atoi(str);
+}
+
+int get_dedup_size(char *str){
+    if(isnumber(str, strlen(str)) || atoi(str) == 0){
+    	printf("<dedup MB> must be a positive integer\n");
+    	exit(1);
+    }
+    return atoi(str);
+}
+
+void get_pool_range(char *str, int *min, int *max){
+    char *colon = strchr(str, ':');
+    if(colon == NULL || isnumber(str, colon - str) || colon == str || isnumber(colon + 1, strlen(colon + 1))
+    	|| (*min = atoi(str)) == 0 || (*max = atoi(colon + 1)) < *min){
+    	printf("<min resolver>:<max resolver> must be two positive integers, min first\n");
+    	exit(1);
+    }
+}
+
+void get_deadline(char *str, int *deadline_ms, int *percentile){
+    char *colon = strchr(str, ':');
+    size_t len = colon ? (size_t)(colon - str) : strlen(str);
+    *percentile = HEDGE_DEFAULT_PERCENTILE;
+    if(len == 0 || isnumber(str, len) || (*deadline_ms = atoi(str)) == 0
+    	|| (colon != NULL && (colon[1] == 0 || isnumber(colon + 1, strlen(colon + 1))
+    	|| (*percentile = atoi(colon + 1)) < 1 || *percentile > 99))){
+    	printf("<deadline ms>[:<hedge percentile>] must be a positive integer, optionally followed by a percentile from 1 to 99\n");
+    	exit(1);
+    }
+}
+
+enum writer_format get_output_format(char *str){
+    if(strcmp(str, "text") == 0){
+    	return WRITER_TEXT;
+    }
+    if(strcmp(str, "binary") == 0){
+    	return WRITER_BINARY;
+    }
+    printf("<format> must be text or binary\n");
+    exit(1);
+}
+
+int get_num_consumer(char *str){
+   	if(isnumber(str, strlen(str)) || atoi(str) == 0){
+     	printf("<# resolver> must be a positive integer\n");
     	exit(1);
     }
 	return atoi(str);
@@ -175,23 +420,16 @@ int get_num_data_files(int num){
 }
 
 
-FILE *open_data_files(char *str, FILE *fp, int flag){
-    if(!(fp = fopen(str, "r+")) && flag == 0){
+FILE *open_data_files(char *str, FILE *fp){
+	if(strcmp(str, "-") == 0){
+		return stdin;
+	}
+    if(!(fp = fopen(str, "r"))){
     	printf("%s file path is not valid; moving on to next file\n", str);
     }
     return fp;
 }
 
-int get_num_domains(FILE *fp){
-	int num_domains = 0;
-  	char c;
-  	for(c = getc(fp); c != EOF; c = getc(fp)){
-  		if(c == '\n'){
-  			num_domains++;
-  		}
-  	}
-	return num_domains;
-}
 
 
 
@@ -200,33 +438,96 @@ int get_num_domains(FILE *fp){
 
 
 
+/* A data file
+- stream: The open file, read with getline(); NULL once the file is mapped
+- map: The mapping of a regular file */
+struct input_file{
+	FILE *stream;
+	struct mapped_file map;
+};
 
 /* Parameter of thread functions
 - num_data_files: The number of data files to be serviced, total
-- num_data_files_done: The number of data files that have been serviced
-- num_domains: The number of domain names
-- num_consumed: The number of domain names consumed so far
+- num_producers_done: The number of producers that have published all their names
 - num_produced: The number of domain names produced so far
-- producer_idx: Producer buffer index
-- consumer_idx: Consumer buffer index
-- buffer: The shared memory buffer
-- data_files: The data files */
+- ring: The shared lock-free ring buffer
+- batch_size: Max num of names moved per ring operation
+- use_async: 1 if resolvers use the async engine against nameserver
+- nameserver: Address of the nameserver for the async engine
+- max_inflight: Max outstanding async queries per resolver
+- deadline_ms/hedge_percentile: Deadline of a lookup and when to hedge it; deadline_ms is 0 without -t
+- cache: The resolution cache; NULL if turned off
+- flight: Table of lookups in flight, shared by all resolvers
+- backend: Resolver backend the blocking resolvers look names up through
+- backend_state: State of that backend
+- writer: The log-writer thread every resolver hands its output to; in session mode for the daemon
+- server: The daemon's socket; NULL unless -S
+- arena: Slabs holding the names read from streams
+- data_files: The data files
+- chunks: Newline-aligned chunks of all mapped data files, plus one per stream, in input order
+- num_chunks: Num of chunks
+- work: Work-stealing deques of chunk indexes, one per producer
+- next_producer: Index the next producer thread will take in tids/chunks_serviced/bytes_serviced
+- tids: Thread id of each producer
+- chunks_serviced: Num of chunks (a stream counts as one), or of daemon clients, each producer has read
+- bytes_serviced: Num of bytes each producer has read
+- chunks_stolen: Num of its chunks each producer stole from another
+- next_consumer: Index the next consumer thread will take
+- pool_lock/pool_cond: Consumers the pool has shrunk away from sleep on pool_cond
+- resolver_target: Consumers with an index at or past it sit out; changed under pool_lock
+- pool_closing: Set once no consumer needs to sit out any more; guarded by pool_lock
+- cores: Num of CPUs the pipeline's threads run on
+- lookups: Num of lookups that missed the cache
+- lookup_ns: Time spent in those lookups
+- stats: Per-stage histograms and counters; every thread attaches to it
+- zone: The local zone database, or NULL
+- refresh_stop: Tells the refresher the resolvers are done
+- num_refreshed: Num of stale snapshot names the refresher looked up */
 struct param{
 	int num_data_files;
-  	int num_data_files_done;
-  	int num_domains;
-  	int num_consumed;
-  	int num_produced;
-  	int producer_idx;
-  	int consumer_idx;
-  	char (*buffer)[MAX_NAME_LENGTH];
-  	FILE **data_files;
+  	atomic_int num_producers_done;
+  	atomic_long num_produced;
+  	struct ring *ring;
+  	int batch_size;
+  	int use_async;
+  	struct sockaddr_storage nameserver;
+  	socklen_t nameserver_len;
+  	int max_inflight;
+  	int deadline_ms;
+  	int hedge_percentile;
+  	struct zone_db *zone;
+  	struct cache *cache;
+  	struct flight *flight;
+  	const struct resolver_backend *backend;
+  	void *backend_state;
+  	struct writer *writer;
+  	struct server *server;
+  	struct arena *arena;
+  	struct input_file *data_files;
+  	struct chunk *chunks;
+  	int num_chunks;
+  	struct work *work;
+  	atomic_int next_producer;
   	FILE *producer_log;
   	FILE *consumer_log;
 
   	int num_producer;
   	int *tids;
-  	int *counter;
+  	int *chunks_serviced;
+  	long *bytes_serviced;
+  	int *chunks_stolen;
+
+  	atomic_int next_consumer;
+  	pthread_mutex_t pool_lock;
+  	pthread_cond_t pool_cond;
+  	atomic_int resolver_target;
+  	int pool_closing;
+  	int cores;
+  	atomic_ullong lookups;
+  	atomic_ullong lookup_ns;
+  	struct stats *stats;
+  	atomic_int refresh_stop;
+  	atomic_long num_refreshed;
 };
 
 
@@ -240,75 +541,586 @@ struct param{
 
 
 
+/* Current time of the monotonic clock in ns */
+static unsigned long long now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Timestamp of a view; us of the monotonic clock, wrapping */
+static uint32_t stamp_now(void){
+	return (uint32_t)(now_ns() / 1000);
+}
+
+/* Record the latency of a name published at stamp and answered at now */
+static void record_latency(uint32_t stamp, uint32_t now){
+	stats_record(STAT_NAME, (uint64_t)(uint32_t)(now - stamp) * 1000);
+}
+
+/* Count one lookup that missed the cache and took ns */
+static void count_lookup(struct param *p, unsigned long long ns){
+	atomic_fetch_add_explicit(&p->lookups, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&p->lookup_ns, ns, memory_order_relaxed);
+}
+
+/* Sit out while the adaptive pool has shrunk below this consumer
+- Input: p, the consumer's index, and its output buffer, handed to the writer first
+  so the writer never waits on a sleeping thread */
+void park_resolver(struct param *p, int idx, struct wbuf **out){
+	if(idx < atomic_load_explicit(&p->resolver_target, memory_order_relaxed)){
+		return;
+	}
+	writer_flush(p->writer, out);
+	pthread_mutex_lock(&p->pool_lock);
+	while(idx >= atomic_load_explicit(&p->resolver_target, memory_order_relaxed) && !p->pool_closing){
+		pthread_cond_wait(&p->pool_cond, &p->pool_lock);
+		stats_count(STAT_WAKEUPS, 1);
+	}
+	pthread_mutex_unlock(&p->pool_lock);
+}
+
+/* Take names off the ring without blocking
+- Input: p, the views and names to fill, their size, the drained flag, and the consumer's output buffer
+- Returns the num of names taken that need answering; sets *drained once every producer is done
+  and the ring is empty, which is how consumers know to exit
+- Names the requesters found not to be hostnames are written as failed here and left out
+- Only the chunk, line and stamp of the views are still valid afterwards */
+int take_names(struct param *p, struct name_view *views, char (*names)[MAX_NAME_LENGTH], int n, int *drained, struct wbuf **out){
+	static const struct addr_list none;
+	int got = ring_try_dequeue_batch(p->ring, views, n);
+	int kept = 0;
+	if(got == 0 && atomic_load(&p->num_producers_done) == p->num_producer){
+		/* The producers published everything before saying they were done; one more look drains it */
+		got = ring_try_dequeue_batch(p->ring, views, n);
+		*drained = (got == 0);
+	}
+
+	/* The views point into the mapped files (or into arena slabs for streams); make each a string */
+	for(int i = 0; i < got; i++){
+		memcpy(names[i], views[i].name, views[i].len);
+		names[i][views[i].len] = 0;
+	}
+	arena_release(p->arena, views, got);
+	for(int i = 0; i < got; i++){
+		if(views[i].invalid){
+			record_latency(views[i].stamp, stamp_now());
+			writer_append(p->writer, out, views[i].chunk, views[i].line, names[i], &none);
+			stats_count(STAT_INVALID, 1);
+			continue;
+		}
+		if(kept != i){
+			views[kept] = views[i];
+			strcpy(names[kept], names[i]);
+		}
+		kept++;
+	}
+	if(got > 0){
+		stats_count(STAT_CONSUMED, got);
+	}
+	return kept;
+}
+
+
+
+
+
+/* Look up names this thread leads with one resolve_batch() call of the backend,
+  cache the answers, and hand them to anyone waiting in the in-flight table
+- Input: p, the names, the lists for their addresses, and the num of names
+- Each name counts the time of its own lookup, as the backend reports it, not the batch's */
+static void lookup_leads(struct param *p, const char **lead, struct addr_list **lead_addrs, int n){
+	int status[n];
+	unsigned long long ns[n];
+	p->backend->resolve_batch(p->backend_state, lead, lead_addrs, status, ns, n);
+	for(int i = 0; i < n; i++){
+		struct addr_list *a = lead_addrs[i];
+		a->timed_out = status[i] == UTIL_TIMEOUT;
+		if(status[i] != UTIL_SUCCESS){
+			a->num = 0;
+			stats_count(a->timed_out ? STAT_TIMEOUTS : STAT_FAILURES, 1);
+		}
+		stats_record(STAT_LOOKUP, ns[i]);
+		if(p->cache != NULL){
+			cache_put(p->cache, lead[i], a, a->num ? CACHE_DEFAULT_TTL : CACHE_NEGATIVE_TTL);
+		}
+		flight_done(p->flight, lead[i], a);
+		count_lookup(p, ns[i]);
+	}
+}
+
+/* Answer a batch of names
+- Input: p, the names, the lists for their addresses, and the num of names
+- Names in the cache are answered at once, and names another resolver is already looking up
+  are waited on; this thread looks the rest up with one resolve_batch() call of the backend,
+  caches them, and hands them to anyone who waited
+- Its own lookups finish before it waits, so two resolvers waiting on each other cannot deadlock */
+void resolve_names(struct param *p, char (*names)[MAX_NAME_LENGTH], struct addr_list *addrs, int n){
+	struct flight_entry *wait[n];
+	const char *lead[n];
+	struct addr_list *lead_addrs[n];
+	int num_lead = 0;
+
+	for(int i = 0; i < n; i++){
+		wait[i] = NULL;
+		if(p->zone != NULL && zone_find(p->zone, names[i], &addrs[i]) == 0){
+			stats_count(STAT_ZONE_HITS, 1);
+			continue;
+		}
+		if(p->cache != NULL && cache_get(p->cache, names[i], &addrs[i]) == 0){
+			continue;
+		}
+		if((wait[i] = flight_join(p->flight, names[i])) == NULL){
+			lead[num_lead] = names[i];
+			lead_addrs[num_lead] = &addrs[i];
+			num_lead++;
+		}
+	}
+
+	if(num_lead > 0){
+		lookup_leads(p, lead, lead_addrs, num_lead);
+	}
+
+	for(int i = 0; i < n; i++){
+		if(wait[i] != NULL){
+			flight_wait(p->flight, wait[i], &addrs[i]);
+		}
+	}
+}
+
+
+
+
+
+/* Blocking consumer
+- Input: p, and the consumer's index in the pool
+- Resolves through the backend a batch at a time; also what an async consumer falls back to */
+void *consume_names(struct param *p, int idx){
+  	int got;
+  	int drained = 0;
+  	unsigned spins = 0;
+
+  	/* Per-thread batch of names, their addresses, and the buffer their log lines go into */
+  	struct name_view *views = malloc(sizeof(*views) * p->batch_size);
+  	char (*names)[MAX_NAME_LENGTH] = malloc(sizeof(*names) * p->batch_size);
+  	struct addr_list *addrs = malloc(sizeof(*addrs) * p->batch_size);
+  	struct wbuf *out = NULL;
+  	uint32_t now;
+  	unsigned long long wait_start = 0;
+
+  	/* All threads enter here */
+  	while(1){
+
+  		/* Between batches, sit out if the pool has shrunk below this thread */
+  		park_resolver(p, idx, &out);
+
+    	/* Take up to batch_size names off the ring in one step; back off while the producers catch up */
+    	got = take_names(p, views, names, p->batch_size, &drained, &out);
+
+    	/* If the producers are done and the ring is drained, the thread exits */
+    	if(drained){
+    		break;
+    	}
+
+    	/* Hand over what is buffered before waiting, so the writer never waits on an idle thread */
+    	if(got == 0){
+    		writer_flush(p->writer, &out);
+    		if(wait_start == 0){
+    			wait_start = now_ns();
+    		}
+    		ring_backoff(&spins);
+    		continue;
+    	}
+    	spins = 0;
+    	stats_record(STAT_DEQUEUE_WAIT, wait_start ? now_ns() - wait_start : 0);
+    	wait_start = 0;
+
+    	/* Answer the names from the cache, or resolve them; full buffers go to the writer */
+    	resolve_names(p, names, addrs, got);
+    	now = stamp_now();
+    	for(int i = 0; i < got; i++){
+    		record_latency(views[i].stamp, now);
+			writer_append(p->writer, &out, views[i].chunk, views[i].line, names[i], &addrs[i]);
+		}
+  	}
+
+  	writer_flush(p->writer, &out);
+  	free(views);
+  	free(names);
+  	free(addrs);
+  	//printf("consumer exit %ld\n", gettid());
+
+	return NULL;
+}
+
 /* Consumer function
 - Input: p, a structure of type struct param */
 void *consume(void *arg){
+	struct param *p = (struct param*) arg;
+	stats_attach(p->stats, "resolver");
+	consume_names(p, atomic_fetch_add(&p->next_consumer, 1));
+	stats_detach();
+	return NULL;
+}
+
+
+
+
+
+/* Input position of a query in flight; the async engine hands it back as ctx
+- next_free: Next unused position
+- chunk/line: Where the name came from
+- stamp: When the name was published
+- start: When the query was sent */
+struct query_pos{
+	struct query_pos *next_free;
+	uint32_t chunk;
+	uint32_t line;
+	uint32_t stamp;
+	unsigned long long start;
+};
+
+/* Output state of an async consumer
+- p: Parameter of the thread, for its lookup counters
+- writer: The log-writer thread
+- out: This thread's buffer of log lines
+- free_pos: Unused query positions; there is one per query in flight
+- cache: The resolution cache; NULL if turned off
+- flight: Table of lookups in flight */
+struct async_out{
+	struct param *p;
+	struct writer *writer;
+	struct wbuf *out;
+	struct query_pos *free_pos;
+	struct cache *cache;
+	struct flight *flight;
+};
+
+/* A name an async consumer is waiting on another resolver for
+- e: The lookup being waited on
+- chunk/line: Where the name came from
+- stamp: When the name was published
+- name: The domain name */
+struct parked{
+	struct flight_entry *e;
+	uint32_t chunk;
+	uint32_t line;
+	uint32_t stamp;
+	char name[MAX_NAME_LENGTH];
+};
+
+/* Called by the async engine for every finished query */
+static void write_result(void *arg, const struct adns_result *res){
+	struct async_out *o = arg;
+	struct query_pos *pos = res->ctx;
+	if(o->cache != NULL){
+		cache_put(o->cache, res->name, &res->addrs, res->status == UTIL_SUCCESS ? res->ttl : CACHE_NEGATIVE_TTL);
+	}
+	flight_done(o->flight, res->name, &res->addrs);
+	if(res->status != UTIL_SUCCESS){
+		stats_count(res->status == UTIL_TIMEOUT ? STAT_TIMEOUTS : STAT_FAILURES, 1);
+	}
+	unsigned long long now = now_ns();
+	count_lookup(o->p, now - pos->start);
+	stats_record(STAT_LOOKUP, now - pos->start);
+	record_latency(pos->stamp, (uint32_t)(now / 1000));
+	writer_append(o->writer, &o->out, pos->chunk, pos->line, res->name, &res->addrs);
+	pos->next_free = o->free_pos;
+	o->free_pos = pos;
+}
+
+
+
+
+
+/* Async consumer function
+- Input: p, a structure of type struct param
+- Keeps up to max_inflight queries outstanding on one async engine instead of
+  one blocking dnslookup() at a time
+- Names another resolver is already looking up are parked until its answer arrives */
+void *consume_async(void *arg){
 
 
 	/* Cast the void parameter into a type of struct param */
   	struct param *p = (struct param*) arg;
-  	char ip_address[INET6_ADDRSTRLEN];
+  	int idx = atomic_fetch_add(&p->next_consumer, 1);
+  	int got, room;
+  	struct addr_list found;
+  	int drained = 0;
+  	int num_parked = 0;
+  	unsigned spins = 0;
+  	unsigned long long wait_start = 0;
+  	struct flight_entry *e;
+  	struct query_pos *pos;
+
+  	/* Per-thread batch of names and the buffer their log lines go into */
+  	struct name_view *views = malloc(sizeof(*views) * p->batch_size);
+  	char (*names)[MAX_NAME_LENGTH] = malloc(sizeof(*names) * p->batch_size);
+  	struct query_pos *positions = malloc(sizeof(*positions) * p->max_inflight);
+  	struct async_out o;
+  	o.p = p;
+  	o.writer = p->writer;
+  	o.out = NULL;
+  	o.free_pos = NULL;
+  	o.cache = p->cache;
+  	o.flight = p->flight;
+  	for(int i = 0; i < p->max_inflight; i++){
+  		positions[i].next_free = o.free_pos;
+  		o.free_pos = &positions[i];
+  	}
+  	struct parked *parked = malloc(sizeof(*parked) * p->max_inflight);
+  	stats_attach(p->stats, "resolver");
+
+  	struct adns *a = adns_create(&p->nameserver, p->nameserver_len, p->max_inflight, write_result, &o);
+  	if(a != NULL && p->deadline_ms > 0){
+  		adns_set_deadline(a, p->deadline_ms, p->hedge_percentile);
+  	}
+  	if(a == NULL){
+  		printf("Could not start the async engine; thread %ld falls back to dnslookup()\n", gettid());
+  		free(views);
+  		free(names);
+  		free(positions);
+  		free(parked);
+  		consume_names(p, idx);
+  		stats_detach();
+  		return NULL;
+  	}
 
   	/* All threads enter here */
   	while(1){
 
-  		//printf("consumer flag %ld\n", gettid());
+  		/* Sit out if the pool has shrunk below this thread, but only once nothing is in flight */
+  		if(adns_pending(a) == 0 && num_parked == 0){
+  			park_resolver(p, idx, &o.out);
+  		}
 
-  		/* All threads are stuck here until the thread who is using this mutex lock, unlocks the mutex */
-    	pthread_mutex_lock(&mutex_c);
+  		/* Write the names whose leader has answered */
+  		for(int i = 0; i < num_parked; i++){
+  			if(flight_poll(p->flight, parked[i].e, &found) == 0){
+  				record_latency(parked[i].stamp, stamp_now());
+  				writer_append(p->writer, &o.out, parked[i].chunk, parked[i].line, parked[i].name, &found);
+  				parked[i--] = parked[--num_parked];
+  			}
+  		}
 
-    	/* If all domains have been read, the thread that is using this mutex lock, unlocks the mutex, and exits */
-    	if(p->num_consumed >= p->num_domains){
-    		//printf("num consumed = %d\n", p->num_consumed);
-    		pthread_mutex_unlock(&mutex_c);
-    		break;
-    	}
+  		/* Take up to batch_size names off the ring, as many as there is room for; send the ones the cache cannot answer and nobody else is looking up */
+  		got = 0;
+  		room = adns_room(a) < p->max_inflight - num_parked ? adns_room(a) : p->max_inflight - num_parked;
+  		if(!drained && room > 0){
+  			got = take_names(p, views, names, p->batch_size < room ? p->batch_size : room, &drained, &o.out);
+  			if(got > 0){
+  				stats_record(STAT_DEQUEUE_WAIT, wait_start ? now_ns() - wait_start : 0);
+  				wait_start = 0;
+  			}
+  			else if(wait_start == 0){
+  				wait_start = now_ns();
+  			}
+  			for(int i = 0; i < got; i++){
+  				int local = p->zone != NULL && zone_find(p->zone, names[i], &found) == 0;
+  				if(local){
+  					stats_count(STAT_ZONE_HITS, 1);
+  				}
+  				if(local || (p->cache != NULL && cache_get(p->cache, names[i], &found) == 0)){
+  					record_latency(views[i].stamp, stamp_now());
+  					writer_append(p->writer, &o.out, views[i].chunk, views[i].line, names[i], &found);
+  				}
+  				else if((e = flight_join(p->flight, names[i])) != NULL){
+  					parked[num_parked].e = e;
+  					parked[num_parked].chunk = views[i].chunk;
+  					parked[num_parked].line = views[i].line;
+  					parked[num_parked].stamp = views[i].stamp;
+  					strcpy(parked[num_parked].name, names[i]);
+  					num_parked++;
+  				}
+  				else{
+  					/* room keeps queries in flight under max_inflight, so a position is always free */
+  					pos = o.free_pos;
+  					o.free_pos = pos->next_free;
+  					pos->chunk = views[i].chunk;
+  					pos->line = views[i].line;
+  					pos->stamp = views[i].stamp;
+  					pos->start = now_ns();
+  					adns_submit(a, names[i], pos);
+  				}
+  			}
+  			if(got > 0){
+  				spins = 0;
+  			}
+  		}
 
-		/* If the buffer is consumed empty, the consumer will wait() for the full signal */
-		//printf("producer idx 1 = %d\n", p->producer_idx); 
-	    while(p->producer_idx == 0){
-	    	//printf("consumer thread %ld is waiting\n", gettid());
-    		pthread_cond_wait(&full, &mutex_temp);
-    		//printf("consumer thread %ld has been woken up\n", gettid());
-    	}
-    
-    	/* Consume all the domain names in the buffer */
-    	//printf("consumer tid = %ld\n", gettid());
-
-	    fputs(p->buffer[p->consumer_idx], p->consumer_log);
-	    fputs(",", p->consumer_log);
-	    memset(ip_address, 0, sizeof(ip_address));
-		if(dnslookup(p->buffer[p->consumer_idx], ip_address, INET6_ADDRSTRLEN) == 0){
-		   	fputs(ip_address, p->consumer_log);
-		}
-	    fputs("\n", p->consumer_log);
-
-	    //printf("p->consumer_idx = %d\n", p->consumer_idx);
-
-    	
-    	/* Update the consumer index of the buffer */
-    	p->consumer_idx++;
-    	p->num_consumed++;
-    	//printf("num consumed = %d\n", p->num_consumed);
-    	if(p->consumer_idx == BUFFER_SIZE){
-    		p->consumer_idx = 0;
-    		p->producer_idx = 0;
-    	}
+  		/* If the producers are done, the ring is drained, and every name is answered, the thread exits */
+  		if(drained && adns_pending(a) == 0 && num_parked == 0){
+  			break;
+  		}
+
+  		/* Wait for answers; only wait long when there is nothing new to send and nobody else to wait on */
+  		if(adns_pending(a) > 0){
+  			int hungry = (adns_room(a) > 0 && !drained) || num_parked > 0;
+  			adns_poll(a, hungry ? (got > 0 ? 0 : 1) : ASYNC_POLL_MS);
+  		}
+  		else if(got == 0){
+  			ring_backoff(&spins);
+  		}
 
-    
-    	/* If the buffer has been emptied, send signal() empty to producer */
-    	if(p->consumer_idx == 0){
-    		//printf("sending signal to producer\n");
-		    pthread_cond_signal(&empty);
+  		/* Hand over what is buffered whenever no new names came in, so the writer never waits on an idle thread */
+  		if(got == 0){
+  			writer_flush(p->writer, &o.out);
+  		}
+  	}
+
+  	writer_flush(p->writer, &o.out);
+  	adns_destroy(a);
+  	free(views);
+  	free(names);
+  	free(positions);
+  	free(parked);
+  	stats_detach();
+	return NULL;
+}
+
+
+
+
+
+/* A stale snapshot name the async refresher has in flight
+- next_free: Next unused query
+- name: The name; points into the snapshot
+- start: When the query was sent */
+struct refresh_query{
+	struct refresh_query *next_free;
+	const char *name;
+	unsigned long long start;
+};
+
+/* State of the async refresher
+- p: Parameter of the run
+- free_query: Unused queries; there is one per query in flight */
+struct refresh_async{
+	struct param *p;
+	struct refresh_query *free_query;
+};
+
+/* Called by the refresher's async engine for every finished query */
+static void refresh_result(void *arg, const struct adns_result *res){
+	struct refresh_async *r = arg;
+	struct refresh_query *q = res->ctx;
+	cache_put(r->p->cache, res->name, &res->addrs, res->status == UTIL_SUCCESS ? res->ttl : CACHE_NEGATIVE_TTL);
+	flight_done(r->p->flight, res->name, &res->addrs);
+	if(res->status != UTIL_SUCCESS){
+		stats_count(res->status == UTIL_TIMEOUT ? STAT_TIMEOUTS : STAT_FAILURES, 1);
+	}
+	unsigned long long elapsed = now_ns() - q->start;
+	count_lookup(r->p, elapsed);
+	stats_record(STAT_LOOKUP, elapsed);
+	atomic_fetch_add(&r->p->num_refreshed, 1);
+	q->name = NULL;
+	q->next_free = r->free_query;
+	r->free_query = q;
+}
+
+/* Take up to n stale snapshot names nobody is looking up yet; this thread leads the lookups of the names returned */
+static int take_stale(struct param *p, uint64_t *pos, const char **names, int n, int *exhausted){
+	const char *stale[n];
+	int num_lead = 0;
+	size_t got = cache_stale_names(p->cache, pos, stale, n);
+	*exhausted = got == 0;
+	for(size_t i = 0; i < got; i++){
+		struct flight_entry *e = flight_join(p->flight, stale[i]);
+		if(e != NULL){
+			/* A resolver is already asking; its answer refreshes the cache */
+			flight_leave(p->flight, e);
 		}
+		else{
+			names[num_lead++] = stale[i];
+		}
+	}
+	return num_lead;
+}
 
-    	pthread_mutex_unlock(&mutex_c);
-    	//printf("producer idx 2 = %d\n", p->producer_idx);
+/* Refresher with blocking lookups through the backend, a batch at a time */
+static void refresh_names(struct param *p){
+	const char **names = malloc(sizeof(*names) * p->batch_size);
+	struct addr_list *addrs = malloc(sizeof(*addrs) * p->batch_size);
+	struct addr_list **lead_addrs = malloc(sizeof(*lead_addrs) * p->batch_size);
+	uint64_t pos = 0;
+	int exhausted = 0;
 
-  	}
+	for(int i = 0; i < p->batch_size; i++){
+		lead_addrs[i] = &addrs[i];
+	}
+	while(!exhausted && !atomic_load(&p->refresh_stop)){
+		int n = take_stale(p, &pos, names, p->batch_size, &exhausted);
+		if(n > 0){
+			lookup_leads(p, names, lead_addrs, n);
+			atomic_fetch_add(&p->num_refreshed, n);
+		}
+	}
+	free(names);
+	free(addrs);
+	free(lead_addrs);
+}
 
-  	//printf("consumer exit %ld\n", gettid());
+/* Refresher function
+- Input: p, a structure of type struct param
+- Looks up every name of the loaded cache snapshot whose answer has expired, in the
+  background, the same way the resolvers do, so the run and the next one find it fresh
+- Stops when the resolvers are done; names it has in flight then are dropped */
+void *refresh_stale(void *arg){
+	struct param *p = (struct param*) arg;
+	struct refresh_async r;
+	const char **names = NULL;
+	struct refresh_query *queries = NULL;
+	struct adns *a = NULL;
+	uint64_t pos = 0;
+	int exhausted = 0;
+
+	stats_attach(p->stats, "refresher");
+	if(p->use_async){
+		r.p = p;
+		r.free_query = NULL;
+		names = malloc(sizeof(*names) * p->max_inflight);
+		queries = malloc(sizeof(*queries) * p->max_inflight);
+		for(int i = 0; i < p->max_inflight; i++){
+			queries[i].name = NULL;
+			queries[i].next_free = r.free_query;
+			r.free_query = &queries[i];
+		}
+		a = adns_create(&p->nameserver, p->nameserver_len, p->max_inflight, refresh_result, &r);
+		if(a != NULL && p->deadline_ms > 0){
+			adns_set_deadline(a, p->deadline_ms, p->hedge_percentile);
+		}
+	}
+	if(a == NULL){
+		refresh_names(p);
+	}
+	else{
+		while(!atomic_load(&p->refresh_stop) && (!exhausted || adns_pending(a) > 0)){
+			int room = adns_room(a);
+			if(!exhausted && room > 0){
+				int n = take_stale(p, &pos, names, room, &exhausted);
+				for(int i = 0; i < n; i++){
+					struct refresh_query *q = r.free_query;
+					r.free_query = q->next_free;
+					q->name = names[i];
+					q->start = now_ns();
+					adns_submit(a, names[i], q);
+				}
+			}
+			adns_poll(a, exhausted || room == 0 ? ASYNC_POLL_MS : 0);
+		}
 
+		/* Release the names still in flight; no resolver is left to wait on them */
+		struct addr_list none = {0};
+		for(int i = 0; i < p->max_inflight; i++){
+			if(queries[i].name != NULL){
+				flight_done(p->flight, queries[i].name, &none);
+			}
+		}
+		adns_destroy(a);
+	}
+	free(names);
+	free(queries);
+	stats_detach();
 	return NULL;
 }
 
@@ -316,85 +1128,240 @@ void *consume(void *arg){
 
 
 
-/* Producer function
-- Input: p, a structure of type struct param */
+/* Batch of views a producer is filling
+- views: The views
+- num_views: Num of views in the batch
+- chunk: The chunk being read
+- line: Num of lines read from it so far
+- slab: Arena slab streamed names are copied into
+- start: When the first name of the batch was read */
+struct producer_batch{
+	struct name_view *views;
+	int num_views;
+	uint32_t chunk;
+	uint32_t line;
+	struct slab *slab;
+	unsigned long long start;
+};
+
+/* Publish a producer's batch; the time it took to fill counts as read time, the time to publish it as enqueue wait */
+void flush_names(struct param *p, struct producer_batch *b){
+	if(b->num_views > 0){
+		unsigned long long now = now_ns();
+		uint32_t stamp = (uint32_t)(now / 1000);
+		for(int i = 0; i < b->num_views; i++){
+			b->views[i].stamp = stamp;
+		}
+		stats_record(STAT_READ, now - b->start);
+		ring_enqueue_batch(p->ring, b->views, b->num_views);
+		stats_record(STAT_ENQUEUE_WAIT, now_ns() - now);
+		stats_count(STAT_PRODUCED, b->num_views);
+		atomic_fetch_add_explicit(&p->num_produced, b->num_views, memory_order_relaxed);
+		b->num_views = 0;
+	}
+}
+
+/* Add one line to a producer's batch and publish the batch once it is full
+- Input: p, the batch, the line (without its newline), its length, its reader_scan() flags, and whether to copy it into the arena
+- Lines of a stream are reused by getline(), so they are copied; lines of a mapping are not */
+void add_name(struct param *p, struct producer_batch *b, const char *line, size_t len, int flags, int copy){
+	static const char too_long[] = "DOMAIN NAME EXCEEDED MAX LENGTH";
+	struct name_view *v = &b->views[b->num_views];
+
+	if(b->num_views == 0){
+		b->start = now_ns();
+	}
+	v->invalid = (flags & READER_INVALID) != 0;
+	if(flags & READER_TOO_LONG){
+		v->name = too_long;
+		v->len = sizeof(too_long) - 1;
+		v->owned = 0;
+	}
+	else{
+		v->name = copy ? arena_copy(p->arena, &b->slab, line, len) : line;
+		v->len = (uint16_t)len;
+		v->owned = (uint8_t)copy;
+	}
+	v->chunk = b->chunk;
+	v->line = b->line++;
+	b->num_views++;
+
+	/* Publish a full batch to the ring; back off while it is full */
+	if(b->num_views == p->batch_size){
+		flush_names(p, b);
+	}
+}
+
+
+
 
-// TODO: Print gettid() and num_serviced to serviced.txt before exiting
+
+
+/* Producer function
+- Input: p, a structure of type struct param
+- Mapped files are produced chunk by chunk, so several producers work on one file at once;
+  the views point straight into the mapping
+- Files that cannot be mapped (stdin, pipes) are one chunk each, read with getline()
+- Each producer works through its own deque of chunks and steals from the others when it runs dry */
 void *produce(void *arg){
 
 
 	/* Cast the void parameter into a type of struct param */
   	struct param *p = (struct param*) arg;
+  	int idx = atomic_fetch_add(&p->next_producer, 1);
+  	int c, stolen;
+  	FILE *stream;
 
   	/* Initialize variables for reading the file */
   	char *line = NULL;
   	size_t n = 0;
+  	ssize_t len;
+  	const char *view;
+  	size_t view_len, pos;
+  	int flags;
+
+  	/* Per-thread batch of names published to the ring in one step */
+  	struct producer_batch b;
+  	b.views = malloc(sizeof(*b.views) * p->batch_size);
+  	b.num_views = 0;
+  	b.slab = NULL;
+
+  	p->tids[idx] = gettid();
+  	printf("tid = %ld\n", gettid());
+  	stats_attach(p->stats, "requester");
+
+  	/* Take chunks, own first and then stolen, until there are none left */
+  	while(work_next(p->work, idx, &c, &stolen) == 0){
+
+  		/* In ordered mode, do not run more than the reorder window ahead of the writer */
+  		writer_wait_window(p->writer, c);
+  		b.chunk = c;
+  		b.line = 0;
+
+  		stream = p->data_files[p->chunks[c].file].stream;
+  		if(stream == NULL){
+  			pos = 0;
+  			while(reader_next_line(&p->chunks[c], &pos, &view, &view_len, &flags) == 0){
+  				add_name(p, &b, view, view_len, flags, 0);
+  			}
+  			p->bytes_serviced[idx] += p->chunks[c].len;
+  		}
+  		else{
+  			/* Iterate through each domain name in the stream; each line is copied into the arena, and the consumer releases it */
+			while((len = getline(&line, &n, stream)) != -1){
+				p->bytes_serviced[idx] += len;
+				view_len = reader_scan(line, len, &flags);
+				add_name(p, &b, line, view_len, flags, 1);
+			}
+	    	printf("thread %ld has finished reading a file.\n", gettid());
+  		}
+  		flush_names(p, &b);
+  		writer_chunk_done(p->writer, c, b.line);
 
+  		p->chunks_serviced[idx]++;
+  		p->chunks_stolen[idx] += stolen;
+  	}
 
-  	/* All threads enter here */
-  	while(1){
-
-  		p->tids[gettid() % p->num_producer] = gettid();
-  		printf("tid = %ld\n", gettid());
+	free(line);
+	free(b.views);
+	arena_retire(p->arena, &b.slab);
 
-  		/* All threads are stuck here until the thread who is using this mutex lock, unlocks the mutex */
-    	pthread_mutex_lock(&mutex_p);
+	/* Everything this producer read is in the ring; let the consumers know */
+	atomic_fetch_add(&p->num_producers_done, 1);
+	stats_detach();
+	//printf("producer exit %ld\n", gettid());
+	return NULL;
+}
 
-    	/* If all data files have been read, the thread that is using this mutex lock, unlocks the mutex, and exits */
-    	if(p->num_data_files_done >= p->num_data_files){
-    		pthread_mutex_unlock(&mutex_p);
-    		break;
-    	}
+/* Producer function of the daemon
+- Input: p, a structure of type struct param
+- Takes one client at a time from the server and publishes its names until it closes its sending end;
+  each client is a writer session, so its answers go back to it
+- Whatever one read() brings in is published at once, so a client that waits for an answer before
+  sending more is never left waiting on a batch that is not full
+- Leaves once the daemon is stopped and no client is waiting */
+void *produce_clients(void *arg){
+	struct param *p = (struct param*) arg;
+	int idx = atomic_fetch_add(&p->next_producer, 1);
+	int fd, flags, skip;
+	size_t have, pos, len;
+	ssize_t got;
+
+	struct producer_batch b;
+	b.views = malloc(sizeof(*b.views) * p->batch_size);
+	b.num_views = 0;
+	b.slab = NULL;
+	char *buf = malloc(CLIENT_READ_SIZE);
+	if(b.views == NULL || buf == NULL){
+		printf("Could not allocate a requester's buffers\n");
+		exit(1);
+	}
 
-    	/* If the file is valid, iterate through each domain name in the data file */
-    	if(p->data_files[p->num_data_files_done] != NULL){
-
-    		while(getline(&line, &n, p->data_files[p->num_data_files_done]) != -1){
-
-    			//printf("producer %ld reading %s", gettid(), line);
-    	
-    			/* If the buffer is produced full, the producer will wait() for the empty signal */
-    			while(p->producer_idx == BUFFER_SIZE){
-    				//printf("producer %ld is waiting\n", gettid());
-      				pthread_cond_wait(&empty, &mutex_temp);
-      				//printf("producer %ld has been woken up\n", gettid());
-    			}
-
-    			//printf("p->producer_idx = %d\n", p->producer_idx);
-      	
-      			/* Otherwise, the producer will produce to the buffer */
-		      	if(strlen(line) > MAX_NAME_LENGTH){
-		      		strcpy(p->buffer[p->producer_idx], "DOMAIN NAME EXCEEDED MAX LENGTH");
-      			}
-      			else{
-	      			line[strlen(line) - 1] = 0;
-    	  			strcpy(p->buffer[p->producer_idx], line);
-      			}
-
-
-	      		/* Update the producer index of the buffer */
-	    	  	p->producer_idx++;
-	    	  	p->num_produced++;
-	    	  	//printf("p->num_produced = %d\n", p->num_produced);
-
-    	  		/* If the buffer is produced full or all domains have been read, signal() full to the consumer */
-    	  		if(p->producer_idx == BUFFER_SIZE || p->num_produced == p->num_domains){
-    	  			//printf("\nsend signal p->producer_idx = %d\n", p->producer_idx);
-    	  			//printf("send signal p->num_produced = %d\n\n", p->num_produced);
-	      			pthread_cond_broadcast(&full);
-	      		}
-    		}
+	p->tids[idx] = gettid();
+	printf("tid = %ld\n", gettid());
+	stats_attach(p->stats, "requester");
+
+	while((fd = server_next_client(p->server)) >= 0){
+		b.chunk = writer_session_open(p->writer, fd);
+		b.line = 0;
+		have = 0;
+		skip = 0;
+
+		while(1){
+			/* Read no more of a client's names while it leaves its answers unread */
+			writer_session_wait(p->writer, b.chunk);
+			if((got = read(fd, buf + have, CLIENT_READ_SIZE - have)) == 0){
+				break;
+			}
+			if(got < 0){
+				if(errno == EINTR){
+					continue;
+				}
+
+				/* A hang-up, or a client idle for SERVER_IDLE_MS, ends its names like a closed sending end */
+				break;
+			}
+			p->bytes_serviced[idx] += got;
+			have += got;
+
+			/* Publish every complete line; a line is complete once its newline is in */
+			pos = 0;
+			while(pos < have && (len = reader_scan(buf + pos, have - pos, &flags)) < have - pos){
+				if(!skip){
+					add_name(p, &b, buf + pos, len, flags, 1);
+				}
+				skip = 0;
+				pos += len + 1;
+			}
+
+			/* A line that fills the whole buffer can only be too long; publish it now and drop the rest of it */
+			if(pos == 0 && have == CLIENT_READ_SIZE){
+				if(!skip){
+					add_name(p, &b, buf, have, READER_INVALID | READER_TOO_LONG, 1);
+				}
+				skip = 1;
+				pos = have;
+			}
+			memmove(buf, buf + pos, have - pos);
+			have -= pos;
+			flush_names(p, &b);
 		}
 
-		/* Increment num data files serviced */
-	    p->num_data_files_done++;
-	    printf("thread %ld has finished reading a file.\n", gettid());
-	    p->counter[gettid() % p->num_producer]++;
-	    pthread_mutex_unlock(&mutex_p);
-  	}
+		/* A last line without a newline */
+		if(have > 0 && !skip){
+			len = reader_scan(buf, have, &flags);
+			add_name(p, &b, buf, len, flags, 1);
+		}
+		flush_names(p, &b);
+		writer_chunk_done(p->writer, b.chunk, b.line);
+		p->chunks_serviced[idx]++;
+	}
 
-	free(line);
-	//printf("producer exit %ld\n", gettid());
+	free(buf);
+	free(b.views);
+	arena_retire(p->arena, &b.slab);
+	atomic_fetch_add(&p->num_producers_done, 1);
+	stats_detach();
 	return NULL;
 }
 
@@ -416,11 +1383,368 @@ void *produce(void *arg){
 
 
 
-int main(int argc, char **argv){
+/* Resolver pool
+- min/max: Bounds on the num of consumers
+- started: Num of consumer threads created so far; indexes 0..started-1
+- peak: Largest num of consumers the pool has had
+- resolve: consume or consume_async
+- tids: The consumer threads; room for max */
+struct pool{
+	int min;
+	int max;
+	int started;
+	int peak;
+	void *(*resolve)(void *);
+	pthread_t *tids;
+};
+
+/* Let the first target consumers run and make the rest sit out; threads are only created when first needed */
+void set_resolver_target(struct param *p, struct pool *pool, int target){
+	while(pool->started < target){
+		pthread_create(&pool->tids[pool->started++], NULL, pool->resolve, p);
+	}
+	if(target > pool->peak){
+		pool->peak = target;
+	}
+	pthread_mutex_lock(&p->pool_lock);
+	atomic_store_explicit(&p->resolver_target, target, memory_order_relaxed);
+	pthread_cond_broadcast(&p->pool_cond);
+	pthread_mutex_unlock(&p->pool_lock);
+}
+
+/* Controller of the adaptive resolver pool
+- Input: p and the pool
+- Samples the buffer depth and mean lookup time every CONTROL_INTERVAL_MS until the producers
+  are done and the buffer is drained
+- A backlog of more than a batch per consumer that is not shrinking grows the pool by half;
+  a buffer that stays nearly empty for SHRINK_SAMPLES samples shrinks it by one
+- Consumers whose lookups are CPU-bound (cache hits, fast answers) only compete for cores,
+  so then the pool stays within the cores the pipeline runs on */
+void control_pool(struct param *p, struct pool *pool){
+	struct timespec interval = {0, CONTROL_INTERVAL_MS * 1000000L};
+	int cores = p->cores;
+	int target = atomic_load(&p->resolver_target);
+	int quiet = 0;
+	int limit;
+	size_t depth, last_depth = 0;
+	unsigned long long lookups, lookup_ns, mean = 0;
+	unsigned long long last_lookups = 0, last_lookup_ns = 0;
+
+	while(atomic_load(&p->num_producers_done) < p->num_producer || ring_count(p->ring) > 0){
+		nanosleep(&interval, NULL);
+
+		/* Mean time of the lookups done since the last sample; keep the old one if none were */
+		depth = ring_count(p->ring);
+		lookups = atomic_load_explicit(&p->lookups, memory_order_relaxed);
+		lookup_ns = atomic_load_explicit(&p->lookup_ns, memory_order_relaxed);
+		if(lookups > last_lookups){
+			mean = (lookup_ns - last_lookup_ns) / (lookups - last_lookups);
+		}
+		last_lookups = lookups;
+		last_lookup_ns = lookup_ns;
+
+		limit = pool->max;
+		if(mean < CPU_BOUND_NS && limit > cores){
+			limit = cores > pool->min ? cores : pool->min;
+		}
+
+		if(target > limit){
+			target--;
+			quiet = 0;
+		}
+		else if(depth > (size_t)p->batch_size * target && depth >= last_depth && target < limit){
+			target += target / 2 > 1 ? target / 2 : 1;
+			target = target < limit ? target : limit;
+			quiet = 0;
+		}
+		else if(depth < (size_t)p->batch_size){
+			if(++quiet >= SHRINK_SAMPLES && target > pool->min){
+				target--;
+				quiet = 0;
+			}
+		}
+		else{
+			quiet = 0;
+		}
+		last_depth = depth;
+
+		if(target != atomic_load(&p->resolver_target)){
+			set_resolver_target(p, pool, target);
+		}
+	}
+}
+
+
+
+
+
+/* One pipeline: a buffer with its own requesters and resolvers, and everything they touch per name;
+  pipelines share only the data files, the zone and the statistics, which are read-only or per thread
+- p: Parameter of its threads
+- pool: Its resolver pool
+- ring: Its buffer
+- work: Its requesters' deques; it takes a contiguous run of the chunks
+- cpu: CPU every thread of it is pinned to; -1 leaves them unpinned
+- queue_depth/cache_bytes/cache_path/backend_options/format/reorder_window: What it is built with
+- procs: The worker processes every pipeline looks names up in; NULL without -w
+- fd: Where its writer writes
+- out: Temporary file fd belongs to, appended to <resolver log> at the end; NULL if fd is <resolver log>
+- num_consumer: Resolvers it starts with
+- adaptive: Whether control_pool() steers its pool
+- warm: Whether its cache was loaded from <cache file>, so a refresher runs
+- producers/refresher/thread: Its threads */
+struct pipeline{
+	struct param p;
+	struct pool pool;
+	struct ring ring;
+	struct work work;
+	int cpu;
+	int queue_depth;
+	size_t cache_bytes;
+	const char *cache_path;
+	const char *backend_options;
+	struct procs *procs;
+	enum writer_format format;
+	int reorder_window;
+	int fd;
+	FILE *out;
+	int num_consumer;
+	int adaptive;
+	int warm;
+	pthread_t *producers;
+	pthread_t refresher;
+	pthread_t thread;
+};
+
+/* Run one pipeline to the end
+- Input: pl, a structure of type struct pipeline
+- Pins itself first, so the buffer, the cache and the writer are allocated on, and every thread
+  it starts (the writer's and the backend's included) runs on, the pipeline's CPU
+- Returns once every name of its chunks is written */
+void *run_pipeline(void *arg){
+	struct pipeline *pl = (struct pipeline *) arg;
+	struct param *p = &pl->p;
+
+	if(pl->cpu >= 0 && affinity_pin(pl->cpu) != 0){
+		printf("Could not pin a pipeline to CPU %d; it runs unpinned\n", pl->cpu);
+	}
+	if(ring_init(&pl->ring, pl->queue_depth) != 0){
+		printf("Could not allocate the shared buffer\n");
+		exit(1);
+	}
+	if((p->arena = arena_create()) == NULL){
+		printf("Could not allocate the name arena\n");
+		exit(1);
+	}
+	if(pl->cache_bytes > 0 && (p->cache = cache_create(pl->cache_bytes)) == NULL){
+		printf("Could not allocate the resolution cache\n");
+		exit(1);
+	}
+
+	/* Only map the snapshot; its answers are read as names ask for them. A missing file is a cold start */
+	if(pl->cache_path != NULL){
+		if(cache_load(p->cache, pl->cache_path) == 0){
+			pl->warm = 1;
+		}
+		else if(errno != ENOENT){
+			printf("Could not load the cache snapshot %s; starting cold\n", pl->cache_path);
+		}
+	}
+	if((p->flight = flight_create()) == NULL){
+		printf("Could not allocate the in-flight table\n");
+		exit(1);
+	}
+	/* The worker processes have each set up the backend for themselves */
+	if(pl->procs != NULL){
+		p->backend = &procs_backend;
+		p->backend_state = pl->procs;
+	}
+	else if(p->backend->init(&p->backend_state, pl->backend_options) != UTIL_SUCCESS){
+		printf("Could not start the %s resolver backend\n", p->backend->name);
+		exit(1);
+	}
+
+	/* With a deadline, blocking lookups go through the hedging backend; the async engine keeps its own deadlines */
+	if(p->deadline_ms > 0){
+		if(hedge_wrap(p->backend, p->backend_state, p->deadline_ms, p->hedge_percentile, &p->backend_state) != UTIL_SUCCESS){
+			printf("Could not start the hedging backend\n");
+			exit(1);
+		}
+		p->backend = &hedge_backend;
+	}
+
+	/* Start the log writer; it owns its log until every resolver is done, or in the daemon the clients' sockets */
+	if(p->server != NULL){
+		p->writer = writer_create_sessions(SERVER_MAX_SESSIONS, p->stats);
+	}
+	else{
+		p->writer = writer_create(pl->fd, pl->format, pl->reorder_window, p->num_chunks, p->stats);
+	}
+	if(p->writer == NULL){
+		printf("Could not start the log writer\n");
+		exit(1);
+	}
+
+	/* Deal the chunks out to the producers' deques in contiguous runs */
+	if(work_init(&pl->work, p->num_producer, p->num_chunks) != 0){
+		printf("Could not allocate the work-stealing deques\n");
+		exit(1);
+	}
+
+	/* Create producer and consumer threads */
+	set_resolver_target(p, &pl->pool, pl->num_consumer);
+	for(int i = 0; i < p->num_producer; i++){
+		pthread_create(&pl->producers[i], NULL, p->server != NULL ? produce_clients : produce, p);
+	}
+	if(pl->warm && pthread_create(&pl->refresher, NULL, refresh_stale, p) != 0){
+		pl->warm = 0;
+	}
+
+	/* In adaptive mode this thread steers the pool until the buffer is drained */
+	if(pl->adaptive){
+		control_pool(p, &pl->pool);
+	}
+
+	for(int i = 0; i < p->num_producer; i++){
+		pthread_join(pl->producers[i], NULL);
+	}
+
+	/* Wake the consumers that sit out so they see the buffer is drained and exit */
+	pthread_mutex_lock(&p->pool_lock);
+	p->pool_closing = 1;
+	pthread_cond_broadcast(&p->pool_cond);
+	pthread_mutex_unlock(&p->pool_lock);
+	for(int i = 0; i < pl->pool.started; i++){
+		pthread_join(pl->pool.tids[i], NULL);
+	}
+	if(pl->warm){
+		atomic_store(&p->refresh_stop, 1);
+		pthread_join(pl->refresher, NULL);
+	}
+	writer_close(p->writer);
+	return NULL;
+}
+
+/* Append the pipelines' temporary logs to <resolver log> in pipeline order; they hold consecutive runs
+  of the chunks, so with -o the result is in input order
+- Input: The pipelines, their num, and the fd of <resolver log>
+- Returns 0, or -1 if a log could not be read or written */
+int merge_logs(struct pipeline *pipes, int num_pipelines, int fd){
+	char *buf = malloc(MERGE_BUF_SIZE);
+	int ret = buf != NULL ? 0 : -1;
+
+	for(int k = 0; k < num_pipelines && ret == 0; k++){
+		int in = pipes[k].fd;
+		ssize_t got;
+		if(lseek(in, 0, SEEK_SET) != 0){
+			ret = -1;
+			break;
+		}
+		while(ret == 0 && (got = read(in, buf, MERGE_BUF_SIZE)) != 0){
+			if(got < 0){
+				if(errno != EINTR){
+					ret = -1;
+				}
+				continue;
+			}
+			for(ssize_t done = 0, wrote; done < got; done += wrote){
+				if((wrote = write(fd, buf + done, got - done)) < 0){
+					if(errno != EINTR){
+						ret = -1;
+						break;
+					}
+					wrote = 0;
+				}
+			}
+		}
+	}
+	free(buf);
+	return ret;
+}
+
+/* Run the data files through the dedup pre-pass and put its names file in their place
+- Input: <resolver log>, the memory budget, and the data files and their chunks, replaced on return
+- Every line is scanned as a requester would scan it, so copies that differ only in case are one name;
+  the data files are closed afterwards
+- Returns the pre-pass, with the fd of the log its names are to be answered into in *log_fd */
+struct dedup *dedup_data_files(const char *path, size_t budget, struct input_file **data_files, int *num_data_files,
+	struct chunk **chunks, int *num_chunks, int *log_fd){
+	struct input_file *files = *data_files;
+	struct dedup *d;
+	size_t input_bytes = 0;
+	char *line = NULL;
+	size_t n = 0;
+	int names_fd, flags;
+
+	for(int i = 0; i < *num_data_files; i++){
+		input_bytes += files[i].map.size;
+	}
+	if((d = dedup_create(path, budget, input_bytes)) == NULL){
+		printf("Could not start the dedup pre-pass next to %s\n", path);
+		exit(1);
+	}
+
+	/* Chunks are in input order, so this is the order of the lines */
+	for(int c = 0; c < *num_chunks; c++){
+		FILE *stream = files[(*chunks)[c].file].stream;
+		const char *view;
+		size_t view_len, pos = 0;
+		ssize_t len;
+		int ret = 0;
+		if(stream == NULL){
+			while(ret == 0 && reader_next_line(&(*chunks)[c], &pos, &view, &view_len, &flags) == 0){
+				ret = dedup_add(d, view, view_len);
+			}
+		}
+		else{
+			while(ret == 0 && (len = getline(&line, &n, stream)) != -1){
+				ret = dedup_add(d, line, reader_scan(line, len, &flags));
+			}
+		}
+		if(ret != 0){
+			perror("Error spilling the data files");
+			exit(1);
+		}
+	}
+	free(line);
+	if(dedup_finish(d, &names_fd, log_fd) != 0){
+		perror("Error deduplicating the data files");
+		exit(1);
+	}
+
+	/* The names file is the only data file from here on */
+	for(int i = 0; i < *num_data_files; i++){
+		if(files[i].stream != NULL && files[i].stream != stdin){
+			fclose(files[i].stream);
+		}
+		reader_unmap(&files[i].map);
+	}
+	files = realloc(files, sizeof(*files));
+	files[0].stream = NULL;
+	if(reader_map(names_fd, &files[0].map) != 0){
+		perror("Error mapping the deduplicated names");
+		exit(1);
+	}
+	*num_chunks = reader_split(&files[0].map, 0, READER_CHUNK_SIZE, NULL, 0);
+	free(*chunks);
+	*chunks = malloc(sizeof(**chunks) * (*num_chunks + 1));
+	reader_split(&files[0].map, 0, READER_CHUNK_SIZE, *chunks, SIZE_MAX);
+	*data_files = files;
+	*num_data_files = 1;
+	return d;
+}
+
+
+
 
 
-	struct timeval start, end;
-	gettimeofday(&start, NULL);
+/* The whole program; main() is a call to this, and the benchmark driver calls it once per configuration
+- Input: The command line, and where to put the numbers of the run (may be NULL) */
+int run_lookup(int argc, char **argv, struct lookup_report *report){
+
+
+	unsigned long long start = now_ns();
+	double seconds;
 
 
 
@@ -428,22 +1752,49 @@ int main(int argc, char **argv){
     - num_producer: The number of producer threads
     - num_consumer: The number of consumer threads
     - num_data_files: The number of data files
-    - num_domains: The number of domains
     - producer_log: serviced.txt
     - consumer_log: results.txt
-    - buffer: Shared memory buffer
+    - ring: Shared lock-free ring buffer
     - p: Parameter for thread init functions */
 	int num_producer = 0;
 	int num_consumer = 0;
 	int num_data_files = 0;
-	int num_domains = 0;
+	int batch_size = DEFAULT_BATCH_SIZE;
+	int use_async = 0;
+	struct sockaddr_storage nameserver;
+	socklen_t nameserver_len = 0;
+	int max_inflight = ADNS_DEFAULT_INFLIGHT;
+	int deadline_ms = 0;
+	int hedge_percentile = HEDGE_DEFAULT_PERCENTILE;
+	int cache_mb = CACHE_DEFAULT_MB;
+	int reorder_window = 0;
+	int queue_depth = DEFAULT_BUFFER_SIZE;
+	int adaptive = 0;
+	int num_pipelines = 0;
+	int dedup_mb = 0;
+	int num_procs = 0;
+	struct procs *procs = NULL;
+	struct dedup *dedup = NULL;
+	struct dedup_stats dedup_stats;
+	int log_fd = -1;
+	struct pool pool;
+	const struct resolver_backend *backend = &dns_backend;
+	const char *backend_options = NULL;
+	const char *stats_path = NULL;
+	const char *cache_path = NULL;
+	const char *zone_path = NULL;
+	struct zone_db zone;
+	const char *server_path = NULL;
+	const char *client_path = NULL;
+	struct server *server = NULL;
+	enum writer_format format = WRITER_TEXT;
+	struct stats *stats = NULL;
+	struct stats_totals *totals = NULL;
+	uint64_t bytes_written, writes;
+	struct cache_stats cache_stats;
+	int opt;
  	FILE *producer_log = NULL;
 	FILE *consumer_log = NULL;
-  	char buffer[BUFFER_SIZE][MAX_NAME_LENGTH];
-  	for(int i = 0; i < BUFFER_SIZE; i++){
-   		memset(buffer[i], 0, sizeof(buffer[i]));
-  	}
-  	struct param p;
 
 
 
@@ -451,72 +1802,309 @@ int main(int argc, char **argv){
 
 
 
-  	/* Read user arguments; helper functions check for error */
-  	usage(argv[0], argc);
+  	/* Read options, then shift argv so the positional arguments start at argv[1]; a second run must rescan */
+  	optind = 1;
+  	while((opt = getopt(argc, argv, "b:n:q:c:o:d:a:m:j:f:p:t:z:P:u:w:S:C:")) != -1){
+  		switch(opt){
+  			case 'b':
+  				batch_size = get_batch_size(optarg);
+  				break;
+  			case 'n':
+  				get_nameserver(optarg, &nameserver, &nameserver_len);
+  				use_async = 1;
+  				break;
+  			case 'q':
+  				max_inflight = get_num_inflight(optarg);
+  				break;
+  			case 'c':
+  				cache_mb = get_cache_size(optarg);
+  				break;
+  			case 'o':
+  				reorder_window = get_reorder_window(optarg);
+  				break;
+  			case 'd':
+  				queue_depth = get_queue_depth(optarg);
+  				break;
+  			case 'a':
+  				get_pool_range(optarg, &pool.min, &pool.max);
+  				adaptive = 1;
+  				break;
+  			case 'm':
+  				backend = &mock_backend;
+  				backend_options = optarg;
+  				break;
+  			case 'j':
+  				stats_path = optarg;
+  				break;
+  			case 'f':
+  				format = get_output_format(optarg);
+  				break;
+  			case 'p':
+  				cache_path = optarg;
+  				break;
+  			case 't':
+  				get_deadline(optarg, &deadline_ms, &hedge_percentile);
+  				break;
+  			case 'z':
+  				zone_path = optarg;
+  				break;
+  			case 'P':
+  				num_pipelines = get_num_pipelines(optarg);
+  				break;
+  			case 'u':
+  				dedup_mb = get_dedup_size(optarg);
+  				break;
+  			case 'w':
+  				num_procs = get_num_procs(optarg);
+  				break;
+  			case 'S':
+  				server_path = optarg;
+  				break;
+  			case 'C':
+  				client_path = optarg;
+  				break;
+  			default:
+  				usage(argv[0], 0, 1);
+  		}
+  	}
+  	argv[optind - 1] = argv[0];
+  	argv += optind - 1;
+  	argc -= optind - 1;
+  	/* A client only sends its data files to the daemon and prints what comes back */
+  	if(client_path != NULL){
+  		usage(argv[0], argc, 2);
+  		return server_client(client_path, argc - 1, argv + 1, STDOUT_FILENO);
+  	}
+
+  	/* Read user arguments; helper functions check for error. The daemon has no <resolver log> or data files */
+  	usage(argv[0], argc, server_path != NULL ? 4 : 6);
   	num_producer = get_num_producer(argv[1]);
   	num_consumer = get_num_consumer(argv[2]);
   	producer_log = open_producer_log(argv[3], producer_log);
-  	consumer_log = open_consumer_log(argv[4], consumer_log);
+  	if(num_pipelines > 1 && (server_path != NULL || cache_path != NULL || format != WRITER_TEXT)){
+  		printf("<pipelines> merges text logs at the end; it cannot be used with -S, -p or -f binary\n");
+  		exit(1);
+  	}
+  	if(dedup_mb > 0 && (server_path != NULL || format != WRITER_TEXT)){
+  		printf("<dedup MB> fans text lines back out to the data files; it cannot be used with -S or -f binary\n");
+  		exit(1);
+  	}
+  	if(use_async && num_procs > 0){
+  		printf("<resolver processes> run blocking lookups; it cannot be used with -n\n");
+  		exit(1);
+  	}
 
+  	/* Fork the worker processes before the first thread (the daemon's included), so each is a copy of a single-threaded process */
+  	if(num_procs > 0 && (procs = procs_create(backend, backend_options, num_procs)) == NULL){
+  		printf("Could not start the %s resolver backend in %d worker processes\n", backend->name, num_procs);
+  		exit(1);
+  	}
+  	if(server_path != NULL){
+  		if(reorder_window > 0 || format != WRITER_TEXT){
+  			printf("The daemon answers each client in text as names are resolved; it cannot be used with -o or -f binary\n");
+  			exit(1);
+  		}
 
+  		/* Before any other thread starts, so they all leave SIGINT and SIGTERM to the server */
+  		if((server = server_create(server_path)) == NULL){
+  			perror("Could not listen on the daemon socket");
+  			exit(1);
+  		}
+  	}
+  	else{
+  		consumer_log = open_consumer_log(argv[4], consumer_log);
+  	}
+  	if(cache_path != NULL && cache_mb == 0){
+  		printf("<cache file> needs the resolution cache; it cannot be used with -c 0\n");
+  		exit(1);
+  	}
+
+  	/* Only map the zone; a name is answered from it with two probes, and only misses go on to the cache and the resolver */
+  	if(zone_path != NULL && zone_open(zone_path, &zone) != 0){
+  		printf("Could not open the zone database %s\n", zone_path);
+  		exit(1);
+  	}
+  	if(use_async && backend != &dns_backend){
+  		printf("<nameserver> and <mock latency> cannot be used together\n");
+  		exit(1);
+  	}
 
 
-  	
-  	/* Get number of data files */
-  	num_data_files = get_num_data_files(argc);
-  	FILE **data_files = malloc(sizeof(FILE*) * num_data_files);
-  	
-  	/* Store all data files in array */
-  	for(int i = 0; i < num_data_files; i++){
 
-  		data_files[i] = open_data_files(argv[i + 5], data_files[i], 0);
-    	
-    	/* Count the number of domains in each data file */
-    	if(data_files[i] != NULL){
-    		num_domains += get_num_domains(data_files[i]);
-    	}
-  	}
 
 
-  	/* Close all data files to reset getline() */
+  	/* Get number of data files */
+  	num_data_files = server != NULL ? 0 : get_num_data_files(argc);
+  	struct input_file *data_files = malloc(sizeof(*data_files) * num_data_files);
+  	int num_chunks = 0;
+
+  	/* Store all data files in array; each is opened once, and mapped if it is a regular file; a stream is one chunk */
   	for(int i = 0; i < num_data_files; i++){
-    	if(data_files[i] != NULL){
-      		fclose(data_files[i]);
-    	}
+  		data_files[i].stream = open_data_files(argv[i + 5], data_files[i].stream);
+  		data_files[i].map.data = NULL;
+  		data_files[i].map.size = 0;
+  		if(data_files[i].stream != NULL && data_files[i].stream != stdin
+  			&& reader_map(fileno(data_files[i].stream), &data_files[i].map) == 0){
+  			fclose(data_files[i].stream);
+  			data_files[i].stream = NULL;
+  			num_chunks += reader_split(&data_files[i].map, i, READER_CHUNK_SIZE, NULL, 0);
+  		}
+  		else if(data_files[i].stream != NULL){
+  			num_chunks++;
+  		}
   	}
 
-  	/* Re-open all data files */
+  	/* Split the mapped files into newline-aligned chunks; chunk order is input order */
+  	struct chunk *chunks = malloc(sizeof(*chunks) * (num_chunks + 1));
+  	num_chunks = 0;
   	for(int i = 0; i < num_data_files; i++){
-    	data_files[i] = open_data_files(argv[i + 5], data_files[i], 1);
+  		if(data_files[i].stream == NULL){
+  			num_chunks += reader_split(&data_files[i].map, i, READER_CHUNK_SIZE, chunks + num_chunks, SIZE_MAX);
+  		}
+  		else{
+  			chunks[num_chunks].start = NULL;
+  			chunks[num_chunks].len = 0;
+  			chunks[num_chunks].file = i;
+  			num_chunks++;
+  		}
   	}
-  
-
 
-  	/* tid stuff */
-  	int tids[num_producer];
-  	int counter[num_producer];
-  	for(int i = 0; i < num_producer; i++){
-  		counter[i] = 0;
+  	/* Only distinct names go on to the pipelines; their answers go to a temporary log, fanned out to <resolver log> at the end */
+  	if(consumer_log != NULL){
+  		log_fd = fileno(consumer_log);
+  	}
+  	if(dedup_mb > 0){
+  		dedup = dedup_data_files(argv[4], (size_t)dedup_mb << 20, &data_files, &num_data_files, &chunks, &num_chunks, &log_fd);
   	}
 
+  	/* Start collecting statistics before the first thread, so every thread leaves SIGUSR1 to the listener */
+  	if((stats = stats_create(stats_path)) == NULL){
+  		printf("Could not start collecting statistics\n");
+  		exit(1);
+  	}
 
+  	/* A pipeline gets at least one chunk, so there are never more pipelines than chunks; they take the CPUs this process may run on in turn */
+  	int pinned = num_pipelines > 0;
+  	if(num_pipelines > num_chunks && server == NULL){
+  		num_pipelines = num_chunks;
+  	}
+  	if(num_pipelines < 1){
+  		num_pipelines = 1;
+  	}
+  	int *cpus = malloc(sizeof(*cpus) * num_pipelines);
+  	int num_cpus = cpus != NULL ? affinity_cpus(cpus, num_pipelines) : 0;
+
+  	/* tid stuff; there is no cap on threads, so these live on the heap; each pipeline has a slice */
+  	int *tids = calloc(num_pipelines * num_producer, sizeof(*tids));
+  	int *chunks_serviced = calloc(num_pipelines * num_producer, sizeof(*chunks_serviced));
+  	long *bytes_serviced = calloc(num_pipelines * num_producer, sizeof(*bytes_serviced));
+  	int *chunks_stolen = calloc(num_pipelines * num_producer, sizeof(*chunks_stolen));
+  	struct pipeline *pipes = calloc(num_pipelines, sizeof(*pipes));
+  	if(tids == NULL || chunks_serviced == NULL || bytes_serviced == NULL || chunks_stolen == NULL
+  		|| pipes == NULL || num_cpus == 0){
+  		printf("Could not allocate the thread tables\n");
+  		exit(1);
+  	}
 
-  	/* Initialize elements of type struct param */
-  	p.num_data_files = num_data_files;
-  	p.num_data_files_done = 0;
-  	p.num_domains = num_domains;
-  	p.num_consumed = 0;
-  	p.num_produced = 0;
-  	p.producer_idx = 0;
-  	p.consumer_idx = 0;
-  	p.buffer = buffer;
-  	p.data_files = data_files;
-  	p.consumer_log = consumer_log;
-  	p.producer_log = producer_log;
+  	/* Without -a the pool is fixed at <# resolver>; with it, <# resolver> is where it starts */
+  	if(!adaptive){
+  		pool.min = pool.max = num_consumer;
+  	}
+  	num_consumer = num_consumer < pool.min ? pool.min : num_consumer > pool.max ? pool.max : num_consumer;
+
+
+
+  	/* Initialize each pipeline; its buffer, cache, backend and writer are made by its own thread, on its own CPU */
+  	for(int k = 0; k < num_pipelines; k++){
+  		struct pipeline *pl = &pipes[k];
+  		struct param *q = &pl->p;
+  		int first = (int)((long)num_chunks * k / num_pipelines);
+  		int last = (int)((long)num_chunks * (k + 1) / num_pipelines);
+
+  		pl->cpu = pinned ? cpus[k % num_cpus] : -1;
+  		pl->queue_depth = queue_depth;
+  		pl->cache_bytes = ((size_t)cache_mb << 20) / num_pipelines;
+  		pl->cache_path = cache_path;
+  		pl->backend_options = backend_options;
+  		pl->procs = procs;
+  		pl->format = format;
+  		pl->reorder_window = dedup != NULL && reorder_window == 0 ? DEDUP_REORDER_WINDOW : reorder_window;
+  		pl->num_consumer = num_consumer;
+  		pl->adaptive = adaptive;
+  		pl->pool.min = pool.min;
+  		pl->pool.max = pool.max;
+  		pl->pool.started = 0;
+  		pl->pool.peak = 0;
+  		pl->pool.resolve = use_async ? consume_async : consume;
+  		pl->pool.tids = malloc(sizeof(*pl->pool.tids) * pool.max);
+  		pl->producers = malloc(sizeof(*pl->producers) * num_producer);
+  		pl->out = NULL;
+  		if(pl->pool.tids == NULL || pl->producers == NULL){
+  			printf("Could not allocate the thread tables\n");
+  			exit(1);
+  		}
 
-  	p.num_producer = num_producer;
-  	p.tids = tids;
-  	p.counter = counter;
+  		/* Several pipelines each fill a temporary file next to <resolver log>, appended to it in order at the end */
+  		if(num_pipelines > 1){
+  			char path[4096];
+  			int fd;
+  			snprintf(path, sizeof(path), "%s.%d.XXXXXX", argv[4], k);
+  			if((fd = mkstemp(path)) < 0 || (pl->out = fdopen(fd, "w+")) == NULL){
+  				printf("Could not create a temporary log next to %s\n", argv[4]);
+  				exit(1);
+  			}
+  			unlink(path);
+  		}
+  		pl->fd = pl->out != NULL ? fileno(pl->out) : log_fd;
+
+  		/* Initialize elements of type struct param */
+  		q->num_data_files = num_data_files;
+  		atomic_init(&q->num_producers_done, 0);
+  		atomic_init(&q->num_produced, 0);
+  		q->ring = &pl->ring;
+  		q->batch_size = batch_size;
+  		q->use_async = use_async;
+  		if(use_async){
+  			q->nameserver = nameserver;
+  		}
+  		q->nameserver_len = nameserver_len;
+  		q->max_inflight = max_inflight;
+  		q->deadline_ms = deadline_ms;
+  		q->hedge_percentile = hedge_percentile;
+  		q->zone = zone_path != NULL ? &zone : NULL;
+  		q->cache = NULL;
+  		q->flight = NULL;
+  		q->backend = backend;
+  		q->backend_state = NULL;
+  		q->writer = NULL;
+  		q->server = server;
+  		q->arena = NULL;
+  		q->data_files = data_files;
+  		q->chunks = chunks + first;
+  		q->num_chunks = last - first;
+  		q->work = &pl->work;
+  		atomic_init(&q->next_producer, 0);
+  		q->consumer_log = consumer_log;
+  		q->producer_log = producer_log;
+
+  		q->num_producer = num_producer;
+  		q->tids = tids + k * num_producer;
+  		q->chunks_serviced = chunks_serviced + k * num_producer;
+  		q->bytes_serviced = bytes_serviced + k * num_producer;
+  		q->chunks_stolen = chunks_stolen + k * num_producer;
+
+  		atomic_init(&q->next_consumer, 0);
+  		pthread_mutex_init(&q->pool_lock, NULL);
+  		pthread_cond_init(&q->pool_cond, NULL);
+  		atomic_init(&q->resolver_target, 0);
+  		q->pool_closing = 0;
+  		q->cores = pinned ? 1 : sysconf(_SC_NPROCESSORS_ONLN);
+  		atomic_init(&q->lookups, 0);
+  		atomic_init(&q->lookup_ns, 0);
+  		q->stats = stats;
+  		atomic_init(&q->refresh_stop, 0);
+  		atomic_init(&q->num_refreshed, 0);
+  	}
 
 
 
@@ -528,54 +2116,191 @@ int main(int argc, char **argv){
 
 
 
-  	/* Create producer and consumer threads */
-  	pthread_t tids_producer[num_producer];
-  	pthread_t tids_consumer[num_consumer];
-  	
-  	for(int i = 0; i < num_consumer; i++){
-    	pthread_create(&tids_consumer[i], NULL, consume, &p);
+  	/* A single pipeline runs on this thread; several each get a thread of their own */
+  	if(num_pipelines == 1){
+  		run_pipeline(&pipes[0]);
   	}
-  	for(int i = 0; i < num_producer; i++){
-    	pthread_create(&tids_producer[i], NULL, produce, &p);
+  	else{
+  		for(int k = 0; k < num_pipelines; k++){
+  			if(pthread_create(&pipes[k].thread, NULL, run_pipeline, &pipes[k]) != 0){
+  				printf("Could not start pipeline %d\n", k);
+  				exit(1);
+  			}
+  		}
+  		for(int k = 0; k < num_pipelines; k++){
+  			pthread_join(pipes[k].thread, NULL);
+  		}
+  		if(merge_logs(pipes, num_pipelines, log_fd) != 0){
+  			perror("Error writing <resolver log>");
+  		}
   	}
-
-  	for(int i = 0; i < num_producer; i++){
-    	pthread_join(tids_producer[i], NULL);
+  	if(dedup != NULL && dedup_fanout(dedup, fileno(consumer_log), reorder_window > 0) != 0){
+  		perror("Error writing <resolver log>");
   	}
- 	for(int i = 0; i < num_consumer; i++){
-    	pthread_join(tids_consumer[i], NULL);
+  	seconds = (now_ns() - start) / 1e9;
+  	if(server != NULL){
+  		server_destroy(server);
   	}
-  	
 
 
 
-  	for(int i = 0; i < num_producer; i++){
+
+  	for(int i = 0; i < num_pipelines * num_producer; i++){
   		fputs("Thread ", producer_log);
   		fprintf(producer_log, "%d ", tids[i]);
   		fputs("serviced ", producer_log);
-  		fprintf(producer_log, "%d ", counter[i]);
-  		fputs("files.\n", producer_log);
-  		//printf("%d %d\n", tids[i], counter[i]);
+  		fprintf(producer_log, "%d ", chunks_serviced[i]);
+  		if(server != NULL){
+  			fprintf(producer_log, "clients (%ld bytes).\n", bytes_serviced[i]);
+  		}
+  		else{
+  			fprintf(producer_log, "chunks (%ld bytes, %d stolen).\n", bytes_serviced[i], chunks_stolen[i]);
+  		}
+  		//printf("%d %d\n", tids[i], chunks_serviced[i]);
   	}
 
 
 
   	/* Return gracefully
     - close all files that were opened
-    - free all memory allocated */
+    - free all memory allocated
+    - add up what the pipelines did */
   	fclose(producer_log);
-  	fclose(consumer_log);
+  	if(consumer_log != NULL){
+  		fclose(consumer_log);
+  	}
   	for(int i = 0; i < num_data_files; i++){
-    	if(data_files[i] != NULL){
-      		fclose(data_files[i]);
+    	if(data_files[i].stream != NULL && data_files[i].stream != stdin){
+      		fclose(data_files[i].stream);
     	}
+    	reader_unmap(&data_files[i].map);
   	}
-  	
+
   	free(data_files);
+  	free(chunks);
+  	free(tids);
+  	free(chunks_serviced);
+  	free(bytes_serviced);
+  	free(chunks_stolen);
+  	free(cpus);
+
+  	memset(&cache_stats, 0, sizeof(cache_stats));
+  	bytes_written = writes = 0;
+  	long num_names = 0, num_refreshed = 0;
+  	uint64_t coalesced = 0;
+  	int peak = 0, ended = 0;
+  	for(int k = 0; k < num_pipelines; k++){
+  		struct pipeline *pl = &pipes[k];
+  		struct param *q = &pl->p;
+  		uint64_t b, w;
+  		writer_get_stats(q->writer, &b, &w);
+  		bytes_written += b;
+  		writes += w;
+  		writer_destroy(q->writer);
+  		if(pl->out != NULL){
+  			fclose(pl->out);
+  		}
+  		if(q->cache != NULL){
+  			struct cache_stats s;
+  			cache_get_stats(q->cache, &s);
+  			cache_stats.hits += s.hits;
+  			cache_stats.misses += s.misses;
+  			cache_stats.evictions += s.evictions;
+  			cache_stats.entries += s.entries;
+  			cache_stats.bytes += s.bytes;
+  			cache_stats.warm_hits += s.warm_hits;
+
+  			/* The snapshot is only kept with a single pipeline */
+  			if(cache_path != NULL && cache_save(q->cache, cache_path) != 0){
+  				perror("Error saving the cache snapshot");
+  			}
+  			cache_destroy(q->cache);
+  		}
+  		coalesced += flight_coalesced(q->flight);
+  		flight_destroy(q->flight);
+  		num_names += atomic_load(&q->num_produced);
+  		num_refreshed += atomic_load(&q->num_refreshed);
+  		peak += pl->pool.peak;
+  		ended += atomic_load(&q->resolver_target);
+  		free(pl->pool.tids);
+  		free(pl->producers);
+  		pthread_mutex_destroy(&q->pool_lock);
+  		pthread_cond_destroy(&q->pool_cond);
+  		work_destroy(&pl->work);
+  		ring_destroy(&pl->ring);
+  		arena_destroy(q->arena);
+  		q->backend->shutdown(q->backend_state);
+  	}
+  	free(pipes);
+  	if(procs != NULL){
+  		printf("RESOLVER PROCESSES: %d workers looked up %lu names\n", num_procs, (unsigned long)procs_lookups(procs));
+  		procs_destroy(procs);
+  	}
+
+  	/* Report how well the cache did */
+  	if(cache_mb > 0){
+  		printf("CACHE: %lu hits, %lu misses, %lu evictions, %lu entries (%lu bytes)\n",
+  			(unsigned long)cache_stats.hits, (unsigned long)cache_stats.misses, (unsigned long)cache_stats.evictions,
+  			(unsigned long)cache_stats.entries, (unsigned long)cache_stats.bytes);
+  		if(cache_path != NULL){
+  			printf("CACHE SNAPSHOT: %lu hits from the snapshot, %ld expired names refreshed\n",
+  				(unsigned long)cache_stats.warm_hits, num_refreshed);
+  		}
+  	}
+  	if(dedup != NULL){
+  		dedup_get_stats(dedup, &dedup_stats);
+  		printf("DEDUP: %lu lines, %lu distinct names, %d partitions (%d split)\n", (unsigned long)dedup_stats.lines,
+  			(unsigned long)dedup_stats.names, dedup_stats.partitions, dedup_stats.splits);
+  		dedup_destroy(dedup);
+  	}
+  	if(pinned){
+  		printf("PIPELINES: %d, pinned over %d CPUs\n", num_pipelines, num_cpus);
+  	}
+  	if(adaptive){
+  		printf("RESOLVER POOL: %d to %d threads, peaked at %d, ended at %d\n",
+  			pool.min * num_pipelines, pool.max * num_pipelines, peak, ended);
+  	}
+  	printf("WRITER: %lu bytes in %lu writes\n", (unsigned long)bytes_written, (unsigned long)writes);
+  	if(zone_path != NULL){
+  		zone_close(&zone);
+  	}
+  	printf("SINGLE-FLIGHT: %lu lookups waited on another resolver\n", (unsigned long)coalesced);
+
+  	/* Throughput and the latency of a name from publish to answer; every thread is done, so the totals are final */
+  	if((totals = malloc(sizeof(*totals))) == NULL){
+  		printf("Could not allocate the statistics\n");
+  		exit(1);
+  	}
+  	stats_snapshot(stats, totals);
+  	struct hist *latency = &totals->hists[STAT_NAME];
+  	if(zone_path != NULL){
+  		printf("ZONE: %lu names answered from %s\n", (unsigned long)totals->counters[STAT_ZONE_HITS], zone_path);
+  	}
+  	printf("THROUGHPUT: %ld names in %.6f seconds, %.0f names/sec\n", num_names, seconds, seconds > 0 ? num_names / seconds : 0);
+  	printf("LATENCY: p50 %.1f us, p99 %.1f us, max %.1f us\n", hist_quantile(latency, 0.5) / 1e3,
+  		hist_quantile(latency, 0.99) / 1e3, latency->count ? latency->max / 1e3 : 0);
+  	printf("THE RUNNING TIME OF THIS PROGRAM IS %.6f SECONDS\n", seconds);
+
+  	if(report != NULL){
+  		report->names = num_names;
+  		report->seconds = seconds;
+  		report->p50_ns = hist_quantile(latency, 0.5);
+  		report->p99_ns = hist_quantile(latency, 0.99);
+  	}
 
-  	gettimeofday(&end, NULL);
-  	long seconds = end.tv_sec - start.tv_sec;
-  	printf("THE RUNNING TIME OF THIS PROGRAM IS %ld SECONDS\n", seconds);
+  	/* Per-stage histograms and counters as JSON */
+  	if(stats_path != NULL){
+  		stats_dump(stats, 1);
+  	}
+  	free(totals);
+  	stats_destroy(stats);
 
 	return 0;
-}
\ No newline at end of file
+}
+
+/* The benchmark driver brings its own main() */
+#ifndef LOOKUP_NO_MAIN
+int main(int argc, char **argv){
+	return run_lookup(argc, argv, NULL);
+}
+#endif
\ No newline at end of file
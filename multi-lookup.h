@@ -0,0 +1,33 @@
+/*
+ * File: multi-lookup.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the declaration of run_lookup(), the whole
+ *      program behind main(). The benchmark driver calls it in-process
+ *      once per configuration and reads the numbers back from a
+ *      struct lookup_report.
+ *
+ */
+
+#ifndef MULTI_LOOKUP_H
+#define MULTI_LOOKUP_H
+
+#include <stdint.h>
+
+/* What one run did
+- names: Num of names read from the data files
+- seconds: Time from start to the last line written, on the monotonic clock
+- p50_ns/p99_ns: Median and 99th percentile time from a name's publish to its answer */
+struct lookup_report{
+	long names;
+	double seconds;
+	uint64_t p50_ns;
+	uint64_t p99_ns;
+};
+
+/* Run the program with the given command line, as main() would.
+ * If report is not NULL, fill it in. Returns the exit status
+ */
+int run_lookup(int argc, char **argv, struct lookup_report *report);
+
+#endif
@@ -12,16 +12,54 @@ from timeit import timeit
 
 T_CONVERSION=100
 
-# Fetches data from preformatted files
-def get_data(fname):
+# Fetches data from preformatted files, or from the CSV that ./bench or
+# ./qbench writes; for the CSV, column picks the value to plot at the first
+# queue, queue depth and batch size in the file
+def get_data(fname, column="names_per_sec"):
     times = []
     res = []
     req = []
 
     # Open the file
     f = open(fname)
+    lines = f.readlines()
+    if lines and lines[0].startswith("requesters,"):
+        header = lines[0].strip().split(",")
+        if column not in header:
+            print("Error: No Column %s" % column)
+            exit()
+        col = header.index(column)
+        rows = [line.strip().split(",") for line in lines[1:] if line.strip()]
+        if not rows:
+            print("Error: No Data")
+            exit()
+        depth, batch = rows[0][2], rows[0][3]
+        for d in rows:
+            if d[2] == depth and d[3] == batch:
+                req.append(int(d[0]))
+                res.append(int(d[1]))
+                times.append(float(d[col]))
+        return res, req, times
+    if lines and lines[0].startswith("queue,"):
+        header = lines[0].strip().split(",")
+        if column not in header:
+            print("Error: No Column %s" % column)
+            exit()
+        col = header.index(column)
+        rows = [line.strip().split(",") for line in lines[1:] if line.strip()]
+        if not rows:
+            print("Error: No Data")
+            exit()
+        queue, depth, batch = rows[0][0], rows[0][3], rows[0][4]
+        for d in rows:
+            if d[0] == queue and d[3] == depth and d[4] == batch:
+                req.append(int(d[1]))
+                res.append(int(d[2]))
+                times.append(float(d[col]))
+        return res, req, times
+
     # For each line
-    for line in f.readlines():
+    for line in lines:
         # Split the comment-separated data into an array
         d = line.split(",")
         if len(d) != 3:
@@ -65,7 +103,7 @@ def generate_data(exe):
     return req_list, res_list, time_list
 
 # Takes the data input and plots it to a 3D graph
-def plot(data):
+def plot(data, label="Time"):
     # Split the data into its components
     res, req, times = data
 
@@ -83,11 +121,11 @@ def plot(data):
     # Plot output
     f = plt.figure()
     ax2 = plt.axes(projection='3d')
-    ax2.set_title('Time vs. Thread Count')
+    ax2.set_title('%s vs. Thread Count' % label)
     surf2 = ax2.plot_surface(req2d, res2d, Z, cmap=plt.cm.coolwarm, linewidth=0)
     ax2.set_xlabel("# Requester Threads")
     ax2.set_ylabel('# Resolver Threads')
-    ax2.set_zlabel('Time')
+    ax2.set_zlabel(label)
     f.colorbar(surf2, shrink=0.5, aspect=5)
     plt.savefig("performance.png")
     plt.show()
@@ -111,11 +149,15 @@ if __name__ == "__main__":
     if len(sys.argv) < 2:
         print("Error: Missing Arguments")
         exit()
-    elif len(sys.argv) > 2:
+    elif len(sys.argv) > 3 or (len(sys.argv) == 3 and not sys.argv[1].endswith(".csv")):
         print("Error: Extra Arguments")
         exit()
 
-    # Input arguments
+    # Input arguments: an executable to time, or a CSV from ./bench and the column to plot
+    if sys.argv[1].endswith(".csv"):
+        data = get_data(*sys.argv[1:])
+        plot(data, sys.argv[2] if len(sys.argv) == 3 else "names_per_sec")
+        exit()
     exe = sys.argv[1]
 
     # Uncomment the following line to test with mock data
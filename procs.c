@@ -0,0 +1,463 @@
+/*
+ * File: procs.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the process-pool backend. Both rings are the
+ *      bounded ring of queue.c, with slots that hold the name or the
+ *      answer itself instead of a pointer, since a pointer means nothing
+ *      in another process. A name's cookie is the address of its
+ *      target on the stack of the resolver that asked; the workers hand
+ *      it back untouched, and the resolver that takes the answer off
+ *      the ring writes through it. A resolver only returns once all its
+ *      names are answered, so no answer is ever written to a stale
+ *      target, and while it waits it drains the answer ring for
+ *      everyone, so a worker never waits on a full answer ring for
+ *      long.
+ *
+ *      A worker takes one name at a time, so a slow name holds up only
+ *      its own worker, and keeps the cookie of that name in its busy
+ *      slot. Resolvers that have waited a while reap the workers that
+ *      died and fail the names in their busy slots; once no worker is
+ *      left, every name on the ring fails too. A worker killed in the
+ *      few instructions between claiming a ring slot and handing it
+ *      back still stalls that ring.
+ *
+ *      procs_destroy() counts on the same: it stops the workers, which
+ *      answer what is on the ring and exit, reaps them, and waits for
+ *      the last resolver to leave before it unmaps the rings.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "queue.h"
+#include "procs.h"
+
+_Static_assert((PROCS_RING_SIZE & (PROCS_RING_SIZE - 1)) == 0, "PROCS_RING_SIZE must be a power of two");
+
+/* A slot of the name ring
+- seq: Whose turn it is, as in queue.c
+- cookie: Where the answer goes, in the asking process
+- name: The name, NUL-terminated */
+struct procs_request{
+	atomic_size_t seq;
+	uint64_t cookie;
+	char name[PROCS_MAX_NAME];
+};
+
+/* A slot of the answer ring
+- seq: Whose turn it is
+- cookie: The cookie of the name
+- status/addrs: The answer
+- ns: Time the worker took to look it up */
+struct procs_answer{
+	atomic_size_t seq;
+	uint64_t cookie;
+	int status;
+	unsigned long long ns;
+	struct addr_list addrs;
+};
+
+/* Ends of a ring
+- head: Next position a producer will claim
+- tail: Next position a consumer will claim */
+struct procs_ring{
+	_Alignas(CACHE_LINE) atomic_size_t head;
+	_Alignas(CACHE_LINE) atomic_size_t tail;
+};
+
+/* The shared memory
+- requests/answers: The rings
+- closing: Set by procs_destroy()
+- ready/failed: Workers that have set up the backend, and those that could not
+- lookups: Names the workers resolved
+- busy: Cookie of the name each worker is resolving, 0 if none
+- request_slots/answer_slots: The slots of the rings */
+struct procs_shared{
+	struct procs_ring requests;
+	struct procs_ring answers;
+	_Alignas(CACHE_LINE) atomic_int closing;
+	atomic_int ready;
+	atomic_int failed;
+	atomic_ullong lookups;
+	atomic_uint_least64_t busy[PROCS_MAX_WORKERS];
+	struct procs_request request_slots[PROCS_RING_SIZE];
+	struct procs_answer answer_slots[PROCS_RING_SIZE];
+};
+
+/* The pool, in the program's own memory
+- shared: The shared memory
+- pids: The workers; 0 for one already waited for
+- num_workers: Num of workers forked
+- alive: Workers not yet found dead
+- callers: Resolvers inside resolve_batch()
+- reap_lock: Held by the resolver reaping dead workers
+- next_reap: When the workers are next looked at, in ns */
+struct procs{
+	struct procs_shared *shared;
+	pid_t *pids;
+	int num_workers;
+	atomic_int alive;
+	atomic_int callers;
+	pthread_mutex_t reap_lock;
+	atomic_ullong next_reap;
+};
+
+/* Where the answer of a name goes. Another resolver may take it, ordered after the asker's writes by the
+  request's seq and then the answer's, through a worker process; ThreadSanitizer cannot follow that and reports
+  a race
+- addrs/status/ns: The resolver's answer for it
+- remaining: Names of the resolver's batch without an answer */
+struct procs_target{
+	struct addr_list *addrs;
+	int *status;
+	unsigned long long *ns;
+	atomic_int *remaining;
+};
+
+/* Claim the next slot to fill (put) or to read (!put) of r, whose slots are size bytes apart and start with
+ * their seq. Returns the slot, with its position in *pos, or NULL if the ring is full (or empty). The slot is
+ * handed back by storing pos + 1 (filled) or pos + PROCS_RING_SIZE (read) in its seq */
+static void *claim(struct procs_ring *r, void *slots, size_t size, int put, size_t *pos){
+	atomic_size_t *end = put ? &r->head : &r->tail;
+	size_t p = atomic_load_explicit(end, memory_order_relaxed);
+
+	while(1){
+		char *slot = (char *)slots + (p & (PROCS_RING_SIZE - 1)) * size;
+		size_t seq = atomic_load_explicit((atomic_size_t *)slot, memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)(p + !put);
+		if(diff == 0){
+			if(atomic_compare_exchange_weak_explicit(end, &p, p + 1, memory_order_relaxed, memory_order_relaxed)){
+				*pos = p;
+				return slot;
+			}
+		}
+		else if(diff < 0){
+			return NULL;
+		}
+		else{
+			p = atomic_load_explicit(end, memory_order_relaxed);
+		}
+	}
+}
+
+static unsigned long long now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Write an answer to the target of cookie; the resolver may return as soon as its last one is written */
+static void deliver(uint64_t cookie, int status, unsigned long long ns, const struct addr_list *addrs){
+	struct procs_target *t = (struct procs_target *)(uintptr_t)cookie;
+	atomic_int *remaining = t->remaining;
+	*t->addrs = *addrs;
+	*t->status = status;
+	*t->ns = ns;
+	atomic_fetch_sub_explicit(remaining, 1, memory_order_release);
+}
+
+/* Hand every answer on the ring to its resolver. Returns the num of answers taken */
+static int take_answers(struct procs_shared *sh){
+	struct procs_answer *a;
+	size_t pos;
+	int got = 0;
+
+	while((a = claim(&sh->answers, sh->answer_slots, sizeof(*a), 0, &pos)) != NULL){
+		deliver(a->cookie, a->status, a->ns, &a->addrs);
+		atomic_store_explicit(&a->seq, pos + PROCS_RING_SIZE, memory_order_release);
+		got++;
+	}
+	return got;
+}
+
+/* Reap the workers that died, or left after procs_destroy(), at most every PROCS_REAP_MS, and fail the names
+  they were resolving; once none is left, fail every name on the ring as well. Returns the num of names failed */
+static int reap(struct procs *pp){
+	struct procs_shared *sh = pp->shared;
+	struct addr_list none = {0};
+	unsigned long long now = now_ns();
+	int failed = 0, wstatus;
+
+	if(now < atomic_load_explicit(&pp->next_reap, memory_order_relaxed) || pthread_mutex_trylock(&pp->reap_lock) != 0){
+		return 0;
+	}
+	atomic_store_explicit(&pp->next_reap, now + PROCS_REAP_MS * 1000000ULL, memory_order_relaxed);
+	for(int i = 0; i < pp->num_workers; i++){
+		if(pp->pids[i] == 0 || waitpid(pp->pids[i], &wstatus, WNOHANG) != pp->pids[i]){
+			continue;
+		}
+		if(!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0){
+			fprintf(stderr, "Resolver process %d died\n", (int)pp->pids[i]);
+		}
+		pp->pids[i] = 0;
+		atomic_fetch_sub(&pp->alive, 1);
+
+		/* A worker clears its busy slot before it puts the answer, so an answer is never delivered twice */
+		uint64_t cookie = atomic_exchange(&sh->busy[i], 0);
+		if(cookie != 0){
+			deliver(cookie, UTIL_FAILURE, 0, &none);
+			failed++;
+		}
+	}
+	if(atomic_load(&pp->alive) == 0){
+		struct procs_request *req;
+		size_t pos;
+		while((req = claim(&sh->requests, sh->request_slots, sizeof(*req), 0, &pos)) != NULL){
+			uint64_t cookie = req->cookie;
+			atomic_store_explicit(&req->seq, pos + PROCS_RING_SIZE, memory_order_release);
+			deliver(cookie, UTIL_FAILURE, 0, &none);
+			failed++;
+		}
+	}
+	pthread_mutex_unlock(&pp->reap_lock);
+	return failed;
+}
+
+/* A worker: resolve names off the ring until the pool is stopped and the ring is empty */
+static void work(struct procs_shared *sh, int idx, const struct resolver_backend *backend, void *state){
+	struct procs_request *req;
+	struct procs_answer *a;
+	char name[PROCS_MAX_NAME];
+	uint64_t cookie;
+	struct addr_list addrs;
+	unsigned spins = 0;
+	size_t pos;
+
+	while(1){
+		if((req = claim(&sh->requests, sh->request_slots, sizeof(*req), 0, &pos)) == NULL){
+			if(atomic_load(&sh->closing)){
+				return;
+			}
+			ring_backoff(&spins);
+			continue;
+		}
+		spins = 0;
+		cookie = req->cookie;
+		memcpy(name, req->name, sizeof(name));
+		atomic_store(&sh->busy[idx], cookie);
+		atomic_store_explicit(&req->seq, pos + PROCS_RING_SIZE, memory_order_release);
+
+		unsigned long long start = now_ns();
+		int status = backend->resolve(state, name, &addrs);
+		if(status != UTIL_SUCCESS){
+			addrs.num = 0;
+		}
+		unsigned long long ns = now_ns() - start;
+		while((a = claim(&sh->answers, sh->answer_slots, sizeof(*a), 1, &pos)) == NULL){
+			ring_backoff(&spins);
+		}
+		spins = 0;
+		a->cookie = cookie;
+		a->status = status;
+		a->ns = ns;
+		a->addrs = addrs;
+		atomic_store(&sh->busy[idx], 0);
+		atomic_store_explicit(&a->seq, pos + 1, memory_order_release);
+		atomic_fetch_add_explicit(&sh->lookups, 1, memory_order_relaxed);
+	}
+}
+
+/* A worker process, right after fork(); never returns */
+static void worker_main(struct procs_shared *sh, int idx, pid_t parent, const struct resolver_backend *backend,
+	const char *options){
+	void *state;
+
+	/* Die with the program, even if it is killed; if it is gone already, so is the pool. Ctrl-C is the program's
+	  to handle (the daemon drains its clients first), so it must not take the workers away from under it */
+	if(prctl(PR_SET_PDEATHSIG, SIGKILL) != 0 || getppid() != parent){
+		_exit(1);
+	}
+	signal(SIGINT, SIG_IGN);
+	signal(SIGTERM, SIG_IGN);
+	if(backend->init(&state, options) != UTIL_SUCCESS){
+		atomic_fetch_add(&sh->failed, 1);
+		_exit(1);
+	}
+	atomic_fetch_add(&sh->ready, 1);
+	work(sh, idx, backend, state);
+	backend->shutdown(state);
+
+	/* Nothing of the program's (stdio buffers, atexit handlers) is this process's to flush */
+	_exit(0);
+}
+
+static void procs_resolve_batch(void *state, const char **hostnames, struct addr_list **addrs, int *status,
+	unsigned long long *ns, int n){
+	struct procs *pp = state;
+	struct procs_shared *sh = pp->shared;
+	struct procs_target targets[n];
+	atomic_int remaining;
+	unsigned spins = 0;
+	int sent = 0;
+
+	atomic_fetch_add(&pp->callers, 1);
+	atomic_init(&remaining, n);
+	for(int i = 0; i < n; i++){
+		targets[i].addrs = addrs[i];
+		targets[i].status = &status[i];
+		targets[i].ns = &ns[i];
+		targets[i].remaining = &remaining;
+	}
+
+	/* Send what fits and take whatever answers are there, anyone's, until all of this batch is answered */
+	while(atomic_load_explicit(&remaining, memory_order_acquire) > 0){
+		int progress = take_answers(sh);
+		while(sent < n){
+			struct procs_request *req;
+			size_t pos, len = strlen(hostnames[sent]);
+			if(len >= PROCS_MAX_NAME || atomic_load(&pp->alive) == 0){
+				addrs[sent]->num = 0;
+				ns[sent] = 0;
+				status[sent++] = UTIL_FAILURE;
+				atomic_fetch_sub_explicit(&remaining, 1, memory_order_relaxed);
+				continue;
+			}
+			if((req = claim(&sh->requests, sh->request_slots, sizeof(*req), 1, &pos)) == NULL){
+				break;
+			}
+			req->cookie = (uint64_t)(uintptr_t)&targets[sent];
+			memcpy(req->name, hostnames[sent], len + 1);
+			atomic_store_explicit(&req->seq, pos + 1, memory_order_release);
+			sent++;
+			progress++;
+		}
+		if(progress > 0){
+			spins = 0;
+		}
+		else if(reap(pp) == 0){
+			ring_backoff(&spins);
+		}
+	}
+	atomic_fetch_sub(&pp->callers, 1);
+}
+
+static int procs_resolve(void *state, const char *hostname, struct addr_list *addrs){
+	int status;
+	unsigned long long ns;
+	procs_resolve_batch(state, &hostname, &addrs, &status, &ns, 1);
+	return status;
+}
+
+static int procs_init(void **state, const char *options){
+	(void)state;
+	(void)options;
+	return UTIL_FAILURE;
+}
+
+static void procs_shutdown(void *state){
+	(void)state;
+}
+
+const struct resolver_backend procs_backend = {
+	"procs",
+	procs_init,
+	procs_resolve,
+	procs_resolve_batch,
+	procs_shutdown
+};
+
+struct procs *procs_create(const struct resolver_backend *backend, const char *options, int num_workers){
+	static atomic_uint next_pool;
+	struct procs *pp = calloc(1, sizeof(*pp));
+	struct procs_shared *sh;
+	char name[64];
+	unsigned spins = 0;
+	int fd;
+
+	if(pp == NULL || (pp->pids = calloc(num_workers, sizeof(*pp->pids))) == NULL){
+		free(pp);
+		return NULL;
+	}
+
+	/* The name is only needed until the mapping exists; the workers inherit the mapping, not the name */
+	snprintf(name, sizeof(name), "/multi-lookup.%d.%u", (int)getpid(), atomic_fetch_add(&next_pool, 1));
+	if((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0){
+		free(pp->pids);
+		free(pp);
+		return NULL;
+	}
+	shm_unlink(name);
+	sh = ftruncate(fd, sizeof(*sh)) == 0 ? mmap(NULL, sizeof(*sh), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if(sh == MAP_FAILED){
+		free(pp->pids);
+		free(pp);
+		return NULL;
+	}
+
+	/* The memory starts zeroed; a slot's seq starts at its index */
+	for(size_t i = 0; i < PROCS_RING_SIZE; i++){
+		atomic_init(&sh->request_slots[i].seq, i);
+		atomic_init(&sh->answer_slots[i].seq, i);
+	}
+	pp->shared = sh;
+	pthread_mutex_init(&pp->reap_lock, NULL);
+
+	pid_t self = getpid();
+	for(int i = 0; i < num_workers; i++){
+		pid_t pid = fork();
+		if(pid == 0){
+			worker_main(sh, i, self, backend, options);
+		}
+		if(pid < 0){
+			procs_destroy(pp);
+			return NULL;
+		}
+		pp->pids[pp->num_workers++] = pid;
+	}
+
+	/* Wait for every worker to set up the backend; one that exits first has failed */
+	while(atomic_load(&sh->ready) + atomic_load(&sh->failed) < num_workers){
+		for(int i = 0; i < num_workers; i++){
+			if(pp->pids[i] != 0 && waitpid(pp->pids[i], NULL, WNOHANG) == pp->pids[i]){
+				pp->pids[i] = 0;
+				atomic_fetch_add(&sh->failed, 1);
+			}
+		}
+		ring_backoff(&spins);
+	}
+	if(atomic_load(&sh->failed) > 0){
+		procs_destroy(pp);
+		return NULL;
+	}
+	atomic_init(&pp->alive, num_workers);
+	return pp;
+}
+
+uint64_t procs_lookups(struct procs *pp){
+	return atomic_load(&pp->shared->lookups);
+}
+
+void procs_destroy(struct procs *pp){
+	unsigned spins = 0;
+
+	/* Resolvers still waiting get the answers of names the workers took; once the last worker has left, reap()
+	  fails whatever is still on the ring */
+	atomic_store(&pp->shared->closing, 1);
+	while(atomic_load(&pp->callers) > 0){
+		reap(pp);
+		ring_backoff(&spins);
+	}
+	for(int i = 0; i < pp->num_workers; i++){
+		if(pp->pids[i] != 0){
+			waitpid(pp->pids[i], NULL, 0);
+		}
+	}
+	munmap(pp->shared, sizeof(*pp->shared));
+	pthread_mutex_destroy(&pp->reap_lock);
+	free(pp->pids);
+	free(pp);
+}
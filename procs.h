@@ -0,0 +1,65 @@
+/*
+ * File: procs.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains declarations of the process-pool backend. A
+ *      blocking backend serializes on getaddrinfo()'s locks once a
+ *      process has more than a handful of threads calling it, so this
+ *      backend does not call it at all: it forks worker processes, each
+ *      of which sets up the real backend for itself, and hands them the
+ *      names over a lock-free ring in shared memory (shm_open()). The
+ *      answers come back over a second ring. Any resolver thread that
+ *      takes an answer off the ring hands it to the thread that asked.
+ *
+ *      The workers are forked before the program starts any thread, so
+ *      each is a copy of a single-threaded process, and they serve
+ *      every pipeline. A worker dies with the program (PR_SET_PDEATHSIG)
+ *      and otherwise leaves once the pool is stopped and no name is
+ *      left on the ring. A worker that dies early (a crash, the OOM
+ *      killer) is not replaced; the name it was resolving fails.
+ *
+ */
+
+#ifndef PROCS_H
+#define PROCS_H
+
+#include <stdint.h>
+
+#include "util.h"
+
+/* Define macros:
+- PROCS_MAX_WORKERS: Worker processes limit
+- PROCS_RING_SIZE: Num of names, and of answers, each ring holds; a power of two
+- PROCS_MAX_NAME: Longest name a ring slot holds, with its NUL; a hostname is at most 253 bytes
+- PROCS_REAP_MS: How often waiting resolvers look for workers that died */
+#define PROCS_MAX_WORKERS 256
+#define PROCS_RING_SIZE 4096
+#define PROCS_MAX_NAME 256
+#define PROCS_REAP_MS 10
+
+struct procs;
+
+/* The process-pool backend; its state is a pool started with
+ * procs_create(), not init(). Its shutdown() leaves the pool alone,
+ * since every pipeline shares it
+ */
+extern const struct resolver_backend procs_backend;
+
+/* Fork num_workers worker processes, each setting up backend with
+ * options for itself, and wait until every one of them has. Call before
+ * starting any thread. Returns NULL if the shared memory could not be
+ * made or a worker could not be forked or set up
+ */
+struct procs *procs_create(const struct resolver_backend *backend, const char *options, int num_workers);
+
+/* Num of names the workers have resolved */
+uint64_t procs_lookups(struct procs *pp);
+
+/* Stop the workers once no name is left on the ring, wait for them to
+ * exit and for resolvers still inside the backend to get their answers
+ * (a failure for a name no worker was left to take), and free the pool.
+ * No resolver may call into it afterwards
+ */
+void procs_destroy(struct procs *pp);
+
+#endif
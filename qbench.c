@@ -0,0 +1,586 @@
+/*
+ * File: qbench.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the queue microbenchmark. It measures the
+ *      handoff between requesters and resolvers on its own: producers
+ *      publish name views as fast as they can, consumers take them and
+ *      do nothing with them, so all that is timed is the queue. Each
+ *      queue moves views in batches of <batch size>:
+ *
+ *      - mutex: A circular buffer behind one mutex, with condition
+ *        variables for full and empty; the program's original buffer
+ *      - futex: The same buffer behind a lock that spins before it
+ *        sleeps on a futex, and waits for room or views by spinning on
+ *        a sequence word before sleeping on it
+ *      - ring: The lock-free ring of queue.c, which the program uses,
+ *        with its yield-then-sleep backoff
+ *
+ *      For every combination of queue, producers, consumers, depth and
+ *      batch size it writes one CSV row to stdout:
+ *
+ *      queue,producers,consumers,depth,batch,ops_per_sec,p50_ns,p99_ns,p999_ns,wakeups_per_item
+ *
+ *      ops_per_sec is views moved per second from the start of the
+ *      threads to the last consumer taking its last view, the mean of
+ *      the repetitions. Latency is from a producer starting to publish
+ *      a view to a consumer having it, over every repetition. A wakeup
+ *      is a thread coming back after giving up the CPU to wait on the
+ *      queue: a condition variable or futex wait, or a ring backoff.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "queue.h"
+#include "hist.h"
+
+/* Define macros:
+- MAX_VALUES: Num of values a list option may hold
+- DEFAULT_ITEMS: Views moved per run unless -i is given
+- DEFAULT_WARMUPS: Unmeasured runs per combination unless -w is given
+- DEFAULT_REPS: Measured runs per combination unless -n is given
+- SPIN_TRIES: Times the futex queue checks again before it sleeps */
+#define MAX_VALUES 64
+#define DEFAULT_ITEMS 1000000
+#define DEFAULT_WARMUPS 1
+#define DEFAULT_REPS 3
+#define SPIN_TRIES 100
+
+enum queue_kind{
+	QUEUE_MUTEX,
+	QUEUE_FUTEX,
+	QUEUE_RING,
+	QUEUE_NUM_KINDS
+};
+
+static const char *queue_names[QUEUE_NUM_KINDS] = {"mutex", "futex", "ring"};
+
+/* A list option, e.g. "1-4,8,16" */
+struct values{
+	int num;
+	int v[MAX_VALUES];
+};
+
+/* The circular buffer of the mutex and futex queues
+- lock/not_full/not_empty: The mutex queue's lock and conditions
+- futex_lock: The futex queue's lock; 0 free, 1 taken, 2 taken with sleepers
+- room_seq/views_seq: Bumped whenever views are taken/published; the futex queue sleeps on them
+- room_waiters/views_waiters: Threads asleep on each
+- views/cap/head/count: The buffer; views are taken at head */
+struct lbuf{
+	pthread_mutex_t lock;
+	pthread_cond_t not_full;
+	pthread_cond_t not_empty;
+	_Alignas(CACHE_LINE) atomic_int futex_lock;
+	_Alignas(CACHE_LINE) atomic_int room_seq;
+	atomic_int room_waiters;
+	_Alignas(CACHE_LINE) atomic_int views_seq;
+	atomic_int views_waiters;
+	_Alignas(CACHE_LINE) struct name_view *views;
+	size_t cap;
+	size_t head;
+	size_t count;
+};
+
+/* One run
+- kind: The queue being measured
+- ring/buf: The queue
+- batch: Views per publish and take
+- start: Lines every thread up before the clock starts */
+struct run{
+	enum queue_kind kind;
+	struct ring ring;
+	struct lbuf buf;
+	int batch;
+	pthread_barrier_t start;
+};
+
+/* A producer or consumer
+- r: The run
+- items: Views a producer publishes
+- lat: Handoff latency of the views a consumer took
+- wakeups: Times it waited on the queue
+- done_ns: When a consumer took its stop view */
+struct worker{
+	struct run *r;
+	long items;
+	struct hist lat;
+	uint64_t wakeups;
+	unsigned long long done_ns;
+	pthread_t tid;
+};
+
+static unsigned long long now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* A view carries the ns it was published at in chunk and line; a view without a name tells a consumer to stop */
+static void set_stamp(struct name_view *v, unsigned long long ns){
+	v->chunk = (uint32_t)(ns >> 32);
+	v->line = (uint32_t)ns;
+}
+
+static unsigned long long get_stamp(const struct name_view *v){
+	return (unsigned long long)v->chunk << 32 | v->line;
+}
+
+static void cpu_relax(void){
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+static void futex_wait(atomic_int *addr, int val){
+	syscall(SYS_futex, (int *)addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_int *addr, int n){
+	syscall(SYS_futex, (int *)addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+/* Take the futex queue's lock: spin, then sleep marked as contended (Drepper's "Futexes Are Tricky", mutex 3) */
+static void futex_lock(atomic_int *m, uint64_t *wakeups){
+	int c = 0;
+	for(int i = 0; i < SPIN_TRIES; i++){
+		c = 0;
+		if(atomic_compare_exchange_strong(m, &c, 1)){
+			return;
+		}
+		cpu_relax();
+	}
+	if(c != 2){
+		c = atomic_exchange(m, 2);
+	}
+	while(c != 0){
+		futex_wait(m, 2);
+		(*wakeups)++;
+		c = atomic_exchange(m, 2);
+	}
+}
+
+static void futex_unlock(atomic_int *m){
+	if(atomic_fetch_sub(m, 1) != 1){
+		atomic_store(m, 0);
+		futex_wake(m, 1);
+	}
+}
+
+/* Wait for seq to move past what it was under the lock; the caller has dropped the lock */
+static void futex_await(atomic_int *seq, atomic_int *waiters, int old, uint64_t *wakeups){
+	for(int i = 0; i < SPIN_TRIES; i++){
+		if(atomic_load(seq) != old){
+			return;
+		}
+		cpu_relax();
+	}
+	atomic_fetch_add(waiters, 1);
+	futex_wait(seq, old);
+	atomic_fetch_sub(waiters, 1);
+	(*wakeups)++;
+}
+
+/* Bump seq and wake its sleepers; everyone, as a batch may be enough for several */
+static void futex_signal(atomic_int *seq, atomic_int *waiters){
+	atomic_fetch_add(seq, 1);
+	if(atomic_load(waiters) > 0){
+		futex_wake(seq, INT_MAX);
+	}
+}
+
+/* Copy up to n views into / out of the buffer; the caller holds its lock */
+static size_t buf_put(struct lbuf *b, const struct name_view *views, size_t n){
+	size_t i;
+	for(i = 0; i < n && b->count < b->cap; i++){
+		b->views[(b->head + b->count++) % b->cap] = views[i];
+	}
+	return i;
+}
+
+static size_t buf_take(struct lbuf *b, struct name_view *views, size_t n){
+	size_t i;
+	for(i = 0; i < n && b->count > 0; i++){
+		views[i] = b->views[b->head];
+		b->head = (b->head + 1) % b->cap;
+		b->count--;
+	}
+	return i;
+}
+
+/* Publish all n views, waiting for room as the queue needs to */
+static void put(struct worker *w, const struct name_view *views, size_t n){
+	struct run *r = w->r;
+	struct lbuf *b = &r->buf;
+	unsigned spins = 0;
+	size_t done = 0, moved;
+
+	while(done < n){
+		switch(r->kind){
+			case QUEUE_MUTEX:
+				pthread_mutex_lock(&b->lock);
+				while(b->count == b->cap){
+					pthread_cond_wait(&b->not_full, &b->lock);
+					w->wakeups++;
+				}
+				done += buf_put(b, views + done, n - done);
+				pthread_cond_broadcast(&b->not_empty);
+				pthread_mutex_unlock(&b->lock);
+				break;
+			case QUEUE_FUTEX:
+				futex_lock(&b->futex_lock, &w->wakeups);
+				if(b->count == b->cap){
+					int old = atomic_load(&b->room_seq);
+					futex_unlock(&b->futex_lock);
+					futex_await(&b->room_seq, &b->room_waiters, old, &w->wakeups);
+					break;
+				}
+				done += buf_put(b, views + done, n - done);
+				futex_unlock(&b->futex_lock);
+				futex_signal(&b->views_seq, &b->views_waiters);
+				break;
+			default:
+				moved = n - done == 1 ? ring_try_enqueue(&r->ring, views + done) == 0
+					: ring_try_enqueue_batch(&r->ring, views + done, n - done);
+				if(moved == 0){
+					ring_backoff(&spins);
+					w->wakeups++;
+				}
+				done += moved;
+		}
+	}
+}
+
+/* Take between 1 and n views, waiting for them as the queue needs to */
+static size_t take(struct worker *w, struct name_view *views, size_t n){
+	struct run *r = w->r;
+	struct lbuf *b = &r->buf;
+	unsigned spins = 0;
+	size_t got = 0;
+
+	while(got == 0){
+		switch(r->kind){
+			case QUEUE_MUTEX:
+				pthread_mutex_lock(&b->lock);
+				while(b->count == 0){
+					pthread_cond_wait(&b->not_empty, &b->lock);
+					w->wakeups++;
+				}
+				got = buf_take(b, views, n);
+				pthread_cond_broadcast(&b->not_full);
+				pthread_mutex_unlock(&b->lock);
+				break;
+			case QUEUE_FUTEX:
+				futex_lock(&b->futex_lock, &w->wakeups);
+				if(b->count == 0){
+					int old = atomic_load(&b->views_seq);
+					futex_unlock(&b->futex_lock);
+					futex_await(&b->views_seq, &b->views_waiters, old, &w->wakeups);
+					break;
+				}
+				got = buf_take(b, views, n);
+				futex_unlock(&b->futex_lock);
+				futex_signal(&b->room_seq, &b->room_waiters);
+				break;
+			default:
+				got = n == 1 ? ring_try_dequeue(&r->ring, views) == 0 : ring_try_dequeue_batch(&r->ring, views, n);
+				if(got == 0){
+					ring_backoff(&spins);
+					w->wakeups++;
+				}
+		}
+	}
+	return got;
+}
+
+static void *producer_main(void *arg){
+	struct worker *w = arg;
+	int batch = w->r->batch;
+	struct name_view *views = calloc(batch, sizeof(*views));
+	static const char name[] = "bench.example.com";
+
+	for(int i = 0; i < batch; i++){
+		views[i].name = name;
+		views[i].len = sizeof(name) - 1;
+	}
+	pthread_barrier_wait(&w->r->start);
+	for(long left = w->items; left > 0; ){
+		int n = left < batch ? (int)left : batch;
+		unsigned long long now = now_ns();
+		for(int i = 0; i < n; i++){
+			set_stamp(&views[i], now);
+		}
+		put(w, views, n);
+		left -= n;
+	}
+	free(views);
+	return NULL;
+}
+
+static void *consumer_main(void *arg){
+	struct worker *w = arg;
+	int batch = w->r->batch;
+	struct name_view *views = calloc(batch, sizeof(*views));
+	int stop = 0;
+
+	pthread_barrier_wait(&w->r->start);
+	while(!stop){
+		size_t got = take(w, views, batch), extra = 0;
+		unsigned long long now = now_ns();
+		for(size_t i = 0; i < got; i++){
+			if(views[i].name == NULL){
+				/* One stop view per consumer; one taken with this one belongs to another consumer */
+				extra += stop;
+				stop = 1;
+				continue;
+			}
+			hist_record(&w->lat, now - get_stamp(&views[i]));
+		}
+		if(extra > 0){
+			memset(views, 0, sizeof(*views) * extra);
+			put(w, views, extra);
+		}
+	}
+	w->done_ns = now_ns();
+	free(views);
+	return NULL;
+}
+
+/* Move items views through the queue once; adds the latencies and wakeups to lat and wakeups, returns ops/sec */
+static double run_once(enum queue_kind kind, int producers, int consumers, int depth, int batch, long items,
+	struct hist *lat, uint64_t *wakeups){
+	struct run r;
+	struct worker *w = calloc(producers + consumers, sizeof(*w));
+	struct worker *stopper = calloc(1, sizeof(*stopper));
+	struct name_view *stops = calloc(consumers, sizeof(*stops));
+
+	if(w == NULL || stopper == NULL || stops == NULL){
+		printf("Could not allocate the workers\n");
+		exit(1);
+	}
+	memset(&r, 0, sizeof(r));
+	r.kind = kind;
+	r.batch = batch;
+	if(kind == QUEUE_RING){
+		if(ring_init(&r.ring, depth) != 0){
+			printf("Could not allocate the ring\n");
+			exit(1);
+		}
+	}
+	else{
+		pthread_mutex_init(&r.buf.lock, NULL);
+		pthread_cond_init(&r.buf.not_full, NULL);
+		pthread_cond_init(&r.buf.not_empty, NULL);
+		r.buf.cap = depth;
+		if((r.buf.views = malloc(sizeof(*r.buf.views) * depth)) == NULL){
+			printf("Could not allocate the buffer\n");
+			exit(1);
+		}
+	}
+	pthread_barrier_init(&r.start, NULL, producers + consumers + 1);
+
+	for(int i = 0; i < producers + consumers; i++){
+		w[i].r = &r;
+		w[i].items = i < producers ? items / producers + (i < items % producers) : 0;
+		hist_init(&w[i].lat);
+		pthread_create(&w[i].tid, NULL, i < producers ? producer_main : consumer_main, &w[i]);
+	}
+	pthread_barrier_wait(&r.start);
+	unsigned long long start = now_ns(), end = start;
+
+	/* Once every view is out, one stop view per consumer */
+	for(int i = 0; i < producers; i++){
+		pthread_join(w[i].tid, NULL);
+	}
+	stopper->r = &r;
+	put(stopper, stops, consumers);
+	for(int i = producers; i < producers + consumers; i++){
+		pthread_join(w[i].tid, NULL);
+		end = w[i].done_ns > end ? w[i].done_ns : end;
+	}
+
+	for(int i = 0; i < producers + consumers; i++){
+		hist_merge(lat, &w[i].lat);
+		*wakeups += w[i].wakeups;
+	}
+	pthread_barrier_destroy(&r.start);
+	if(kind == QUEUE_RING){
+		ring_destroy(&r.ring);
+	}
+	else{
+		pthread_mutex_destroy(&r.buf.lock);
+		pthread_cond_destroy(&r.buf.not_full);
+		pthread_cond_destroy(&r.buf.not_empty);
+		free(r.buf.views);
+	}
+	free(w);
+	free(stopper);
+	free(stops);
+	return end > start ? items / ((end - start) / 1e9) : 0;
+}
+
+static void usage(char *str){
+	printf("Usage: %s [-q <queues>] [-p <producers>] [-c <consumers>] [-d <queue depths>] [-b <batch sizes>] [-i <items>]"
+		" [-w <warmups>] [-n <reps>]\n", str);
+	printf("Queues are a comma-separated list of mutex, futex and ring; the other lists are values and ranges, e.g. 1-4,8,16\n");
+	exit(1);
+}
+
+/* Parse a list option into v; exit on anything but positive integers and ranges */
+static void get_values(char *str, struct values *v, char *what){
+	char *p = str;
+	v->num = 0;
+	while(*p){
+		char *end;
+		long lo = strtol(p, &end, 10), hi = lo;
+		if(end == p || lo <= 0){
+			break;
+		}
+		if(*end == '-'){
+			p = end + 1;
+			hi = strtol(p, &end, 10);
+			if(end == p || hi < lo){
+				break;
+			}
+		}
+		for(long i = lo; i <= hi && v->num < MAX_VALUES; i++){
+			v->v[v->num++] = (int)i;
+		}
+		if(*end == ','){
+			end++;
+		}
+		else if(*end != 0){
+			break;
+		}
+		p = end;
+	}
+	if(*p != 0 || v->num == 0){
+		printf("<%s> must be a list of positive integers and ranges, e.g. 1-4,8\n", what);
+		exit(1);
+	}
+}
+
+/* Parse the list of queues into v, as queue_kind values */
+static void get_queues(char *str, struct values *v){
+	v->num = 0;
+	for(char *save, *tok = strtok_r(str, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)){
+		int k;
+		for(k = 0; k < QUEUE_NUM_KINDS && strcmp(tok, queue_names[k]) != 0; k++){
+		}
+		if(k == QUEUE_NUM_KINDS || v->num == MAX_VALUES){
+			printf("<queues> must be a list of mutex, futex and ring\n");
+			exit(1);
+		}
+		v->v[v->num++] = k;
+	}
+	if(v->num == 0){
+		printf("<queues> must be a list of mutex, futex and ring\n");
+		exit(1);
+	}
+}
+
+static long get_count(char *str, char *what){
+	for(char *p = str; *p; p++){
+		if(!isdigit((unsigned char)*p)){
+			printf("<%s> must be an integer\n", what);
+			exit(1);
+		}
+	}
+	return atol(str);
+}
+
+int main(int argc, char **argv){
+	struct values queues = {3, {QUEUE_MUTEX, QUEUE_FUTEX, QUEUE_RING}};
+	struct values producers = {3, {1, 2, 4}};
+	struct values consumers = {3, {1, 2, 4}};
+	struct values depths = {2, {1024, 16384}};
+	struct values batches = {2, {1, 16}};
+	long items = DEFAULT_ITEMS;
+	int warmups = DEFAULT_WARMUPS;
+	int reps = DEFAULT_REPS;
+	int opt;
+
+	while((opt = getopt(argc, argv, "q:p:c:d:b:i:w:n:")) != -1){
+		switch(opt){
+			case 'q':
+				get_queues(optarg, &queues);
+				break;
+			case 'p':
+				get_values(optarg, &producers, "producers");
+				break;
+			case 'c':
+				get_values(optarg, &consumers, "consumers");
+				break;
+			case 'd':
+				get_values(optarg, &depths, "queue depths");
+
+				/* The ring rounds its capacity up to a power of two; the others must hold as many */
+				for(int i = 0; i < depths.num; i++){
+					if(depths.v[i] & (depths.v[i] - 1)){
+						printf("<queue depths> must be powers of two, e.g. 1024,16384\n");
+						exit(1);
+					}
+				}
+				break;
+			case 'b':
+				get_values(optarg, &batches, "batch sizes");
+				break;
+			case 'i':
+				items = get_count(optarg, "items");
+				break;
+			case 'w':
+				warmups = get_count(optarg, "warmups");
+				break;
+			case 'n':
+				reps = get_count(optarg, "reps");
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if(optind != argc || reps == 0 || items == 0){
+		usage(argv[0]);
+	}
+
+	printf("queue,producers,consumers,depth,batch,ops_per_sec,p50_ns,p99_ns,p999_ns,wakeups_per_item\n");
+	for(int a = 0; a < queues.num; a++){
+		for(int b = 0; b < producers.num; b++){
+			for(int c = 0; c < consumers.num; c++){
+				for(int d = 0; d < depths.num; d++){
+					for(int e = 0; e < batches.num; e++){
+						struct hist lat, skip;
+						uint64_t wakeups = 0, skipped = 0;
+						double rate = 0;
+
+						hist_init(&lat);
+						hist_init(&skip);
+						for(int i = 0; i < warmups + reps; i++){
+							int measured = i >= warmups;
+							double r = run_once(queues.v[a], producers.v[b], consumers.v[c], depths.v[d], batches.v[e], items,
+								measured ? &lat : &skip, measured ? &wakeups : &skipped);
+							rate += measured ? r : 0;
+						}
+						printf("%s,%d,%d,%d,%d,%.0f,%lu,%lu,%lu,%.4f\n", queue_names[queues.v[a]], producers.v[b], consumers.v[c],
+							depths.v[d], batches.v[e], rate / reps, (unsigned long)hist_quantile(&lat, 0.5),
+							(unsigned long)hist_quantile(&lat, 0.99), (unsigned long)hist_quantile(&lat, 0.999),
+							(double)wakeups / ((double)items * reps));
+						fflush(stdout);
+					}
+				}
+			}
+		}
+	}
+	return 0;
+}
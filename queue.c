@@ -0,0 +1,248 @@
+/*
+ * File: queue.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the bounded lock-free multi-producer/
+ *      multi-consumer ring used between requesters and resolvers.
+ *      Slots hold small name views, not copies of the names.
+ *
+ *      Every slot carries a sequence number. A slot at position pos
+ *      is free for a producer when seq == pos, and holds a name for
+ *      a consumer when seq == pos + 1. Producers and consumers claim
+ *      positions with a CAS on head/tail, so no lock is ever taken.
+ *      The batch calls claim a run of ready slots with a single CAS.
+ *
+ */
+
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+
+#include "queue.h"
+
+/* Define macros:
+- SPIN_LIMIT: Num of sched_yield() backoffs before sleeping
+- SLEEP_MAX_NS: Longest sleep of a waiting thread */
+#define SPIN_LIMIT 64
+#define SLEEP_MAX_NS 1000000L
+
+int ring_init(struct ring *r, size_t capacity){
+	size_t size = 1;
+	while(size < capacity){
+		size <<= 1;
+	}
+
+	r->slots = aligned_alloc(CACHE_LINE, sizeof(struct ring_slot) * size);
+	if(r->slots == NULL){
+		return -1;
+	}
+	for(size_t i = 0; i < size; i++){
+		atomic_init(&r->slots[i].seq, i);
+	}
+	r->mask = size - 1;
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	return 0;
+}
+
+void ring_destroy(struct ring *r){
+	free(r->slots);
+	r->slots = NULL;
+}
+
+int ring_try_enqueue(struct ring *r, const struct name_view *view){
+	struct ring_slot *slot;
+	size_t pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+	while(1){
+		slot = &r->slots[pos & r->mask];
+		size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		long diff = (long)seq - (long)pos;
+
+		/* Slot is free; try to claim it */
+		if(diff == 0){
+			if(atomic_compare_exchange_weak_explicit(&r->head, &pos, pos + 1,
+				memory_order_relaxed, memory_order_relaxed)){
+				break;
+			}
+		}
+		/* Slot still holds a name from the previous lap; ring is full */
+		else if(diff < 0){
+			return -1;
+		}
+		/* Another producer got here first */
+		else{
+			pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+		}
+	}
+
+	slot->view = *view;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+	return 0;
+}
+
+int ring_try_dequeue(struct ring *r, struct name_view *view){
+	struct ring_slot *slot;
+	size_t pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+	while(1){
+		slot = &r->slots[pos & r->mask];
+		size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		long diff = (long)seq - (long)(pos + 1);
+
+		/* Slot holds a name; try to claim it */
+		if(diff == 0){
+			if(atomic_compare_exchange_weak_explicit(&r->tail, &pos, pos + 1,
+				memory_order_relaxed, memory_order_relaxed)){
+				break;
+			}
+		}
+		/* Slot has not been filled yet; ring is empty */
+		else if(diff < 0){
+			return -1;
+		}
+		/* Another consumer got here first */
+		else{
+			pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+		}
+	}
+
+	*view = slot->view;
+	atomic_store_explicit(&slot->seq, pos + r->mask + 1, memory_order_release);
+	return 0;
+}
+
+size_t ring_try_enqueue_batch(struct ring *r, const struct name_view *views, size_t n){
+	size_t count;
+	size_t pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+	while(1){
+		/* Count how many slots from pos on are free */
+		for(count = 0; count < n; count++){
+			struct ring_slot *slot = &r->slots[(pos + count) & r->mask];
+			if(atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + count){
+				break;
+			}
+		}
+
+		/* Claim all of them at once; only producers fill free slots, so they stay free */
+		if(count > 0){
+			if(atomic_compare_exchange_weak_explicit(&r->head, &pos, pos + count,
+				memory_order_relaxed, memory_order_relaxed)){
+				break;
+			}
+			continue;
+		}
+
+		/* No free slot: either the ring is full or another producer moved head */
+		size_t seq = atomic_load_explicit(&r->slots[pos & r->mask].seq, memory_order_acquire);
+		if((long)seq - (long)pos < 0){
+			return 0;
+		}
+		pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+	}
+
+	for(size_t i = 0; i < count; i++){
+		struct ring_slot *slot = &r->slots[(pos + i) & r->mask];
+		slot->view = views[i];
+		atomic_store_explicit(&slot->seq, pos + i + 1, memory_order_release);
+	}
+	return count;
+}
+
+size_t ring_try_dequeue_batch(struct ring *r, struct name_view *views, size_t n){
+	size_t count;
+	size_t pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+	while(1){
+		/* Count how many slots from pos on hold a name */
+		for(count = 0; count < n; count++){
+			struct ring_slot *slot = &r->slots[(pos + count) & r->mask];
+			if(atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + count + 1){
+				break;
+			}
+		}
+
+		/* Claim all of them at once; only consumers empty full slots, so they stay full */
+		if(count > 0){
+			if(atomic_compare_exchange_weak_explicit(&r->tail, &pos, pos + count,
+				memory_order_relaxed, memory_order_relaxed)){
+				break;
+			}
+			continue;
+		}
+
+		/* No full slot: either the ring is empty or another consumer moved tail */
+		size_t seq = atomic_load_explicit(&r->slots[pos & r->mask].seq, memory_order_acquire);
+		if((long)seq - (long)(pos + 1) < 0){
+			return 0;
+		}
+		pos = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	}
+
+	for(size_t i = 0; i < count; i++){
+		struct ring_slot *slot = &r->slots[(pos + i) & r->mask];
+		views[i] = slot->view;
+		atomic_store_explicit(&slot->seq, pos + i + r->mask + 1, memory_order_release);
+	}
+	return count;
+}
+
+size_t ring_count(struct ring *r){
+	/* Read tail first so a consumer racing ahead cannot make the count negative */
+	size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	return head > tail ? head - tail : 0;
+}
+
+void ring_backoff(unsigned *spins){
+	if(*spins < SPIN_LIMIT){
+		sched_yield();
+	}
+	else{
+		/* Sleep 1us, 2us, 4us, ... up to SLEEP_MAX_NS */
+		unsigned shift = *spins - SPIN_LIMIT;
+		long ns = shift < 10 ? 1000L << shift : SLEEP_MAX_NS;
+		struct timespec ts = {0, ns < SLEEP_MAX_NS ? ns : SLEEP_MAX_NS};
+		nanosleep(&ts, NULL);
+	}
+	(*spins)++;
+}
+
+void ring_enqueue(struct ring *r, const struct name_view *view){
+	unsigned spins = 0;
+	while(ring_try_enqueue(r, view) != 0){
+		ring_backoff(&spins);
+	}
+}
+
+void ring_dequeue(struct ring *r, struct name_view *view){
+	unsigned spins = 0;
+	while(ring_try_dequeue(r, view) != 0){
+		ring_backoff(&spins);
+	}
+}
+
+void ring_enqueue_batch(struct ring *r, const struct name_view *views, size_t n){
+	unsigned spins = 0;
+	size_t done = 0;
+	while(done < n){
+		size_t got = ring_try_enqueue_batch(r, views + done, n - done);
+		if(got == 0){
+			ring_backoff(&spins);
+		}
+		else{
+			done += got;
+			spins = 0;
+		}
+	}
+}
+
+size_t ring_dequeue_batch(struct ring *r, struct name_view *views, size_t n){
+	unsigned spins = 0;
+	size_t got;
+	while((got = ring_try_dequeue_batch(r, views, n)) == 0){
+		ring_backoff(&spins);
+	}
+	return got;
+}
@@ -0,0 +1,101 @@
+/*
+ * File: queue.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains declarations of the bounded lock-free
+ *      multi-producer/multi-consumer ring that hands domain names
+ *      from the requester threads to the resolver threads.
+ *
+ */
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* Define macros:
+- MAX_NAME_LENGTH: Domain name length limit
+- CACHE_LINE: Size of a cache line; head and tail each get their own */
+#define MAX_NAME_LENGTH 1025
+#define CACHE_LINE 64
+
+/* A view of a domain name; the ring carries views, never the names themselves
+- name: First byte of the name; not NUL-terminated (e.g. a line of an mmap'd file)
+- len: Length of the name; never more than MAX_NAME_LENGTH
+- owned: 1 if name was copied into the name arena and the consumer must release it
+- invalid: 1 if name is not a hostname; it is answered as failed without a lookup
+- stamp: When the view was published, in us of the monotonic clock (wraps every ~71 minutes)
+- chunk: Index of the input chunk the name came from
+- line: Line of the name within that chunk */
+struct name_view{
+	const char *name;
+	uint16_t len;
+	uint8_t owned;
+	uint8_t invalid;
+	uint32_t stamp;
+	uint32_t chunk;
+	uint32_t line;
+};
+
+/* A ring slot
+- seq: Sequence number; tells producers and consumers whose turn it is
+- view: The name view stored in this slot */
+struct ring_slot{
+	atomic_size_t seq;
+	struct name_view view;
+};
+
+/* The ring
+- head: Next position a producer will claim
+- tail: Next position a consumer will claim
+- mask: capacity - 1; capacity is always a power of two
+- slots: The slot array */
+struct ring{
+	_Alignas(CACHE_LINE) atomic_size_t head;
+	_Alignas(CACHE_LINE) atomic_size_t tail;
+	_Alignas(CACHE_LINE) size_t mask;
+	struct ring_slot *slots;
+};
+
+/* Allocate a ring holding at least capacity views.
+ * Returns 0 on success, -1 if out of memory
+ */
+int ring_init(struct ring *r, size_t capacity);
+
+/* Free the slots of a ring */
+void ring_destroy(struct ring *r);
+
+/* Non-blocking enqueue/dequeue.
+ * Return 0 on success, -1 if the ring is full/empty
+ */
+int ring_try_enqueue(struct ring *r, const struct name_view *view);
+int ring_try_dequeue(struct ring *r, struct name_view *view);
+
+/* Blocking enqueue/dequeue; back off while the ring is full/empty */
+void ring_enqueue(struct ring *r, const struct name_view *view);
+void ring_dequeue(struct ring *r, struct name_view *view);
+
+/* Non-blocking batch enqueue/dequeue of up to n views in one claim.
+ * Return the num of views moved; 0 if the ring is full/empty
+ */
+size_t ring_try_enqueue_batch(struct ring *r, const struct name_view *views, size_t n);
+size_t ring_try_dequeue_batch(struct ring *r, struct name_view *views, size_t n);
+
+/* Blocking batch enqueue/dequeue.
+ * ring_enqueue_batch() returns once all n views are in the ring;
+ * ring_dequeue_batch() returns as soon as it has between 1 and n views
+ */
+void ring_enqueue_batch(struct ring *r, const struct name_view *views, size_t n);
+size_t ring_dequeue_batch(struct ring *r, struct name_view *views, size_t n);
+
+/* Num of views in the ring. Only a snapshot: producers and consumers
+ * may move head and tail while it is read
+ */
+size_t ring_count(struct ring *r);
+
+/* Back off a waiting thread; spins counts how many times it has waited */
+void ring_backoff(unsigned *spins);
+
+#endif
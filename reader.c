@@ -0,0 +1,261 @@
+/*
+ * File: reader.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the memory-mapped input reader.
+ *
+ *      The scan classifies a block of SCAN_BLOCK bytes at a time into
+ *      bit masks (newlines, bytes no hostname holds, dots), lowering
+ *      the block in place when it holds an uppercase letter. Everything
+ *      after that works on the masks: the first newline bit ends the
+ *      line, and only the dots, a few per name, are looked at one by
+ *      one to check label lengths.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "queue.h"
+#include "reader.h"
+
+/* Define macros:
+- SCAN_BLOCK: Bytes classified at once; one bit of a mask each
+- MAX_LABEL: Longest label of a hostname
+- MAX_HOSTNAME: Longest hostname, besides a final dot
+- SCAN_SSE2/SCAN_AVX2: Set where the vector scans are compiled in */
+#define SCAN_BLOCK 32
+#define MAX_LABEL 63
+#define MAX_HOSTNAME 253
+#if defined(__SSE2__)
+#define SCAN_SSE2 1
+#if defined(__GNUC__)
+#define SCAN_AVX2 1
+#endif
+#endif
+
+/* Masks of a block, bit i for byte i
+- nl: Newlines
+- bad: Bytes that are neither a newline nor in a hostname
+- dots: Dots */
+struct block_masks{
+	uint32_t nl;
+	uint32_t bad;
+	uint32_t dots;
+};
+
+/* Classify the n (at most SCAN_BLOCK) bytes at p, lowering them in place */
+static void classify_scalar(char *p, size_t n, struct block_masks *m){
+	m->nl = m->bad = m->dots = 0;
+	for(size_t i = 0; i < n; i++){
+		unsigned c = (unsigned char)p[i];
+		if(c - 'A' < 26u){
+			p[i] = c | 0x20;
+		}
+		else if(c == '\n'){
+			m->nl |= 1u << i;
+		}
+		else if(c == '.'){
+			m->dots |= 1u << i;
+		}
+		else if(!(c - 'a' < 26u || c - '0' < 10u || c == '-' || c == '_')){
+			m->bad |= 1u << i;
+		}
+	}
+}
+
+#if SCAN_SSE2
+/* Bytes of v from lo to lo + span, as unsigned */
+static inline __m128i in_range_sse2(__m128i v, char lo, char span){
+	__m128i d = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+	return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(span)), d);
+}
+
+/* Classify 16 bytes at p into the low 16 bits of each mask */
+static inline void classify16_sse2(char *p, uint32_t *nl, uint32_t *bad, uint32_t *dots){
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	__m128i upper = in_range_sse2(v, 'A', 25);
+	__m128i lower = _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+	__m128i dot = _mm_cmpeq_epi8(lower, _mm_set1_epi8('.'));
+	__m128i newline = _mm_cmpeq_epi8(lower, _mm_set1_epi8('\n'));
+	__m128i ok = _mm_or_si128(_mm_or_si128(in_range_sse2(lower, 'a', 25), in_range_sse2(lower, '0', 9)),
+		_mm_or_si128(_mm_or_si128(dot, newline), _mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('-')),
+		_mm_cmpeq_epi8(lower, _mm_set1_epi8('_')))));
+	if(_mm_movemask_epi8(upper)){
+		_mm_storeu_si128((__m128i *)p, lower);
+	}
+	*nl = (uint32_t)_mm_movemask_epi8(newline);
+	*bad = (uint32_t)_mm_movemask_epi8(ok) ^ 0xffff;
+	*dots = (uint32_t)_mm_movemask_epi8(dot);
+}
+
+/* Classify SCAN_BLOCK bytes at p, lowering them in place */
+static void classify_sse2(char *p, struct block_masks *m){
+	uint32_t nl, bad, dots;
+	classify16_sse2(p, &m->nl, &m->bad, &m->dots);
+	classify16_sse2(p + 16, &nl, &bad, &dots);
+	m->nl |= nl << 16;
+	m->bad |= bad << 16;
+	m->dots |= dots << 16;
+}
+#endif
+
+#if SCAN_AVX2
+__attribute__((target("avx2")))
+static inline __m256i in_range_avx2(__m256i v, char lo, char span){
+	__m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+	return _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(span)), d);
+}
+
+/* classify_sse2() in one 32-byte vector */
+__attribute__((target("avx2")))
+static void classify_avx2(char *p, struct block_masks *m){
+	__m256i v = _mm256_loadu_si256((const __m256i *)p);
+	__m256i upper = in_range_avx2(v, 'A', 25);
+	__m256i lower = _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+	__m256i dot = _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('.'));
+	__m256i newline = _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('\n'));
+	__m256i ok = _mm256_or_si256(_mm256_or_si256(in_range_avx2(lower, 'a', 25), in_range_avx2(lower, '0', 9)),
+		_mm256_or_si256(_mm256_or_si256(dot, newline), _mm256_or_si256(_mm256_cmpeq_epi8(lower, _mm256_set1_epi8('-')),
+		_mm256_cmpeq_epi8(lower, _mm256_set1_epi8('_')))));
+	if(_mm256_movemask_epi8(upper)){
+		_mm256_storeu_si256((__m256i *)p, lower);
+	}
+	m->nl = (uint32_t)_mm256_movemask_epi8(newline);
+	m->bad = ~(uint32_t)_mm256_movemask_epi8(ok);
+	m->dots = (uint32_t)_mm256_movemask_epi8(dot);
+}
+#endif
+
+/* Classify the n bytes at p with the widest scan there is; a short tail is done byte by byte */
+static void classify(char *p, size_t n, struct block_masks *m){
+#if SCAN_AVX2
+	if(n == SCAN_BLOCK && __builtin_cpu_supports("avx2")){
+		classify_avx2(p, m);
+		return;
+	}
+#endif
+#if SCAN_SSE2
+	if(n == SCAN_BLOCK){
+		classify_sse2(p, m);
+		return;
+	}
+#endif
+	classify_scalar(p, n, m);
+}
+
+size_t reader_scan(char *s, size_t n, int *flags){
+	size_t off = 0, len = n;
+	size_t label_start = 0;
+	int f = 0;
+
+	while(off < n){
+		struct block_masks m;
+		size_t w = n - off < SCAN_BLOCK ? n - off : SCAN_BLOCK;
+		classify(s + off, w, &m);
+
+		/* Nothing past the newline belongs to this line */
+		if(m.nl){
+			uint32_t before = (1u << __builtin_ctz(m.nl)) - 1;
+			len = off + __builtin_ctz(m.nl);
+			m.bad &= before;
+			m.dots &= before;
+		}
+		if(m.bad){
+			f |= READER_INVALID;
+		}
+		for(; m.dots; m.dots &= m.dots - 1){
+			size_t dot = off + __builtin_ctz(m.dots);
+			if(dot == label_start || dot - label_start > MAX_LABEL){
+				f |= READER_INVALID;
+			}
+			label_start = dot + 1;
+		}
+		if(m.nl){
+			break;
+		}
+		off += w;
+	}
+
+	/* The last label may only be empty after a final dot */
+	if(len - label_start > MAX_LABEL || (len == label_start && len <= 1)
+		|| len - (len > 0 && s[len - 1] == '.') > MAX_HOSTNAME){
+		f |= READER_INVALID;
+	}
+	if(len > MAX_NAME_LENGTH - 1){
+		f |= READER_INVALID | READER_TOO_LONG;
+	}
+	*flags = f;
+	return len;
+}
+
+int reader_map(int fd, struct mapped_file *mf){
+	struct stat st;
+
+	if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)){
+		return -1;
+	}
+	mf->size = (size_t)st.st_size;
+	mf->data = NULL;
+	if(mf->size == 0){
+		return 0;
+	}
+
+	/* Writable so names can be lowercased in place; MAP_PRIVATE keeps that from the file */
+	void *data = mmap(NULL, mf->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if(data == MAP_FAILED){
+		return -1;
+	}
+
+	/* Lines are read front to back, once */
+	madvise(data, mf->size, MADV_SEQUENTIAL);
+	mf->data = data;
+	return 0;
+}
+
+void reader_unmap(struct mapped_file *mf){
+	if(mf->data != NULL){
+		munmap((void*)mf->data, mf->size);
+		mf->data = NULL;
+	}
+}
+
+size_t reader_split(const struct mapped_file *mf, int file, size_t chunk_size,
+	struct chunk *chunks, size_t max_chunks){
+	size_t num_chunks = 0;
+	size_t start = 0;
+
+	while(start < mf->size){
+		size_t end = start + chunk_size < mf->size ? start + chunk_size : mf->size;
+
+		/* Move the end past the next newline so no line is split */
+		if(end < mf->size){
+			const char *nl = memchr(mf->data + end - 1, '\n', mf->size - end + 1);
+			end = nl ? (size_t)(nl - mf->data) + 1 : mf->size;
+		}
+
+		if(num_chunks < max_chunks){
+			chunks[num_chunks].start = mf->data + start;
+			chunks[num_chunks].len = end - start;
+			chunks[num_chunks].file = file;
+		}
+		num_chunks++;
+		start = end;
+	}
+	return num_chunks;
+}
+
+int reader_next_line(const struct chunk *c, size_t *pos, const char **line, size_t *len, int *flags){
+	if(*pos >= c->len){
+		return -1;
+	}
+	*line = c->start + *pos;
+	*len = reader_scan(c->start + *pos, c->len - *pos, flags);
+	*pos += *len + (*pos + *len < c->len ? 1 : 0);
+	return 0;
+}
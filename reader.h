@@ -0,0 +1,82 @@
+/*
+ * File: reader.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains declarations of the memory-mapped input
+ *      reader. A data file is mapped once and split into
+ *      newline-aligned chunks, so several requesters can parse one
+ *      file at the same time and hand out views into the mapping
+ *      instead of copies of each line.
+ *
+ *      Lines are split by a vectorized scan (AVX2 where the CPU has it,
+ *      SSE2 otherwise, plain C elsewhere) that finds the newline,
+ *      lowercases the name in place and checks that it is a hostname in
+ *      one pass over its bytes. The mapping is private and writable for
+ *      that; only pages holding an uppercase letter are ever copied.
+ *
+ */
+
+#ifndef READER_H
+#define READER_H
+
+#include <stddef.h>
+
+/* Define macros:
+- READER_CHUNK_SIZE: Target size of a chunk; chunks end on the first newline after it
+- READER_INVALID: Flag of a line that is not a hostname
+- READER_TOO_LONG: Flag of a line of MAX_NAME_LENGTH bytes or more; it is READER_INVALID too */
+#define READER_CHUNK_SIZE (1 << 20)
+#define READER_INVALID 1
+#define READER_TOO_LONG 2
+
+/* A mapped data file
+- data: First byte of the mapping; NULL for an empty file
+- size: Num of bytes mapped */
+struct mapped_file{
+	char *data;
+	size_t size;
+};
+
+/* A newline-aligned piece of a mapped file
+- start: First byte of the chunk
+- len: Num of bytes in the chunk
+- file: Index of the file the chunk belongs to */
+struct chunk{
+	char *start;
+	size_t len;
+	int file;
+};
+
+/* Map the regular file open on fd; writes stay private to the mapping.
+ * Returns 0 on success, -1 if fd is not a regular file or cannot be mapped
+ */
+int reader_map(int fd, struct mapped_file *mf);
+
+/* Unmap a file mapped by reader_map() */
+void reader_unmap(struct mapped_file *mf);
+
+/* Split mf into chunks of about chunk_size bytes that each end on a
+ * newline (or at the end of the file), tagging them with file.
+ * Writes at most max_chunks chunks; returns the num of chunks needed
+ */
+size_t reader_split(const struct mapped_file *mf, int file, size_t chunk_size,
+	struct chunk *chunks, size_t max_chunks);
+
+/* Scan the line at s, which ends at its first newline or after n
+ * bytes. The line is lowercased in place; bytes after its newline, up
+ * to n, may be too. Sets *flags to READER_INVALID unless the line is a
+ * hostname: letters, digits, hyphens and underscores in labels of 1 to
+ * 63 bytes separated by dots, at most 253 bytes besides a final dot;
+ * and adds READER_TOO_LONG if it could not be a name at all.
+ * Returns its length, without the newline
+ */
+size_t reader_scan(char *s, size_t n, int *flags);
+
+/* Find the next line of a chunk with reader_scan(). *pos is the offset
+ * to start from and is moved past the line. Returns 0 and points line,
+ * len and flags at the line (without its newline) and its flags if
+ * there is one, -1 at the end of the chunk
+ */
+int reader_next_line(const struct chunk *c, size_t *pos, const char **line, size_t *len, int *flags);
+
+#endif
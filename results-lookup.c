@@ -0,0 +1,71 @@
+/*
+ * File: results-lookup.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the companion tool of the binary results file
+ *      (multi-lookup -f binary). It maps the file and answers every
+ *      name given on the command line, or one per line on stdin, with
+ *      the same "name,addr,addr,..." line the text <resolver log>
+ *      would hold. Each answer is a hash probe into the mapped index;
+ *      the file is never read as a whole.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "queue.h"
+#include "results.h"
+
+static void usage(char *str){
+	printf("Usage: %s <results file> [name...]\n", str);
+	printf("Without names, names are read from stdin, one per line\n");
+	exit(1);
+}
+
+/* Print the line of name; return 0, or 1 if it is not in the file */
+static int answer(const struct results_db *db, const char *name){
+	struct addr_list addrs;
+	char text[UTIL_ADDRS_STRLEN];
+
+	if(results_find(db, name, &addrs, NULL) != 0){
+		fprintf(stderr, "%s: not in the results file\n", name);
+		return 1;
+	}
+	format_addrs(&addrs, text, sizeof(text));
+	printf("%s,%s\n", name, text);
+	return 0;
+}
+
+int main(int argc, char **argv){
+	struct results_db db;
+	int missing = 0;
+
+	if(argc < 2){
+		usage(argv[0]);
+	}
+	if(results_open(argv[1], &db) != 0){
+		perror("Error opening the results file");
+		exit(1);
+	}
+
+	if(argc > 2){
+		for(int i = 2; i < argc; i++){
+			missing |= answer(&db, argv[i]);
+		}
+	}
+	else{
+		char name[MAX_NAME_LENGTH + 1];
+		while(fgets(name, sizeof(name), stdin) != NULL){
+			name[strcspn(name, "\r\n")] = 0;
+			if(name[0] != 0){
+				missing |= answer(&db, name);
+			}
+		}
+	}
+
+	results_close(&db);
+	return missing;
+}
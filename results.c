@@ -0,0 +1,342 @@
+/*
+ * File: results.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the binary results file. The writer streams
+ *      records through its usual buffers, so ordered mode and the
+ *      batched writes are the same as for text; only once the last
+ *      record is out is the file mapped, scanned once, and the index
+ *      and header written after and before the records.
+ *
+ *      Lookups map the file and only ever touch the slots they probe
+ *      and the records those point at; nothing is parsed up front.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "results.h"
+
+/* Define macros:
+- HEADER_SIZE: Size of the header; the records start here
+- MIN_SLOTS: Smallest index
+- OFF_BITS: Bits of a slot holding the record offset */
+#define HEADER_SIZE 64
+#define MIN_SLOTS 16
+#define OFF_BITS 48
+
+/* The header, in host byte order
+- magic: RESULTS_MAGIC once the file is complete
+- num_records: Records written
+- num_names: Distinct names in the index
+- records_off/records_len: Where the records are
+- index_off/index_slots: Where the index is and its num of slots
+- flags: RESULTS_EXPIRES or 0 */
+struct results_header{
+	char magic[8];
+	uint64_t num_records;
+	uint64_t num_names;
+	uint64_t records_off;
+	uint64_t records_len;
+	uint64_t index_off;
+	uint64_t index_slots;
+	uint64_t flags;
+};
+
+_Static_assert(sizeof(struct results_header) == HEADER_SIZE, "results header must be 64 bytes");
+
+static uint64_t make_slot(uint64_t hash, uint64_t off){
+	return (hash >> OFF_BITS << OFF_BITS) | off;
+}
+
+static int tag_matches(uint64_t slot, uint64_t hash){
+	return slot >> OFF_BITS == hash >> OFF_BITS;
+}
+
+/* Num of addresses of the record at p */
+static int num_addrs(const unsigned char *p){
+	return p[2] == RESULTS_TIMED_OUT ? 0 : p[2];
+}
+
+/* Offset of the addresses in the record at p */
+static size_t addrs_off(const unsigned char *p, uint32_t flags){
+	return 3 + (p[0] | (size_t)p[1] << 8) + 1 + (flags & RESULTS_EXPIRES ? 8 : 0);
+}
+
+/* Size of the record at p, or 0 if it runs past end */
+static size_t record_size(const unsigned char *p, const unsigned char *end, uint32_t flags){
+	if(end - p < 3){
+		return 0;
+	}
+	size_t name_len = p[0] | (size_t)p[1] << 8;
+	size_t size = addrs_off(p, flags);
+	if(p + size > end){
+		return 0;
+	}
+	for(int i = 0; i < num_addrs(p); i++){
+		if(p + size >= end){
+			return 0;
+		}
+		size += 1 + (p[size] == 6 ? 16 : 4);
+	}
+	return p + size <= end && p[3 + name_len] == 0 ? size : 0;
+}
+
+static int write_all(int fd, const void *data, size_t len, off_t off){
+	const char *p = data;
+	while(len > 0){
+		ssize_t wrote = pwrite(fd, p, len, off);
+		if(wrote < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		p += wrote;
+		len -= wrote;
+		off += wrote;
+	}
+	return 0;
+}
+
+int results_begin(int fd){
+	char header[HEADER_SIZE] = {0};
+	if(ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0){
+		return -1;
+	}
+	return write_all(fd, header, sizeof(header), 0) == 0 && lseek(fd, HEADER_SIZE, SEEK_SET) == HEADER_SIZE ? 0 : -1;
+}
+
+static size_t encode(char *buf, const char *name, const struct addr_list *addrs, uint32_t flags, int64_t expires){
+	unsigned char *out = (unsigned char *)buf;
+	size_t name_len = strlen(name);
+	size_t len = 3;
+
+	out[0] = name_len & 0xff;
+	out[1] = name_len >> 8;
+	out[2] = addrs->timed_out ? RESULTS_TIMED_OUT : addrs->num;
+	memcpy(out + len, name, name_len + 1);
+	len += name_len + 1;
+	if(flags & RESULTS_EXPIRES){
+		for(int i = 0; i < 8; i++){
+			out[len++] = (uint64_t)expires >> (8 * i);
+		}
+	}
+	for(int i = 0; i < addrs->num; i++){
+		const struct ip_addr *a = &addrs->addrs[i];
+		if(a->family == AF_INET6){
+			out[len++] = 6;
+			memcpy(out + len, &a->v6, 16);
+			len += 16;
+		}
+		else{
+			out[len++] = 4;
+			memcpy(out + len, &a->v4, 4);
+			len += 4;
+		}
+	}
+	return len;
+}
+
+/* Decode the record at p */
+static void decode(const unsigned char *p, uint32_t flags, struct addr_list *addrs, int64_t *expires){
+	size_t pos = addrs_off(p, flags);
+	if(expires != NULL){
+		uint64_t t = 0;
+		for(int i = 0; i < 8 && (flags & RESULTS_EXPIRES); i++){
+			t |= (uint64_t)p[pos - 8 + i] << (8 * i);
+		}
+		*expires = (int64_t)t;
+	}
+	if(addrs == NULL){
+		return;
+	}
+	addrs->num = 0;
+	addrs->timed_out = p[2] == RESULTS_TIMED_OUT;
+	for(int j = 0; j < num_addrs(p) && addrs->num < UTIL_MAX_ADDRS; j++){
+		struct ip_addr *a = &addrs->addrs[addrs->num++];
+		if(p[pos++] == 6){
+			a->family = AF_INET6;
+			memcpy(&a->v6, p + pos, 16);
+			pos += 16;
+		}
+		else{
+			a->family = AF_INET;
+			memcpy(&a->v4, p + pos, 4);
+			pos += 4;
+		}
+	}
+}
+
+size_t results_encode(char *buf, const char *name, const struct addr_list *addrs){
+	return encode(buf, name, addrs, 0, 0);
+}
+
+size_t results_encode_expiring(char *buf, const char *name, const struct addr_list *addrs, int64_t expires){
+	return encode(buf, name, addrs, RESULTS_EXPIRES, expires);
+}
+
+int results_finish(int fd, uint32_t flags){
+	struct results_header h;
+	off_t end = lseek(fd, 0, SEEK_CUR);
+	const unsigned char *map;
+	uint64_t *index = NULL;
+	int ret = -1;
+
+	if(end < HEADER_SIZE){
+		return -1;
+	}
+	memset(&h, 0, sizeof(h));
+	h.flags = flags;
+	h.records_off = HEADER_SIZE;
+	h.records_len = end - HEADER_SIZE;
+	map = mmap(NULL, end, PROT_READ, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED){
+		return -1;
+	}
+
+	/* One pass to count the records, so the index is sized before it is filled */
+	const unsigned char *p = map + HEADER_SIZE, *stop = map + end;
+	size_t size;
+	for(; p < stop && (size = record_size(p, stop, flags)) > 0; p += size){
+		h.num_records++;
+	}
+	if(p != stop){
+		errno = EINVAL;
+		goto out;
+	}
+
+	/* Keep the load factor under 0.7 */
+	h.index_slots = MIN_SLOTS;
+	while(h.index_slots * 7 < h.num_records * 10){
+		h.index_slots <<= 1;
+	}
+	index = calloc(h.index_slots, sizeof(*index));
+	if(index == NULL){
+		goto out;
+	}
+	uint64_t mask = h.index_slots - 1;
+	for(p = map + HEADER_SIZE; p < stop; p += record_size(p, stop, flags)){
+		const char *name = (const char *)p + 3;
+		uint64_t hash = hash_name(name);
+		uint64_t i = hash & mask;
+		while(index[i] != 0 && !(tag_matches(index[i], hash) &&
+			strcasecmp((const char *)map + (index[i] & ((1ULL << OFF_BITS) - 1)) + 3, name) == 0)){
+			i = (i + 1) & mask;
+		}
+		/* A repeated name keeps its first record */
+		if(index[i] == 0){
+			index[i] = make_slot(hash, p - map);
+			h.num_names++;
+		}
+	}
+
+	/* Index after the records, then the header; the magic goes last */
+	h.index_off = (end + 7) & ~(off_t)7;
+	if(write_all(fd, index, h.index_slots * sizeof(*index), h.index_off) != 0){
+		goto out;
+	}
+	if(write_all(fd, &h, sizeof(h), 0) != 0 || fsync(fd) != 0){
+		goto out;
+	}
+	memcpy(h.magic, RESULTS_MAGIC, sizeof(h.magic));
+	ret = write_all(fd, h.magic, sizeof(h.magic), 0);
+
+out:
+	free(index);
+	munmap((void *)map, end);
+	return ret;
+}
+
+int results_open(const char *path, struct results_db *db){
+	struct stat st;
+	const struct results_header *h;
+	int fd = open(path, O_RDONLY);
+
+	memset(db, 0, sizeof(*db));
+	if(fd < 0){
+		return -1;
+	}
+	if(fstat(fd, &st) != 0 || st.st_size < HEADER_SIZE){
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED){
+		return -1;
+	}
+
+	/* Check that everything a lookup can reach lies inside the file */
+	h = map;
+	uint64_t size = st.st_size;
+	if(memcmp(h->magic, RESULTS_MAGIC, sizeof(h->magic)) != 0 || h->records_off != HEADER_SIZE ||
+		h->records_len > size - HEADER_SIZE || h->index_off < HEADER_SIZE + h->records_len || h->index_off > size ||
+		h->index_off % 8 != 0 || h->index_slots == 0 || (h->index_slots & (h->index_slots - 1)) != 0 ||
+		h->index_slots > (size - h->index_off) / sizeof(uint64_t) || (h->flags & ~(uint64_t)RESULTS_EXPIRES) != 0){
+		munmap(map, st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+	db->map = map;
+	db->size = st.st_size;
+	db->flags = h->flags;
+	db->num_names = h->num_names;
+	db->records_end = db->map + HEADER_SIZE + h->records_len;
+	db->index = (const uint64_t *)(db->map + h->index_off);
+	db->mask = h->index_slots - 1;
+	return 0;
+}
+
+int results_find(const struct results_db *db, const char *name, struct addr_list *addrs, int64_t *expires){
+	uint64_t hash = hash_name(name);
+
+	for(uint64_t i = hash & db->mask, n = 0; n <= db->mask; i = (i + 1) & db->mask, n++){
+		uint64_t slot = db->index[i];
+		if(slot == 0){
+			break;
+		}
+		uint64_t off = slot & ((1ULL << OFF_BITS) - 1);
+		if(!tag_matches(slot, hash) || off < HEADER_SIZE || db->map + off >= db->records_end){
+			continue;
+		}
+		const unsigned char *p = db->map + off;
+		if(record_size(p, db->records_end, db->flags) == 0 || strcasecmp((const char *)p + 3, name) != 0){
+			continue;
+		}
+		decode(p, db->flags, addrs, expires);
+		return 0;
+	}
+	return -1;
+}
+
+int results_next(const struct results_db *db, uint64_t *pos, const char **name, struct addr_list *addrs, int64_t *expires){
+	const unsigned char *p = db->map + (*pos < HEADER_SIZE ? HEADER_SIZE : *pos);
+	size_t size;
+
+	if(p >= db->records_end || (size = record_size(p, db->records_end, db->flags)) == 0){
+		return -1;
+	}
+	if(name != NULL){
+		*name = (const char *)p + 3;
+	}
+	decode(p, db->flags, addrs, expires);
+	*pos = p + size - db->map;
+	return 0;
+}
+
+void results_close(struct results_db *db){
+	if(db->map != NULL){
+		munmap((void *)db->map, db->size);
+	}
+	memset(db, 0, sizeof(*db));
+}
@@ -0,0 +1,105 @@
+/*
+ * File: results.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains declarations of the binary results file, the
+ *      alternative to the "name,addr,..." text of <resolver log>. It
+ *      is laid out to be mapped and queried in place:
+ *
+ *      - A 64-byte header, written last
+ *      - The records, one per resolved name, in the order the writer
+ *        wrote them: a 2-byte name length, a 1-byte num of addresses
+ *        (RESULTS_TIMED_OUT for a lookup given up at its deadline),
+ *        the name and its NUL, with RESULTS_EXPIRES an 8-byte expiry
+ *        time in seconds since the epoch, then per address a 1-byte
+ *        family (4 or 6) and its 4 or 16 bytes in network byte order.
+ *        Lengths and expiry times are little-endian
+ *      - The index, 8-byte aligned: an open-addressing hash table with
+ *        linear probing, a power of two of 8-byte slots, each the top
+ *        16 bits of the name's hash above the 48-bit file offset of
+ *        its record; 0 is an empty slot
+ *
+ *      The header and index are in host byte order. The magic is only
+ *      written once the index is complete, so a file cut short by a
+ *      crash does not open. A name that appears more than once is
+ *      indexed at its first record.
+ *
+ *      The resolution cache snapshot (cache.h) is a results file with
+ *      RESULTS_EXPIRES set, so results-lookup reads both.
+ *
+ */
+
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "util.h"
+#include "queue.h"
+
+/* Define macros:
+- RESULTS_MAGIC: First 8 bytes of a complete results file
+- RESULTS_RECORD_MAX: Largest record
+- RESULTS_EXPIRES: Flag of a file whose records carry an expiry time
+- RESULTS_TIMED_OUT: Num of addresses of a record that timed out */
+#define RESULTS_MAGIC "MLRES01\n"
+#define RESULTS_RECORD_MAX (3 + MAX_NAME_LENGTH + 8 + UTIL_MAX_ADDRS * 17)
+#define RESULTS_EXPIRES 1
+#define RESULTS_TIMED_OUT 0xff
+
+/* A results file mapped for lookups */
+struct results_db{
+	const unsigned char *map;
+	size_t size;
+	uint32_t flags;
+	uint64_t num_names;
+	const unsigned char *records_end;
+	const uint64_t *index;
+	uint64_t mask;
+};
+
+/* Empty the file open on fd and leave room for the header.
+ * Returns 0, or -1 on failure
+ */
+int results_begin(int fd);
+
+/* Encode the record of name into buf, which holds at least
+ * RESULTS_RECORD_MAX bytes. Returns its length
+ */
+size_t results_encode(char *buf, const char *name, const struct addr_list *addrs);
+
+/* results_encode() for a file with RESULTS_EXPIRES; expires is in
+ * seconds since the epoch
+ */
+size_t results_encode_expiring(char *buf, const char *name, const struct addr_list *addrs, int64_t expires);
+
+/* Index the records written to fd since results_begin(), ending at
+ * its current offset, and write the index and the header. flags are
+ * those the records were encoded with. Returns 0, or -1 on failure
+ */
+int results_finish(int fd, uint32_t flags);
+
+/* Map the results file at path. Returns 0, or -1 if it cannot be
+ * read or is not a complete results file
+ */
+int results_open(const char *path, struct results_db *db);
+
+/* Find name, ignoring case, and copy its addresses (none for a failed
+ * lookup) into addrs, and its expiry time (0 without RESULTS_EXPIRES)
+ * into *expires unless it is NULL. Returns 0, or -1 if name is not in
+ * the file
+ */
+int results_find(const struct results_db *db, const char *name, struct addr_list *addrs, int64_t *expires);
+
+/* Walk the records in file order. *pos is 0 for the first; each call
+ * points *name at the NUL-terminated name inside the mapping, fills
+ * addrs and *expires (either may be NULL) and moves *pos on.
+ * Returns 0, or -1 past the last record
+ */
+int results_next(const struct results_db *db, uint64_t *pos, const char **name, struct addr_list *addrs, int64_t *expires);
+
+/* Unmap a results file */
+void results_close(struct results_db *db);
+
+#endif
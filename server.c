@@ -0,0 +1,385 @@
+/*
+ * File: server.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the daemon's socket and its client. The accept
+ *      thread polls the listening socket and a signalfd, so a stop
+ *      request is ordinary code on that thread rather than a signal
+ *      handler. The client sends from one thread and reads answers on
+ *      another, so neither side of the connection ever waits for the
+ *      other to drain.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+/* Define macros:
+- CLIENT_BUF_SIZE: Bytes the client sends or receives per call */
+#define CLIENT_BUF_SIZE (64 * 1024)
+
+/* A connection waiting for a requester */
+struct pending{
+	struct pending *next;
+	int fd;
+};
+
+/* The daemon's socket
+- path: Where the socket lives
+- listen_fd/signal_fd: Polled by the accept thread
+- thread: The accept thread
+- old_mask: Signal mask before server_create()
+- lock/ready: Guard the queue below; requesters wait on ready
+- head/tail: Connections not taken yet
+- closing: Set once the daemon takes no more clients */
+struct server{
+	char *path;
+	int listen_fd;
+	int signal_fd;
+	pthread_t thread;
+	sigset_t old_mask;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	struct pending *head;
+	struct pending *tail;
+	int closing;
+};
+
+static int make_addr(const char *path, struct sockaddr_un *addr){
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr->sun_path)){
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+static void stop(struct server *s){
+	pthread_mutex_lock(&s->lock);
+	s->closing = 1;
+	pthread_cond_broadcast(&s->ready);
+	pthread_mutex_unlock(&s->lock);
+}
+
+static void *accept_main(void *arg){
+	struct server *s = arg;
+	struct pollfd fds[2] = {{s->listen_fd, POLLIN, 0}, {s->signal_fd, POLLIN, 0}};
+
+	while(1){
+		if(poll(fds, 2, -1) < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			perror("Error waiting for clients");
+			break;
+		}
+		if(fds[1].revents){
+			struct signalfd_siginfo info;
+			if(read(s->signal_fd, &info, sizeof(info)) == sizeof(info)){
+				break;
+			}
+		}
+		if(!(fds[0].revents & POLLIN)){
+			continue;
+		}
+		int fd = accept(s->listen_fd, NULL, NULL);
+		if(fd < 0){
+			continue;
+		}
+
+		/* A requester's read() of an idle client fails with EAGAIN instead of waiting for good */
+		struct timeval idle = {SERVER_IDLE_MS / 1000, SERVER_IDLE_MS % 1000 * 1000};
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+		struct pending *c = malloc(sizeof(*c));
+		if(c == NULL){
+			close(fd);
+			continue;
+		}
+		c->next = NULL;
+		c->fd = fd;
+		pthread_mutex_lock(&s->lock);
+		if(s->tail){
+			s->tail->next = c;
+		}
+		else{
+			s->head = c;
+		}
+		s->tail = c;
+		pthread_cond_signal(&s->ready);
+		pthread_mutex_unlock(&s->lock);
+	}
+	stop(s);
+	return NULL;
+}
+
+struct server *server_create(const char *path){
+	struct sockaddr_un addr;
+	struct stat st;
+	sigset_t set;
+
+	if(make_addr(path, &addr) != 0){
+		return NULL;
+	}
+	struct server *s = calloc(1, sizeof(*s));
+	if(s == NULL || (s->path = strdup(path)) == NULL){
+		free(s);
+		return NULL;
+	}
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->ready, NULL);
+	s->listen_fd = s->signal_fd = -1;
+
+	/* A socket nobody answers on is left over from a daemon that is gone */
+	if(stat(path, &st) == 0 && S_ISSOCK(st.st_mode)){
+		int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) != 0 && errno == ECONNREFUSED){
+			unlink(path);
+		}
+		if(probe >= 0){
+			close(probe);
+		}
+	}
+
+	/* A client that hangs up must not take the daemon with it */
+	signal(SIGPIPE, SIG_IGN);
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, &s->old_mask);
+	if((s->signal_fd = signalfd(-1, &set, SFD_CLOEXEC)) < 0
+		|| (s->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0
+		|| bind(s->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+		|| listen(s->listen_fd, SERVER_BACKLOG) != 0){
+		goto fail;
+	}
+	if(pthread_create(&s->thread, NULL, accept_main, s) != 0){
+		unlink(path);
+		goto fail;
+	}
+	return s;
+
+fail:
+	if(s->listen_fd >= 0){
+		close(s->listen_fd);
+	}
+	if(s->signal_fd >= 0){
+		close(s->signal_fd);
+	}
+	pthread_sigmask(SIG_SETMASK, &s->old_mask, NULL);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->ready);
+	free(s->path);
+	free(s);
+	return NULL;
+}
+
+int server_next_client(struct server *s){
+	pthread_mutex_lock(&s->lock);
+	while(s->head == NULL && !s->closing){
+		pthread_cond_wait(&s->ready, &s->lock);
+	}
+	struct pending *c = s->head;
+	if(c != NULL){
+		s->head = c->next;
+		if(s->head == NULL){
+			s->tail = NULL;
+		}
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	if(c == NULL){
+		return -1;
+	}
+	int fd = c->fd;
+	free(c);
+	return fd;
+}
+
+void server_destroy(struct server *s){
+	sigset_t set;
+	struct timespec none = {0, 0};
+
+	/* The accept thread leaves on the first SIGTERM it reads; send one if no signal has stopped it yet */
+	pthread_mutex_lock(&s->lock);
+	int closing = s->closing;
+	pthread_mutex_unlock(&s->lock);
+	if(!closing){
+		pthread_kill(s->thread, SIGTERM);
+	}
+	pthread_join(s->thread, NULL);
+	close(s->listen_fd);
+	close(s->signal_fd);
+	unlink(s->path);
+	while(s->head != NULL){
+		struct pending *next = s->head->next;
+		close(s->head->fd);
+		free(s->head);
+		s->head = next;
+	}
+
+	/* Take any stop request that came in after the accept thread left, then unblock */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	while(sigtimedwait(&set, NULL, &none) > 0){
+	}
+	pthread_sigmask(SIG_SETMASK, &s->old_mask, NULL);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->ready);
+	free(s->path);
+	free(s);
+}
+
+/* What the sending thread of the client needs
+- fd: The connection
+- files/num_files: What to send
+- status: 0, or 1 if anything could not be sent */
+struct client_send{
+	int fd;
+	char **files;
+	int num_files;
+	int status;
+};
+
+static int send_all(int fd, const char *data, size_t len){
+	while(len > 0){
+		ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+		if(sent < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		data += sent;
+		len -= sent;
+	}
+	return 0;
+}
+
+static int write_all(int fd, const char *data, size_t len){
+	while(len > 0){
+		ssize_t wrote = write(fd, data, len);
+		if(wrote < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			return -1;
+		}
+		data += wrote;
+		len -= wrote;
+	}
+	return 0;
+}
+
+/* Send every file, each ending on a newline so its last name does not run into the next file's first */
+static void *send_main(void *arg){
+	struct client_send *cs = arg;
+	char *buf = malloc(CLIENT_BUF_SIZE);
+
+	for(int i = 0; buf != NULL && i < cs->num_files; i++){
+		int in = strcmp(cs->files[i], "-") == 0 ? STDIN_FILENO : open(cs->files[i], O_RDONLY | O_CLOEXEC);
+		char last = '\n';
+		ssize_t got;
+		if(in < 0){
+			fprintf(stderr, "Error opening %s: %s\n", cs->files[i], strerror(errno));
+			cs->status = 1;
+			continue;
+		}
+		while((got = read(in, buf, CLIENT_BUF_SIZE)) != 0){
+			if(got < 0){
+				if(errno == EINTR){
+					continue;
+				}
+				fprintf(stderr, "Error reading %s: %s\n", cs->files[i], strerror(errno));
+				cs->status = 1;
+				break;
+			}
+			if(send_all(cs->fd, buf, got) != 0){
+				perror("Error sending to the daemon");
+				cs->status = 1;
+				i = cs->num_files;
+				break;
+			}
+			last = buf[got - 1];
+		}
+		if(last != '\n' && send_all(cs->fd, "\n", 1) != 0){
+			cs->status = 1;
+		}
+		if(in != STDIN_FILENO){
+			close(in);
+		}
+	}
+	if(buf == NULL){
+		cs->status = 1;
+	}
+	free(buf);
+
+	/* The daemon closes the connection once it has answered everything sent before this */
+	shutdown(cs->fd, SHUT_WR);
+	return NULL;
+}
+
+int server_client(const char *path, int num_files, char **files, int out_fd){
+	struct sockaddr_un addr;
+	struct client_send cs = {-1, files, num_files, 0};
+	pthread_t sender;
+	char *buf;
+	ssize_t got;
+	int status = 0;
+
+	if(make_addr(path, &addr) != 0 || (cs.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0
+		|| connect(cs.fd, (struct sockaddr *)&addr, sizeof(addr)) != 0){
+		fprintf(stderr, "Error connecting to the daemon at %s: %s\n", path, strerror(errno));
+		if(cs.fd >= 0){
+			close(cs.fd);
+		}
+		return 1;
+	}
+	if((buf = malloc(CLIENT_BUF_SIZE)) == NULL || pthread_create(&sender, NULL, send_main, &cs) != 0){
+		free(buf);
+		close(cs.fd);
+		return 1;
+	}
+
+	/* Answers come back while names are still going out */
+	while((got = read(cs.fd, buf, CLIENT_BUF_SIZE)) != 0){
+		if(got < 0){
+			if(errno == EINTR){
+				continue;
+			}
+			perror("Error reading from the daemon");
+			status = 1;
+			break;
+		}
+		if(write_all(out_fd, buf, got) != 0){
+			perror("Error writing the answers");
+			status = 1;
+			break;
+		}
+	}
+
+	/* If reading stopped early, the daemon may never read the rest; unblock the sender */
+	if(status != 0){
+		shutdown(cs.fd, SHUT_RDWR);
+	}
+	pthread_join(sender, NULL);
+	close(cs.fd);
+	free(buf);
+	return status | cs.status;
+}
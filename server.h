@@ -0,0 +1,56 @@
+/*
+ * File: server.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains declarations of the daemon's Unix domain socket
+ *      and of the client that talks to it. A client connects, sends
+ *      names one per line, and reads "name,addr,..." lines back as they
+ *      are answered, in no particular order, while it is still sending;
+ *      once it closes its sending end and every answer is out, the
+ *      daemon closes the connection. A client that sends nothing for
+ *      SERVER_IDLE_MS is taken to have closed its sending end, so idle
+ *      clients cannot hold every requester while others wait.
+ *
+ *      An accept thread queues new connections for the requesters. It
+ *      also takes SIGINT and SIGTERM, which stop the daemon taking new
+ *      clients; clients already connected are answered to the end.
+ *
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+/* Define macros:
+- SERVER_BACKLOG: Connections the kernel holds before they are accepted
+- SERVER_MAX_SESSIONS: Clients being answered at once; the writer's session slots
+- SERVER_IDLE_MS: Time a requester waits for a client to send anything before it stops reading it */
+#define SERVER_BACKLOG 128
+#define SERVER_MAX_SESSIONS 1024
+#define SERVER_IDLE_MS 5000
+
+struct server;
+
+/* Listen on a Unix domain socket at path, replacing a stale socket
+ * left there by a daemon that is gone, and start the accept thread.
+ * Blocks SIGINT and SIGTERM in the calling thread, so call it before
+ * starting any other thread. Returns NULL on failure
+ */
+struct server *server_create(const char *path);
+
+/* Wait for the next client. Returns its connection, or -1 once the
+ * daemon has been told to stop and no client is left waiting
+ */
+int server_next_client(struct server *s);
+
+/* Stop taking clients, close and remove the socket, and free s. The
+ * signal mask is restored
+ */
+void server_destroy(struct server *s);
+
+/* Client mode: send the names in files (num_files of them, "-" for
+ * stdin) to the daemon at path and copy its answers to out_fd as they
+ * come. Returns 0, or 1 if anything could not be sent or read
+ */
+int server_client(const char *path, int num_files, char **files, int out_fd);
+
+#endif
@@ -0,0 +1,291 @@
+/*
+ * File: stats.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the run statistics. Each attached thread owns
+ *      a record with its own lock; only that thread and a snapshot ever
+ *      take it, so recording costs an uncontended lock and a few adds.
+ *      Records stay on the list after their thread exits, so the
+ *      totals at exit still hold everything.
+ *
+ *      SIGUSR1 is taken synchronously by a listener thread with
+ *      sigwait(), so the snapshot runs as ordinary code instead of in
+ *      a signal handler, where neither locks nor stdio are safe.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "queue.h"
+#include "stats.h"
+
+/* Define macros:
+- MAX_PATH: Longest snapshot path, temporary suffix included */
+#define MAX_PATH 4096
+
+/* One thread's record
+- lock: Taken by the thread to record and by snapshots to read
+- next: Next record of the run
+- role: What the thread does
+- totals: What it has recorded */
+struct stats_thread{
+	_Alignas(CACHE_LINE) pthread_mutex_t lock;
+	struct stats_thread *next;
+	const char *role;
+	struct stats_totals totals;
+};
+
+/* Statistics of a run
+- lock: Guards threads
+- dump_lock: Keeps the listener and the final dump from writing at once
+- threads: Every record, newest first
+- path: Where snapshots go; NULL for stderr
+- start: Monotonic time of stats_create()
+- listener: Thread taking SIGUSR1
+- closing: Tells the listener the next SIGUSR1 is stats_destroy()'s
+- old_mask: Signal mask of the caller before stats_create() */
+struct stats{
+	pthread_mutex_t lock;
+	pthread_mutex_t dump_lock;
+	struct stats_thread *threads;
+	char *path;
+	struct timespec start;
+	pthread_t listener;
+	atomic_int closing;
+	sigset_t old_mask;
+};
+
+static _Thread_local struct stats_thread *self;
+
+static const char *stage_names[STAT_NUM_STAGES] = {
+	"read", "enqueue_wait", "dequeue_wait", "lookup", "write", "name"
+};
+
+static const char *counter_names[STAT_NUM_COUNTERS] = {
+	"names_produced", "names_consumed", "failures", "condvar_wakeups", "hedges", "timeouts", "invalid_names", "zone_hits"
+};
+
+static void init_totals(struct stats_totals *t){
+	for(int i = 0; i < STAT_NUM_STAGES; i++){
+		hist_init(&t->hists[i]);
+	}
+	memset(t->counters, 0, sizeof(t->counters));
+}
+
+static void *listen_main(void *arg){
+	struct stats *s = arg;
+	sigset_t set;
+	int sig;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	while(sigwait(&set, &sig) == 0 && !atomic_load(&s->closing)){
+		stats_dump(s, 0);
+	}
+	return NULL;
+}
+
+struct stats *stats_create(const char *path){
+	struct stats *s = calloc(1, sizeof(*s));
+	sigset_t set;
+	if(s == NULL){
+		return NULL;
+	}
+	if(path != NULL && (strlen(path) + 5 > MAX_PATH || (s->path = strdup(path)) == NULL)){
+		free(s);
+		return NULL;
+	}
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_mutex_init(&s->dump_lock, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &s->start);
+	atomic_init(&s->closing, 0);
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &set, &s->old_mask);
+	if(pthread_create(&s->listener, NULL, listen_main, s) != 0){
+		pthread_sigmask(SIG_SETMASK, &s->old_mask, NULL);
+		pthread_mutex_destroy(&s->lock);
+		pthread_mutex_destroy(&s->dump_lock);
+		free(s->path);
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+void stats_destroy(struct stats *s){
+	sigset_t set;
+	struct timespec none = {0, 0};
+
+	if(s == NULL){
+		return;
+	}
+	atomic_store(&s->closing, 1);
+	pthread_kill(s->listener, SIGUSR1);
+	pthread_join(s->listener, NULL);
+
+	/* A SIGUSR1 that came in after the listener left would kill the process once unblocked; take it here */
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	while(sigtimedwait(&set, NULL, &none) == SIGUSR1){
+	}
+	pthread_sigmask(SIG_SETMASK, &s->old_mask, NULL);
+
+	while(s->threads != NULL){
+		struct stats_thread *next = s->threads->next;
+		pthread_mutex_destroy(&s->threads->lock);
+		free(s->threads);
+		s->threads = next;
+	}
+	pthread_mutex_destroy(&s->lock);
+	pthread_mutex_destroy(&s->dump_lock);
+	free(s->path);
+	free(s);
+}
+
+void stats_attach(struct stats *s, const char *role){
+	struct stats_thread *t = aligned_alloc(CACHE_LINE, sizeof(*t));
+	if(t == NULL){
+		self = NULL;
+		return;
+	}
+	pthread_mutex_init(&t->lock, NULL);
+	t->role = role;
+	init_totals(&t->totals);
+
+	pthread_mutex_lock(&s->lock);
+	t->next = s->threads;
+	s->threads = t;
+	pthread_mutex_unlock(&s->lock);
+	self = t;
+}
+
+void stats_detach(void){
+	self = NULL;
+}
+
+void stats_record(enum stat_stage stage, uint64_t ns){
+	struct stats_thread *t = self;
+	if(t == NULL){
+		return;
+	}
+	pthread_mutex_lock(&t->lock);
+	hist_record(&t->totals.hists[stage], ns);
+	pthread_mutex_unlock(&t->lock);
+}
+
+void stats_count(enum stat_counter counter, uint64_t n){
+	struct stats_thread *t = self;
+	if(t == NULL){
+		return;
+	}
+	pthread_mutex_lock(&t->lock);
+	t->totals.counters[counter] += n;
+	pthread_mutex_unlock(&t->lock);
+}
+
+void stats_snapshot(struct stats *s, struct stats_totals *t){
+	init_totals(t);
+	pthread_mutex_lock(&s->lock);
+	for(struct stats_thread *th = s->threads; th != NULL; th = th->next){
+		pthread_mutex_lock(&th->lock);
+		for(int i = 0; i < STAT_NUM_STAGES; i++){
+			hist_merge(&t->hists[i], &th->totals.hists[i]);
+		}
+		for(int i = 0; i < STAT_NUM_COUNTERS; i++){
+			t->counters[i] += th->totals.counters[i];
+		}
+		pthread_mutex_unlock(&th->lock);
+	}
+	pthread_mutex_unlock(&s->lock);
+}
+
+/* Num of attached threads per role, as JSON members */
+static void write_roles(struct stats *s, FILE *fp){
+	const char *seen[64];
+	int counts[64];
+	int num = 0;
+
+	pthread_mutex_lock(&s->lock);
+	for(struct stats_thread *t = s->threads; t != NULL; t = t->next){
+		int i = 0;
+		while(i < num && strcmp(seen[i], t->role) != 0){
+			i++;
+		}
+		if(i == num && num < 64){
+			seen[num] = t->role;
+			counts[num++] = 0;
+		}
+		if(i < num){
+			counts[i]++;
+		}
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	for(int i = 0; i < num; i++){
+		fprintf(fp, "%s\"%s\": %d", i ? ", " : "", seen[i], counts[i]);
+	}
+}
+
+static void write_json(struct stats *s, FILE *fp, const struct stats_totals *t, int final){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double elapsed = (now.tv_sec - s->start.tv_sec) + (now.tv_nsec - s->start.tv_nsec) / 1e9;
+
+	fprintf(fp, "{\n  \"final\": %s,\n  \"elapsed_s\": %.6f,\n  \"threads\": {", final ? "true" : "false", elapsed);
+	write_roles(s, fp);
+	fprintf(fp, "},\n  \"counters\": {\n");
+	for(int i = 0; i < STAT_NUM_COUNTERS; i++){
+		fprintf(fp, "    \"%s\": %lu%s\n", counter_names[i], (unsigned long)t->counters[i],
+			i + 1 < STAT_NUM_COUNTERS ? "," : "");
+	}
+	fprintf(fp, "  },\n  \"histograms_ns\": {\n");
+	for(int i = 0; i < STAT_NUM_STAGES; i++){
+		const struct hist *h = &t->hists[i];
+		fprintf(fp, "    \"%s\": {\"count\": %lu, \"mean\": %.0f, \"min\": %lu, \"p50\": %lu, \"p90\": %lu,"
+			" \"p99\": %lu, \"p999\": %lu, \"max\": %lu}%s\n", stage_names[i], (unsigned long)h->count,
+			h->count ? (double)h->sum / h->count : 0.0, (unsigned long)(h->count ? h->min : 0),
+			(unsigned long)hist_quantile(h, 0.5), (unsigned long)hist_quantile(h, 0.9),
+			(unsigned long)hist_quantile(h, 0.99), (unsigned long)hist_quantile(h, 0.999),
+			(unsigned long)h->max, i + 1 < STAT_NUM_STAGES ? "," : "");
+	}
+	fprintf(fp, "  }\n}\n");
+}
+
+void stats_dump(struct stats *s, int final){
+	struct stats_totals *t = malloc(sizeof(*t));
+	if(t == NULL){
+		return;
+	}
+	stats_snapshot(s, t);
+
+	pthread_mutex_lock(&s->dump_lock);
+	if(s->path == NULL){
+		write_json(s, stderr, t, final);
+		fflush(stderr);
+	}
+	else{
+		/* Write beside the file and rename over it, so a reader never sees half a snapshot */
+		char tmp[MAX_PATH];
+		snprintf(tmp, sizeof(tmp), "%s.tmp", s->path);
+		FILE *fp = fopen(tmp, "w");
+		if(fp == NULL){
+			perror("Error writing statistics");
+		}
+		else{
+			write_json(s, fp, t, final);
+			if(fclose(fp) != 0 || rename(tmp, s->path) != 0){
+				perror("Error writing statistics");
+			}
+		}
+	}
+	pthread_mutex_unlock(&s->dump_lock);
+	free(t);
+}
@@ -0,0 +1,106 @@
+/*
+ * File: stats.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains declarations of the run statistics: a latency
+ *      histogram per pipeline stage and a few counters. Every thread
+ *      attaches once and then records into its own histograms through
+ *      a thread-local pointer, so instrumented code in any module can
+ *      record without being handed anything and threads never share a
+ *      cache line. The histograms are merged when they are reported:
+ *      as JSON at exit, and as a live snapshot whenever the process
+ *      gets SIGUSR1.
+ *
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "hist.h"
+
+/* Stages with a histogram, all in ns
+- STAT_READ: A requester filling one batch from its input
+- STAT_ENQUEUE_WAIT: A requester publishing one batch to a full buffer
+- STAT_DEQUEUE_WAIT: A resolver waiting for its next batch
+- STAT_LOOKUP: One lookup that missed the cache
+- STAT_WRITE: One write to <resolver log>
+- STAT_NAME: A name, from its publish to its answer */
+enum stat_stage{
+	STAT_READ,
+	STAT_ENQUEUE_WAIT,
+	STAT_DEQUEUE_WAIT,
+	STAT_LOOKUP,
+	STAT_WRITE,
+	STAT_NAME,
+	STAT_NUM_STAGES
+};
+
+/* Counters
+- STAT_PRODUCED: Names published by the requesters
+- STAT_CONSUMED: Names taken by the resolvers
+- STAT_FAILURES: Lookups that failed
+- STAT_WAKEUPS: Returns from a condition variable wait
+- STAT_HEDGES: Duplicate requests sent for lookups slower than the hedge percentile
+- STAT_TIMEOUTS: Lookups given up at their deadline
+- STAT_INVALID: Names answered without a lookup because they are not hostnames
+- STAT_ZONE_HITS: Names answered from the local zone database */
+enum stat_counter{
+	STAT_PRODUCED,
+	STAT_CONSUMED,
+	STAT_FAILURES,
+	STAT_WAKEUPS,
+	STAT_HEDGES,
+	STAT_TIMEOUTS,
+	STAT_INVALID,
+	STAT_ZONE_HITS,
+	STAT_NUM_COUNTERS
+};
+
+struct stats;
+
+/* Everything recorded, summed over the threads */
+struct stats_totals{
+	struct hist hists[STAT_NUM_STAGES];
+	uint64_t counters[STAT_NUM_COUNTERS];
+};
+
+/* Create the statistics of a run and start listening for SIGUSR1.
+ * Call before creating any thread: SIGUSR1 is blocked in the caller,
+ * so threads created afterwards inherit the mask and only the
+ * listener takes the signal. Snapshots go to path, or stderr if path
+ * is NULL. Returns NULL on failure
+ */
+struct stats *stats_create(const char *path);
+
+/* Stop listening, restore the signal mask, and free the statistics.
+ * Every thread that attached must have exited
+ */
+void stats_destroy(struct stats *s);
+
+/* Attach the calling thread under role ("requester", "resolver", ...);
+ * until it detaches, what it records goes to s. A thread that never
+ * attached records nothing
+ */
+void stats_attach(struct stats *s, const char *role);
+
+/* Detach the calling thread; what it recorded stays in the totals */
+void stats_detach(void);
+
+/* Record one value of a stage for the calling thread */
+void stats_record(enum stat_stage stage, uint64_t ns);
+
+/* Add n to a counter of the calling thread */
+void stats_count(enum stat_counter counter, uint64_t n);
+
+/* Sum what every thread has recorded so far; safe while they run */
+void stats_snapshot(struct stats *s, struct stats_totals *t);
+
+/* Write a snapshot as JSON to the path given to stats_create(), or to
+ * stderr. final tells a reader whether the run is over
+ */
+void stats_dump(struct stats *s, int final);
+
+#endif
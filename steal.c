@@ -0,0 +1,125 @@
+/*
+ * File: steal.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the work-stealing scheduler. The deque is the
+ *      Chase-Lev deque with the C11 orderings of Le et al., "Correct
+ *      and Efficient Work-Stealing for Weak Memory Models" (2013).
+ *
+ */
+
+#include <stdlib.h>
+
+#include "steal.h"
+
+/* Define macros:
+- STEAL_EMPTY / STEAL_ABORT: A steal found nothing / lost a race and may retry */
+#define STEAL_EMPTY -1
+#define STEAL_ABORT 1
+
+/* Owner side: take the item at the bottom */
+static int deque_pop(struct deque *d, int *item){
+	long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+	atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+	int found = 0;
+
+	if(t <= b){
+		*item = d->items[b % d->capacity];
+		found = 1;
+
+		/* Last item; race the thieves for it */
+		if(t == b){
+			if(!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+				memory_order_seq_cst, memory_order_relaxed)){
+				found = 0;
+			}
+			atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+		}
+	}
+	else{
+		atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+	}
+	return found ? 0 : STEAL_EMPTY;
+}
+
+/* Thief side: take the item at the top */
+static int deque_steal(struct deque *d, int *item){
+	long t = atomic_load_explicit(&d->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+
+	if(t < b){
+		*item = d->items[t % d->capacity];
+		if(!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1,
+			memory_order_seq_cst, memory_order_relaxed)){
+			return STEAL_ABORT;
+		}
+		return 0;
+	}
+	return STEAL_EMPTY;
+}
+
+int work_init(struct work *w, int num_deques, int num_items){
+	w->num_deques = num_deques;
+	w->deques = aligned_alloc(CACHE_LINE, sizeof(*w->deques) * (num_deques > 0 ? num_deques : 1));
+	if(w->deques == NULL){
+		return -1;
+	}
+
+	for(int i = 0; i < num_deques; i++){
+		struct deque *d = &w->deques[i];
+		int first = (int)((long)num_items * i / num_deques);
+		int last = (int)((long)num_items * (i + 1) / num_deques);
+
+		d->capacity = last - first > 0 ? last - first : 1;
+		d->items = malloc(sizeof(*d->items) * d->capacity);
+		if(d->items == NULL){
+			w->num_deques = i;
+			work_destroy(w);
+			return -1;
+		}
+
+		/* Push back to front so the owner works through its run front to back */
+		for(int j = 0; j < last - first; j++){
+			d->items[j] = last - 1 - j;
+		}
+		atomic_init(&d->top, 0);
+		atomic_init(&d->bottom, last - first);
+	}
+	return 0;
+}
+
+void work_destroy(struct work *w){
+	for(int i = 0; i < w->num_deques; i++){
+		free(w->deques[i].items);
+	}
+	free(w->deques);
+	w->deques = NULL;
+}
+
+int work_next(struct work *w, int self, int *item, int *stolen){
+	int retry;
+
+	*stolen = 0;
+	if(deque_pop(&w->deques[self], item) == 0){
+		return 0;
+	}
+
+	/* Own deque is empty; go round the others until a steal succeeds or all are empty */
+	*stolen = 1;
+	do{
+		retry = 0;
+		for(int i = 1; i < w->num_deques; i++){
+			int r = deque_steal(&w->deques[(self + i) % w->num_deques], item);
+			if(r == 0){
+				return 0;
+			}
+			if(r == STEAL_ABORT){
+				retry = 1;
+			}
+		}
+	}while(retry);
+	return -1;
+}
@@ -0,0 +1,54 @@
+/*
+ * File: steal.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains declarations of the work-stealing scheduler
+ *      that hands file chunks to requester threads. Every requester
+ *      owns a deque of chunk indexes; it works through its own deque
+ *      and steals from the other end of someone else's once its own
+ *      is empty.
+ *
+ */
+
+#ifndef STEAL_H
+#define STEAL_H
+
+#include <stdatomic.h>
+
+#include "queue.h"
+
+/* A Chase-Lev deque of fixed capacity. Items are only pushed before the
+ * requesters start, so the array never grows
+- top: Next item a thief will steal
+- bottom: One past the item the owner will take next
+- items: The item array */
+struct deque{
+	_Alignas(CACHE_LINE) atomic_long top;
+	_Alignas(CACHE_LINE) atomic_long bottom;
+	_Alignas(CACHE_LINE) int *items;
+	long capacity;
+};
+
+/* The scheduler
+- num_deques: Num of requesters, one deque each
+- deques: The deques */
+struct work{
+	int num_deques;
+	struct deque *deques;
+};
+
+/* Split items 0..num_items-1 into num_deques contiguous runs, one per deque.
+ * Returns 0 on success, -1 if out of memory
+ */
+int work_init(struct work *w, int num_deques, int num_items);
+
+/* Free the deques */
+void work_destroy(struct work *w);
+
+/* Take the next item for requester self: its own next item, or one
+ * stolen from another requester (then *stolen is set to 1).
+ * Returns 0 on success, -1 once every deque is empty
+ */
+int work_next(struct work *w, int self, int *item, int *stolen);
+
+#endif
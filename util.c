@@ -12,74 +12,187 @@
  *  
  */
 
+#include <ctype.h>
+#include <time.h>
+
 #include "util.h"
 
 int dnslookup(const char* hostname, char* firstIPstr, int maxSize){
 
     /* Local vars */
+    struct addr_list addrs;
+
+    /* Lookup Hostname */
+    if(dnslookup_all(hostname, &addrs) != UTIL_SUCCESS){
+	return UTIL_FAILURE;
+    }
+
+    /* Save First IP Address; only it is converted to a string */
+    addrs.num = 1;
+    format_addrs(&addrs, firstIPstr, maxSize);
+
+    return UTIL_SUCCESS;
+}
+
+int dnslookup_all(const char* hostname, struct addr_list* addrs){
+
+    /* Local vars */
+    struct addrinfo hints;
     struct addrinfo* headresult = NULL;
     struct addrinfo* result = NULL;
-    struct sockaddr_in* ipv4sock = NULL;
-    struct in_addr* ipv4addr = NULL;
-    char ipv4str[INET_ADDRSTRLEN];
-    char ipstr[INET6_ADDRSTRLEN];
+    struct ip_addr addr;
     int addrError = 0;
+    int i;
 
     /* DEBUG: Print Hostname*/
 #ifdef UTIL_DEBUG
     fprintf(stderr, "%s\n", hostname);
 #endif
-   
-    /* Lookup Hostname */
-    addrError = getaddrinfo(hostname, NULL, NULL, &headresult);
+
+    addrs->num = 0;
+    addrs->timed_out = 0;
+
+    /* Lookup Hostname; asking for one socket type lists each address
+     * once instead of once per protocol */
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrError = getaddrinfo(hostname, NULL, &hints, &headresult);
     if(addrError){
 	fprintf(stderr, "Error looking up Address: %s\n",
 		gai_strerror(addrError));
 	return UTIL_FAILURE;
     }
-    /* Loop Through result Linked List */
-    for(result=headresult; result != NULL; result = result->ai_next){
-	/* Extract IP Address and Convert to String */
+    /* Loop Through result Linked List, copying each address as is */
+    for(result=headresult; result != NULL && addrs->num < UTIL_MAX_ADDRS;
+	result = result->ai_next){
+	memset(&addr, 0, sizeof(addr));
 	if(result->ai_addr->sa_family == AF_INET){
 	    /* IPv4 Address Handling */
-	    ipv4sock = (struct sockaddr_in*)(result->ai_addr);
-	    ipv4addr = &(ipv4sock->sin_addr);
-	    if(!inet_ntop(result->ai_family, ipv4addr,
-			  ipv4str, sizeof(ipv4str))){
-		perror("Error Converting IP to String");
-		return UTIL_FAILURE;
-	    }
-#ifdef UTIL_DEBUG
-	    fprintf(stdout, "%s\n", ipv4str);
-#endif
-	    strncpy(ipstr, ipv4str, sizeof(ipstr));
-	    ipstr[sizeof(ipstr)-1] = '\0';
+	    addr.family = AF_INET;
+	    addr.v4 = ((struct sockaddr_in*)result->ai_addr)->sin_addr;
 	}
 	else if(result->ai_addr->sa_family == AF_INET6){
-	    /* IPv6 Handling */
-#ifdef UTIL_DEBUG
-	    fprintf(stdout, "IPv6 Address: Not Handled\n");
-#endif
-	    strncpy(ipstr, "UNHANDELED", sizeof(ipstr));
-	    ipstr[sizeof(ipstr)-1] = '\0';
+	    /* IPv6 Address Handling */
+	    addr.family = AF_INET6;
+	    addr.v6 = ((struct sockaddr_in6*)result->ai_addr)->sin6_addr;
 	}
 	else{
 	    /* Unhandlded Protocol Handling */
 #ifdef UTIL_DEBUG
 	    fprintf(stdout, "Unknown Protocol: Not Handled\n");
 #endif
-	    strncpy(ipstr, "UNHANDELED", sizeof(ipstr));
-	    ipstr[sizeof(ipstr)-1] = '\0';
+	    continue;
 	}
-	/* Save First IP Address */
-	if(result==headresult){
-	    strncpy(firstIPstr, ipstr, maxSize);
-	    firstIPstr[maxSize-1] = '\0';
+	/* Skip Duplicates */
+	for(i = 0; i < addrs->num; i++){
+	    if(memcmp(&addrs->addrs[i], &addr, sizeof(addr)) == 0){
+		break;
+	    }
+	}
+	if(i == addrs->num){
+	    addrs->addrs[addrs->num++] = addr;
 	}
     }
 
     /* Cleanup */
     freeaddrinfo(headresult);
 
+    return addrs->num > 0 ? UTIL_SUCCESS : UTIL_FAILURE;
+}
+
+int format_addrs(const struct addr_list* addrs, char* str, int maxSize){
+
+    /* Local vars */
+    const struct ip_addr* addr = NULL;
+    int len = 0;
+
+    if(maxSize <= 0){
+	return 0;
+    }
+    str[0] = '\0';
+    if(addrs->timed_out){
+	snprintf(str, maxSize, "%s", UTIL_TIMEOUT_MARKER);
+	return strlen(str);
+    }
+    for(int i = 0; i < addrs->num; i++){
+	/* Stop at the first address that might not fit */
+	if(maxSize - len < (i > 0) + INET6_ADDRSTRLEN){
+	    break;
+	}
+	if(i > 0){
+	    str[len++] = ',';
+	}
+	addr = &addrs->addrs[i];
+	if(!inet_ntop(addr->family, addr->family == AF_INET6 ?
+		      (const void*)&addr->v6 : (const void*)&addr->v4,
+		      str + len, maxSize - len)){
+	    perror("Error Converting IP to String");
+	    str[len - (i > 0)] = '\0';
+	    return len - (i > 0);
+	}
+	len += strlen(str + len);
+    }
+    return len;
+}
+
+static int dns_init(void** state, const char* options){
+
+    /* getaddrinfo() takes no options and keeps no state */
+    if(options != NULL){
+	fprintf(stderr, "The dns backend takes no options\n");
+	return UTIL_FAILURE;
+    }
+    *state = NULL;
     return UTIL_SUCCESS;
 }
+
+static int dns_resolve(void* state, const char* hostname, struct addr_list* addrs){
+    (void)state;
+    return dnslookup_all(hostname, addrs);
+}
+
+static unsigned long long now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void dns_resolve_batch(void* state, const char** hostnames, struct addr_list** addrs,
+			      int* status, unsigned long long* ns, int n){
+
+    /* getaddrinfo() blocks, so a batch is just one name after another */
+    unsigned long long start = now_ns();
+    for(int i = 0; i < n; i++){
+	status[i] = dns_resolve(state, hostnames[i], addrs[i]);
+	if(status[i] != UTIL_SUCCESS){
+	    addrs[i]->num = 0;
+	}
+	unsigned long long end = now_ns();
+	ns[i] = end - start;
+	start = end;
+    }
+}
+
+static void dns_shutdown(void* state){
+    (void)state;
+}
+
+const struct resolver_backend dns_backend = {
+    "dns",
+    dns_init,
+    dns_resolve,
+    dns_resolve_batch,
+    dns_shutdown
+};
+
+uint64_t hash_name(const char* hostname){
+
+    /* FNV-1a over the lowercased name */
+    uint64_t h = 14695981039346656037ULL;
+    for(; *hostname; hostname++){
+	h ^= (unsigned char)tolower((unsigned char)*hostname);
+	h *= 1099511628211ULL;
+    }
+    return h;
+}
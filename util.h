@@ -27,9 +27,42 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <stdint.h>
 
 #define UTIL_FAILURE -1
 #define UTIL_SUCCESS 0
+#define UTIL_TIMEOUT -2
+
+/* What a name that got no answer before its deadline is written as */
+#define UTIL_TIMEOUT_MARKER "TIMEOUT"
+
+/* Most addresses kept for one hostname */
+#define UTIL_MAX_ADDRS 8
+
+/* Longest text form of an addr_list: the addresses, comma-separated */
+#define UTIL_ADDRS_STRLEN (UTIL_MAX_ADDRS * (INET6_ADDRSTRLEN + 1))
+
+/* One address of a host, in network byte order
+ * - family: AF_INET or AF_INET6
+ * - v4/v6: The address, by family
+ */
+struct ip_addr{
+    uint8_t family;
+    union{
+	struct in_addr v4;
+	struct in6_addr v6;
+    };
+};
+
+/* Every address of a host, in the order the resolver gave them;
+ * num is 0 for a failed lookup, and timed_out is 1 if the lookup
+ * was given up at its deadline
+ */
+struct addr_list{
+    int num;
+    int timed_out;
+    struct ip_addr addrs[UTIL_MAX_ADDRS];
+};
 
 /* Fuction to return the first IP address found
  * for hostname. IP address returned as string
@@ -39,4 +72,48 @@ int dnslookup(const char* hostname,
 	      char* firstIPstr,
 	      int maxSize);
 
+/* Function to return every IPv4 and IPv6 address found
+ * for hostname, up to UTIL_MAX_ADDRS, in binary form.
+ * Nothing is formatted as text
+ */
+int dnslookup_all(const char* hostname,
+		  struct addr_list* addrs);
+
+/* Function to write the addresses of addrs as text,
+ * comma-separated, into str of size maxSize, or
+ * UTIL_TIMEOUT_MARKER if the lookup timed out.
+ * Returns the length written
+ */
+int format_addrs(const struct addr_list* addrs,
+		 char* str,
+		 int maxSize);
+
+/* A resolver backend; the resolvers look names up only through one
+ * - name: What the backend is called in messages
+ * - init: Set up the backend from options (may be NULL) and store its
+ *   state in *state; returns UTIL_SUCCESS or UTIL_FAILURE
+ * - resolve: Like dnslookup_all(); called by many threads at once
+ * - resolve_batch: Resolve n hostnames, writing each one's addresses
+ *   (none on failure) into addrs[i], UTIL_SUCCESS or UTIL_FAILURE
+ *   into status[i], and the time its own lookup took, in ns, into
+ *   ns[i]; a backend with deadlines may also give UTIL_TIMEOUT
+ * - shutdown: Free the state
+ */
+struct resolver_backend{
+    const char* name;
+    int (*init)(void** state, const char* options);
+    int (*resolve)(void* state, const char* hostname, struct addr_list* addrs);
+    void (*resolve_batch)(void* state, const char** hostnames, struct addr_list** addrs,
+			  int* status, unsigned long long* ns, int n);
+    void (*shutdown)(void* state);
+};
+
+/* The backend that resolves with dnslookup() */
+extern const struct resolver_backend dns_backend;
+
+/* Function to hash a hostname, ignoring case.
+ * Used by the tables keyed by hostname
+ */
+uint64_t hash_name(const char* hostname);
+
 #endif
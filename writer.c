@@ -0,0 +1,768 @@
+/*
+ * File: writer.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the log-writer stage. Resolvers only take the
+ *      writer's lock to hand over a full buffer; the writer thread
+ *      takes the whole queue at once and writes it with as few
+ *      writev() calls as it can.
+ *
+ *      In ordered mode each buffer also records where its lines came
+ *      from. The writer files every line under its chunk, and once
+ *      the oldest unwritten chunk has all its lines it writes them in
+ *      order and recycles the buffers they pointed into. Producers
+ *      wait in writer_wait_window() so that at most <window> chunks
+ *      are ever held back.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "util.h"
+#include "queue.h"
+#include "stats.h"
+#include "results.h"
+#include "writer.h"
+
+/* Define macros:
+- LINE_MAX_LENGTH: Longest "name,addr,...\n" line; longer than any binary record
+- MAX_IOV: Num of iovecs handed to one writev() call; IOV_MAX on Linux
+- RECS_PER_BUF: Num of line positions a buffer can record */
+#define LINE_MAX_LENGTH (MAX_NAME_LENGTH + UTIL_ADDRS_STRLEN + 2)
+#define MAX_IOV 1024
+#define RECS_PER_BUF (WRITER_BUF_SIZE / 16)
+
+_Static_assert(RESULTS_RECORD_MAX <= LINE_MAX_LENGTH, "binary records must fit where a line does");
+
+/* Where a line came from and where it sits in its buffer */
+struct wrecord{
+	uint32_t chunk;
+	uint32_t line;
+	uint32_t off;
+	uint32_t len;
+};
+
+/* A resolver's buffer
+- next: Link in the writer's queue or free list
+- data/len: Formatted lines
+- recs/num_recs: Position of every line; ordered mode only
+- refs: Lines the writer has not written yet; ordered mode only */
+struct wbuf{
+	struct wbuf *next;
+	char data[WRITER_BUF_SIZE];
+	size_t len;
+	struct wrecord recs[RECS_PER_BUF];
+	size_t num_recs;
+	size_t refs;
+};
+
+/* A line held back by the ordered writer */
+struct line_ref{
+	struct wbuf *buf;
+	uint32_t off;
+	uint32_t len;
+};
+
+/* Lines of one chunk seen so far
+- expected: Num of lines in the chunk; -1 until its producer is done
+- received: Num of lines filed
+- lines: Indexed by line number */
+struct chunk_out{
+	atomic_long expected;
+	uint32_t received;
+	uint32_t cap;
+	struct line_ref *lines;
+};
+
+struct writer{
+	int fd;
+	enum writer_format format;
+	int window;
+	pthread_t thread;
+	struct stats *stats;
+
+	/* Guard the handoff between resolvers/producers and the writer */
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	pthread_cond_t space;
+	struct wbuf *queue_head;
+	struct wbuf *queue_tail;
+	int queued;
+	struct wbuf *free_list;
+	int kick;
+	int done;
+	uint32_t head;
+
+	/* Owned by the writer thread, but for the fds of free session slots */
+	struct chunk_out *chunks;
+	uint32_t num_chunks;
+	struct session_out *sessions;
+	uint32_t num_sessions;
+	uint32_t num_held;
+	int resume;
+	struct iovec iov[MAX_IOV];
+	int num_iov;
+	atomic_uint_fast64_t bytes;
+	atomic_uint_fast64_t writes;
+};
+
+/* A session of a session writer
+- fd: The client's socket; -1 for a free slot
+- expected: Num of lines of the session; -1 until its requester is done
+- written: Num of lines written, or dropped, so far
+- failed: Set once a write to the client failed, or it fell too far behind; its other lines are dropped
+- held/held_len/held_cap: Bytes the client's socket had no room for yet
+- stalled: When the client last read any of them, in ns
+- paused: Set while more than WRITER_SESSION_PAUSE bytes are held; the requester waits for it to clear */
+struct session_out{
+	int fd;
+	atomic_long expected;
+	long written;
+	int failed;
+	atomic_int paused;
+	char *held;
+	size_t held_len;
+	size_t held_cap;
+	unsigned long long stalled;
+};
+
+/* Write out the gathered iovecs, retrying short writes */
+static void flush_iov(struct writer *w){
+	struct iovec *iov = w->iov;
+	int n = w->num_iov;
+
+	while(n > 0){
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		ssize_t wrote = writev(w->fd, iov, n);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		stats_record(STAT_WRITE, (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec);
+		if(wrote < 0){
+			if(errno == EINTR){
+				continue;
+			}
+
+			perror("Error writing to resolver log");
+			break;
+		}
+		atomic_fetch_add_explicit(&w->writes, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&w->bytes, wrote, memory_order_relaxed);
+		while(n > 0 && (size_t)wrote >= iov->iov_len){
+			wrote -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if(n > 0){
+			iov->iov_base = (char *)iov->iov_base + wrote;
+			iov->iov_len -= wrote;
+		}
+	}
+	w->num_iov = 0;
+}
+
+static void add_iov(struct writer *w, const char *data, size_t len){
+	/* Lines that sit next to each other in one buffer share an iovec */
+	if(w->num_iov > 0){
+		struct iovec *last = &w->iov[w->num_iov - 1];
+		if((const char *)last->iov_base + last->iov_len == data){
+			last->iov_len += len;
+			return;
+		}
+	}
+	if(w->num_iov == MAX_IOV){
+		flush_iov(w);
+	}
+	w->iov[w->num_iov].iov_base = (void *)data;
+	w->iov[w->num_iov].iov_len = len;
+	w->num_iov++;
+}
+
+static void recycle(struct writer *w, struct wbuf *b){
+	pthread_mutex_lock(&w->lock);
+	b->next = w->free_list;
+	w->free_list = b;
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* File every line of b under its chunk */
+static void file_lines(struct writer *w, struct wbuf *b){
+	b->refs = b->num_recs;
+	for(size_t i = 0; i < b->num_recs; i++){
+		struct wrecord *r = &b->recs[i];
+		struct chunk_out *c = &w->chunks[r->chunk];
+		if(r->line >= c->cap){
+			uint32_t cap = c->cap ? c->cap : 1024;
+			while(cap <= r->line){
+				cap *= 2;
+			}
+			struct line_ref *lines = realloc(c->lines, sizeof(*lines) * cap);
+			if(lines == NULL){
+				perror("Error allocating reorder window");
+				exit(EXIT_FAILURE);
+			}
+			memset(lines + c->cap, 0, sizeof(*lines) * (cap - c->cap));
+			c->lines = lines;
+			c->cap = cap;
+		}
+		c->lines[r->line].buf = b;
+		c->lines[r->line].off = r->off;
+		c->lines[r->line].len = r->len;
+		c->received++;
+	}
+}
+
+/* Write the first num_lines lines of chunk c in order, skipping any
+ * that never arrived
+ */
+static void write_chunk(struct writer *w, struct chunk_out *c, uint32_t num_lines){
+	for(uint32_t i = 0; i < num_lines && i < c->cap; i++){
+		struct line_ref *l = &c->lines[i];
+		if(l->buf != NULL){
+			add_iov(w, l->buf->data + l->off, l->len);
+		}
+	}
+	flush_iov(w);
+
+	/* Only now that they are on disk can the buffers be reused */
+	for(uint32_t i = 0; i < num_lines && i < c->cap; i++){
+		struct wbuf *b = c->lines[i].buf;
+		if(b != NULL && --b->refs == 0){
+			recycle(w, b);
+		}
+	}
+	free(c->lines);
+	c->lines = NULL;
+	c->cap = 0;
+}
+
+/* Write every complete chunk at the head of the window. With force
+ * set, write whatever every remaining chunk holds
+ */
+static void write_ready_chunks(struct writer *w, int force){
+	uint32_t head = w->head;
+
+	while(head < w->num_chunks){
+		struct chunk_out *c = &w->chunks[head];
+		long expected = atomic_load(&c->expected);
+		if(!force && (expected < 0 || c->received < (uint32_t)expected)){
+			break;
+		}
+		write_chunk(w, c, force ? c->cap : (uint32_t)expected);
+		head++;
+	}
+
+	if(head != w->head){
+		pthread_mutex_lock(&w->lock);
+		w->head = head;
+		pthread_cond_broadcast(&w->space);
+		pthread_mutex_unlock(&w->lock);
+	}
+}
+
+static unsigned long long now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Let a paused session's requester read again; it is woken once the writer is done with the sessions */
+static void resume_session(struct writer *w, struct session_out *s){
+	if(atomic_load_explicit(&s->paused, memory_order_relaxed)){
+		atomic_store(&s->paused, 0);
+		w->resume = 1;
+	}
+}
+
+/* Drop the rest of a session's lines; a client that hung up or fell behind is not worth a message */
+static void drop_session(struct writer *w, struct session_out *s){
+	if(s->held_len > 0){
+		w->num_held--;
+	}
+	s->failed = 1;
+	s->held_len = 0;
+	resume_session(w, s);
+}
+
+/* Send as much of data as the client's socket takes without blocking. Returns the num of bytes sent, or -1
+  if the session was dropped */
+static ssize_t send_session(struct writer *w, struct session_out *s, const char *data, size_t len){
+	struct timespec start, end;
+	ssize_t sent;
+
+	do{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		sent = send(s->fd, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+	}while(sent < 0 && errno == EINTR);
+	stats_record(STAT_WRITE, (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec);
+	if(sent < 0){
+		if(errno == EAGAIN || errno == EWOULDBLOCK){
+			return 0;
+		}
+		drop_session(w, s);
+		return -1;
+	}
+	atomic_fetch_add_explicit(&w->writes, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&w->bytes, sent, memory_order_relaxed);
+	return sent;
+}
+
+/* Send a run of lines to a session, after anything held for it, and hold what does not fit */
+static void send_lines(struct writer *w, struct session_out *s, const char *data, size_t len){
+	ssize_t sent = 0;
+
+	if(s->held_len == 0 && (sent = send_session(w, s, data, len)) < 0){
+		return;
+	}
+	len -= sent;
+	if(len == 0){
+		return;
+	}
+	if(s->held_len + len > WRITER_SESSION_HELD){
+		drop_session(w, s);
+		return;
+	}
+	if(s->held_len + len > s->held_cap){
+		size_t cap = s->held_cap ? s->held_cap : WRITER_BUF_SIZE;
+		while(cap < s->held_len + len){
+			cap *= 2;
+		}
+		char *held = realloc(s->held, cap);
+		if(held == NULL){
+			drop_session(w, s);
+			return;
+		}
+		s->held = held;
+		s->held_cap = cap;
+	}
+	if(s->held_len == 0){
+		s->stalled = now_ns();
+		w->num_held++;
+	}
+	memcpy(s->held + s->held_len, data + sent, len);
+	s->held_len += len;
+	if(s->held_len > WRITER_SESSION_PAUSE){
+		atomic_store(&s->paused, 1);
+	}
+}
+
+/* Retry the bytes held for every session; drop a session whose client read none of them for too long */
+static void send_held(struct writer *w){
+	unsigned long long now = now_ns();
+
+	for(uint32_t i = 0; i < w->num_sessions && w->num_held > 0; i++){
+		struct session_out *s = &w->sessions[i];
+		if(s->held_len == 0){
+			continue;
+		}
+		ssize_t sent = send_session(w, s, s->held, s->held_len);
+		if(sent > 0){
+			memmove(s->held, s->held + sent, s->held_len - sent);
+			s->held_len -= sent;
+			s->stalled = now;
+			if(s->held_len == 0){
+				w->num_held--;
+			}
+			if(s->held_len <= WRITER_SESSION_PAUSE){
+				resume_session(w, s);
+			}
+		}
+		else if(sent == 0 && now - s->stalled > WRITER_SESSION_STALL_MS * 1000000ULL){
+			drop_session(w, s);
+		}
+	}
+}
+
+/* Send every line of b to its session; a run of lines of one session sits in one piece of b */
+static void write_sessions(struct writer *w, struct wbuf *b){
+	for(size_t i = 0; i < b->num_recs; ){
+		struct session_out *s = &w->sessions[b->recs[i].chunk];
+		size_t end = i;
+		for(; end < b->num_recs && b->recs[end].chunk == b->recs[i].chunk; end++){
+			s->written++;
+		}
+		if(!s->failed){
+			struct wrecord *last = &b->recs[end - 1];
+			send_lines(w, s, b->data + b->recs[i].off, last->off + last->len - b->recs[i].off);
+		}
+		i = end;
+	}
+}
+
+/* Close every session whose lines are all out, and free its slot */
+static void end_sessions(struct writer *w){
+	int ended = 0;
+
+	/* Requesters take free slots under the lock */
+	pthread_mutex_lock(&w->lock);
+	for(uint32_t i = 0; i < w->num_sessions; i++){
+		struct session_out *s = &w->sessions[i];
+		if(s->fd >= 0 && s->written == atomic_load(&s->expected) && s->held_len == 0){
+			close(s->fd);
+			s->fd = -1;
+			free(s->held);
+			s->held = NULL;
+			s->held_cap = 0;
+			ended = 1;
+		}
+	}
+	if(ended || w->resume){
+		pthread_cond_broadcast(&w->space);
+	}
+	w->resume = 0;
+	pthread_mutex_unlock(&w->lock);
+}
+
+static void *writer_main(void *arg){
+	struct writer *w = arg;
+
+	if(w->stats != NULL){
+		stats_attach(w->stats, "writer");
+	}
+	pthread_mutex_lock(&w->lock);
+	while(1){
+		/* Bytes held for a client are retried every WRITER_SESSION_RETRY_MS, even once the writer is closing */
+		while(w->queue_head == NULL && !w->kick && (!w->done || w->num_held > 0)){
+			if(w->num_held == 0){
+				pthread_cond_wait(&w->ready, &w->lock);
+			}
+			else{
+				unsigned long long until = now_ns() + WRITER_SESSION_RETRY_MS * 1000000ULL;
+				struct timespec ts = {(time_t)(until / 1000000000ULL), (long)(until % 1000000000ULL)};
+				if(pthread_cond_timedwait(&w->ready, &w->lock, &ts) == ETIMEDOUT){
+					break;
+				}
+			}
+			stats_count(STAT_WAKEUPS, 1);
+		}
+		int done = w->done && w->queue_head == NULL;
+		struct wbuf *b = w->queue_head;
+		w->queue_head = w->queue_tail = NULL;
+		w->queued = 0;
+		w->kick = 0;
+		pthread_cond_broadcast(&w->space);
+		pthread_mutex_unlock(&w->lock);
+
+		if(w->sessions != NULL){
+			/* Sessions: retry what is held, send every line to its client, then close the sessions that are complete */
+			send_held(w);
+			while(b != NULL){
+				struct wbuf *next = b->next;
+				write_sessions(w, b);
+				recycle(w, b);
+				b = next;
+			}
+			end_sessions(w);
+		}
+		else if(w->window == 0){
+			/* Unordered: write the buffers as they are, then recycle them */
+			struct wbuf *first = b;
+			for(; b != NULL; b = b->next){
+				add_iov(w, b->data, b->len);
+			}
+			flush_iov(w);
+			while(first != NULL){
+				struct wbuf *next = first->next;
+				recycle(w, first);
+				first = next;
+			}
+		}
+		else{
+			while(b != NULL){
+				struct wbuf *next = b->next;
+				file_lines(w, b);
+				if(b->refs == 0){
+					recycle(w, b);
+				}
+				b = next;
+			}
+			write_ready_chunks(w, done);
+		}
+
+		if(done && w->num_held == 0){
+			break;
+		}
+		pthread_mutex_lock(&w->lock);
+	}
+	if(w->format == WRITER_BINARY && results_finish(w->fd, 0) != 0){
+		perror("Error indexing resolver log");
+	}
+	stats_detach();
+	return NULL;
+}
+
+struct writer *writer_create(int fd, enum writer_format format, int window, uint32_t num_chunks, struct stats *stats){
+	if(format == WRITER_BINARY && results_begin(fd) != 0){
+		return NULL;
+	}
+	struct writer *w = calloc(1, sizeof(*w));
+	if(w == NULL){
+		return NULL;
+	}
+	w->fd = fd;
+	w->format = format;
+	w->stats = stats;
+	w->window = window > 0 ? window : 0;
+	if(w->window > 0){
+		w->num_chunks = num_chunks;
+		w->chunks = calloc(num_chunks ? num_chunks : 1, sizeof(*w->chunks));
+		if(w->chunks == NULL){
+			free(w);
+			return NULL;
+		}
+		for(uint32_t i = 0; i < num_chunks; i++){
+			atomic_init(&w->chunks[i].expected, -1);
+		}
+	}
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->ready, NULL);
+	pthread_cond_init(&w->space, NULL);
+	if(pthread_create(&w->thread, NULL, writer_main, w) != 0){
+		pthread_mutex_destroy(&w->lock);
+		pthread_cond_destroy(&w->ready);
+		pthread_cond_destroy(&w->space);
+		free(w->chunks);
+		free(w);
+		return NULL;
+	}
+	return w;
+}
+
+struct writer *writer_create_sessions(uint32_t max_sessions, struct stats *stats){
+	struct writer *w = calloc(1, sizeof(*w));
+	if(w == NULL){
+		return NULL;
+	}
+	w->fd = -1;
+	w->format = WRITER_TEXT;
+	w->stats = stats;
+	w->num_sessions = max_sessions;
+	w->sessions = calloc(max_sessions ? max_sessions : 1, sizeof(*w->sessions));
+	if(w->sessions == NULL){
+		free(w);
+		return NULL;
+	}
+	for(uint32_t i = 0; i < max_sessions; i++){
+		w->sessions[i].fd = -1;
+		atomic_init(&w->sessions[i].expected, -1);
+		atomic_init(&w->sessions[i].paused, 0);
+	}
+
+	/* The writer waits on ready with a timeout while it holds bytes for a client */
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->ready, &attr);
+	pthread_cond_init(&w->space, NULL);
+	pthread_condattr_destroy(&attr);
+	if(pthread_create(&w->thread, NULL, writer_main, w) != 0){
+		pthread_mutex_destroy(&w->lock);
+		pthread_cond_destroy(&w->ready);
+		pthread_cond_destroy(&w->space);
+		free(w->sessions);
+		free(w);
+		return NULL;
+	}
+	return w;
+}
+
+uint32_t writer_session_open(struct writer *w, int fd){
+	uint32_t i;
+
+	pthread_mutex_lock(&w->lock);
+	while(1){
+		for(i = 0; i < w->num_sessions && w->sessions[i].fd >= 0; i++);
+		if(i < w->num_sessions){
+			break;
+		}
+		pthread_cond_wait(&w->space, &w->lock);
+		stats_count(STAT_WAKEUPS, 1);
+	}
+	w->sessions[i].fd = fd;
+	w->sessions[i].written = 0;
+	w->sessions[i].failed = 0;
+	atomic_store(&w->sessions[i].paused, 0);
+	atomic_store(&w->sessions[i].expected, -1);
+	pthread_mutex_unlock(&w->lock);
+	return i;
+}
+
+void writer_session_wait(struct writer *w, uint32_t session){
+	struct session_out *s = &w->sessions[session];
+
+	if(!atomic_load(&s->paused)){
+		return;
+	}
+	pthread_mutex_lock(&w->lock);
+	while(atomic_load(&s->paused)){
+		pthread_cond_wait(&w->space, &w->lock);
+		stats_count(STAT_WAKEUPS, 1);
+	}
+	pthread_mutex_unlock(&w->lock);
+}
+
+void writer_close(struct writer *w){
+	pthread_mutex_lock(&w->lock);
+	if(w->done){
+		pthread_mutex_unlock(&w->lock);
+		return;
+	}
+	w->done = 1;
+	pthread_cond_signal(&w->ready);
+	pthread_mutex_unlock(&w->lock);
+	pthread_join(w->thread, NULL);
+}
+
+void writer_destroy(struct writer *w){
+	if(w == NULL){
+		return;
+	}
+	writer_close(w);
+
+	while(w->free_list != NULL){
+		struct wbuf *next = w->free_list->next;
+		free(w->free_list);
+		w->free_list = next;
+	}
+	for(uint32_t i = 0; i < w->num_chunks; i++){
+		free(w->chunks[i].lines);
+	}
+	free(w->chunks);
+	for(uint32_t i = 0; i < w->num_sessions; i++){
+		if(w->sessions[i].fd >= 0){
+			close(w->sessions[i].fd);
+		}
+		free(w->sessions[i].held);
+	}
+	free(w->sessions);
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->ready);
+	pthread_cond_destroy(&w->space);
+	free(w);
+}
+
+static struct wbuf *get_buf(struct writer *w){
+	pthread_mutex_lock(&w->lock);
+	struct wbuf *b = w->free_list;
+	if(b != NULL){
+		w->free_list = b->next;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	if(b == NULL){
+		b = malloc(sizeof(*b));
+		if(b == NULL){
+			perror("Error allocating writer buffer");
+			exit(EXIT_FAILURE);
+		}
+	}
+	b->next = NULL;
+	b->len = 0;
+	b->num_recs = 0;
+	b->refs = 0;
+	return b;
+}
+
+void writer_flush(struct writer *w, struct wbuf **b){
+	if(*b == NULL || (*b)->len == 0){
+		return;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	/* An unordered writer that falls behind slows the resolvers down.
+	 * An ordered one never does: the line it is waiting for may be in
+	 * the next buffer this resolver fills */
+	while(w->window == 0 && w->queued >= WRITER_MAX_QUEUED){
+		pthread_cond_wait(&w->space, &w->lock);
+		stats_count(STAT_WAKEUPS, 1);
+	}
+	if(w->queue_tail){
+		w->queue_tail->next = *b;
+	}
+	else{
+		w->queue_head = *b;
+	}
+	w->queue_tail = *b;
+	w->queued++;
+	pthread_cond_signal(&w->ready);
+	pthread_mutex_unlock(&w->lock);
+
+	*b = NULL;
+}
+
+void writer_append(struct writer *w, struct wbuf **b, uint32_t chunk, uint32_t line,
+	const char *name, const struct addr_list *addrs){
+	if(*b != NULL && ((*b)->len + LINE_MAX_LENGTH > WRITER_BUF_SIZE || (*b)->num_recs == RECS_PER_BUF)){
+		writer_flush(w, b);
+	}
+	if(*b == NULL){
+		*b = get_buf(w);
+	}
+
+	struct wbuf *buf = *b;
+	char *out = buf->data + buf->len;
+	size_t len;
+	if(w->format == WRITER_BINARY){
+		len = results_encode(out, name, addrs);
+	}
+	else{
+		size_t name_len = strlen(name);
+		memcpy(out, name, name_len);
+		out[name_len] = ',';
+		len = name_len + 1;
+		len += format_addrs(addrs, out + len, WRITER_BUF_SIZE - buf->len - len);
+		out[len++] = '\n';
+	}
+	if(w->window > 0 || w->sessions != NULL){
+		struct wrecord *r = &buf->recs[buf->num_recs++];
+		r->chunk = chunk;
+		r->line = line;
+		r->off = buf->len;
+		r->len = len;
+	}
+	buf->len += len;
+}
+
+void writer_wait_window(struct writer *w, uint32_t chunk){
+	if(w->window == 0){
+		return;
+	}
+	pthread_mutex_lock(&w->lock);
+	while(chunk >= w->head + (uint32_t)w->window){
+		pthread_cond_wait(&w->space, &w->lock);
+		stats_count(STAT_WAKEUPS, 1);
+	}
+	pthread_mutex_unlock(&w->lock);
+}
+
+void writer_chunk_done(struct writer *w, uint32_t chunk, uint32_t num_lines){
+	if(w->sessions != NULL){
+		atomic_store(&w->sessions[chunk].expected, num_lines);
+	}
+	else if(w->window == 0){
+		return;
+	}
+	else{
+		atomic_store(&w->chunks[chunk].expected, num_lines);
+	}
+	pthread_mutex_lock(&w->lock);
+	w->kick = 1;
+	pthread_cond_signal(&w->ready);
+	pthread_mutex_unlock(&w->lock);
+}
+
+void writer_get_stats(struct writer *w, uint64_t *bytes, uint64_t *writes){
+	*bytes = atomic_load_explicit(&w->bytes, memory_order_relaxed);
+	*writes = atomic_load_explicit(&w->writes, memory_order_relaxed);
+}
@@ -0,0 +1,122 @@
+/*
+ * File: writer.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains declarations of the log-writer stage. Resolvers
+ *      format their "name,addr,..." lines into thread-local buffers and hand
+ *      full buffers to a writer thread, which writes them to
+ *      <resolver log> with large writev() calls. In binary format the
+ *      lines are results.h records, indexed once the writer closes.
+ *
+ *      In unordered mode buffers are written as they arrive. In
+ *      ordered mode every line carries its (chunk, line) position in
+ *      the input and the writer puts lines back into input order,
+ *      holding at most <window> chunks' worth of lines at a time.
+ *
+ *      In session mode (the daemon) there is no <resolver log>: every
+ *      client connection is a session, a line's chunk is its session,
+ *      and the writer sends each line back to its client's socket as
+ *      it arrives. A session ends, and its socket is closed, once all
+ *      the lines its requester reported are out. The writer never
+ *      blocks on a client: what a client's socket has no room for is
+ *      held for it and retried, and its requester stops reading the
+ *      client's names until the client catches up. A client that reads
+ *      nothing for too long loses its session.
+ *
+ */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Define macros:
+- WRITER_BUF_SIZE: Size of a resolver's thread-local buffer
+- WRITER_MAX_QUEUED: Num of full buffers resolvers may queue ahead of an unordered writer
+- WRITER_SESSION_PAUSE: Bytes held for a client past which its requester stops reading its names
+- WRITER_SESSION_HELD: Bytes held for a client past which its session is dropped
+- WRITER_SESSION_STALL_MS: Time a client with bytes held may read nothing before its session is dropped
+- WRITER_SESSION_RETRY_MS: How often the writer retries the bytes held for clients */
+#define WRITER_BUF_SIZE (64 * 1024)
+#define WRITER_MAX_QUEUED 64
+#define WRITER_SESSION_PAUSE (256 * 1024)
+#define WRITER_SESSION_HELD (16 * 1024 * 1024)
+#define WRITER_SESSION_STALL_MS 10000
+#define WRITER_SESSION_RETRY_MS 1
+
+struct writer;
+struct wbuf;
+struct stats;
+struct addr_list;
+
+/* Formats of <resolver log>
+- WRITER_TEXT: "name,addr,addr,..." lines
+- WRITER_BINARY: A results file; see results.h */
+enum writer_format{
+	WRITER_TEXT,
+	WRITER_BINARY
+};
+
+/* Start a writer thread writing to fd in format. If window > 0, lines
+ * are written in input order, and num_chunks is the num of input
+ * chunks. If stats is not NULL, the writer thread records its writes
+ * there. A binary file is emptied first and indexed when the writer
+ * closes. Returns NULL on failure
+ */
+struct writer *writer_create(int fd, enum writer_format format, int window, uint32_t num_chunks, struct stats *stats);
+
+/* Start a writer thread in session mode, with room for max_sessions
+ * sessions at once. Returns NULL on failure
+ */
+struct writer *writer_create_sessions(uint32_t max_sessions, struct stats *stats);
+
+/* Session mode: start a session answering on fd, waiting while every
+ * slot is taken. The writer owns fd from now on and closes it when the
+ * session ends. Returns the session, to be used as the chunk of its
+ * lines
+ */
+uint32_t writer_session_open(struct writer *w, int fd);
+
+/* Session mode: a requester waits here before reading more names for
+ * session, while more than WRITER_SESSION_PAUSE bytes of answers are
+ * held for its client
+ */
+void writer_session_wait(struct writer *w, uint32_t session);
+
+/* Write out everything still buffered and stop the writer thread.
+ * Call once every resolver has flushed its last buffer
+ */
+void writer_close(struct writer *w);
+
+/* Free a writer, closing it first if needed */
+void writer_destroy(struct writer *w);
+
+/* Format "name,addr,addr,..." or its binary record into the
+ * thread-local buffer *b, handing *b to the writer first if it is full.
+ * This is the only place the addresses are turned into text. *b may be
+ * NULL; a buffer is taken as needed
+ */
+void writer_append(struct writer *w, struct wbuf **b, uint32_t chunk, uint32_t line,
+	const char *name, const struct addr_list *addrs);
+
+/* Hand *b to the writer if it holds anything. Resolvers call this when
+ * they run out of names so no line sits in a buffer while they wait
+ */
+void writer_flush(struct writer *w, struct wbuf **b);
+
+/* Ordered mode: a producer waits here before starting chunk, until the
+ * writer has written all chunks before chunk - window + 1
+ */
+void writer_wait_window(struct writer *w, uint32_t chunk);
+
+/* Ordered mode: a producer reports that chunk holds num_lines lines.
+ * Session mode: a requester reports that session chunk has sent its
+ * last name, and num_lines names in all
+ */
+void writer_chunk_done(struct writer *w, uint32_t chunk, uint32_t num_lines);
+
+/* Num of bytes written and num of write calls made */
+void writer_get_stats(struct writer *w, uint64_t *bytes, uint64_t *writes);
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * File: zone-compile.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the compiler of the local zone database
+ *      (multi-lookup -z). It reads a hosts-style file and writes the
+ *      database that multi-lookup maps and asks before the resolver;
+ *      see zone.h for the layout.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "zone.h"
+
+static void usage(char *str){
+	printf("Usage: %s <hosts file> <zone db>\n", str);
+	exit(1);
+}
+
+int main(int argc, char **argv){
+	uint64_t num_names;
+
+	if(argc != 3){
+		usage(argv[0]);
+	}
+	if(zone_compile(argv[1], argv[2], &num_names) != 0){
+		exit(1);
+	}
+	printf("%s: %lu names\n", argv[2], (unsigned long)num_names);
+	return 0;
+}
@@ -0,0 +1,525 @@
+/*
+ * File: zone.c
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains the local zone database. The perfect hash is
+ *      built by hash and displace: names are dealt into buckets by
+ *      their hash, and the buckets, largest first, each get the first
+ *      seed that puts all their names into slots nobody holds yet.
+ *      With ZONE_BUCKET_SIZE names per bucket the search stays short
+ *      even for the last buckets, when few slots are left.
+ *
+ *      A lookup hashes the name once (hash_name()) and derives the
+ *      bucket and the slot from that hash, so it reads one bucket, one
+ *      slot and one record.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "queue.h"
+#include "zone.h"
+
+/* Define macros:
+- HEADER_SIZE: Size of the header; the buckets start here
+- MAX_ZONE_NAME: Longest name a record holds
+- RECORD_MAX: Largest record */
+#define HEADER_SIZE 64
+#define MAX_ZONE_NAME 255
+#define RECORD_MAX (2 + MAX_ZONE_NAME + UTIL_MAX_ADDRS * 17)
+
+/* The header
+- magic: ZONE_MAGIC
+- num_names: Names, and slots
+- num_buckets: Buckets
+- buckets_off/slots_off/records_off: Where each part starts
+- records_len: Size of the records */
+struct zone_header{
+	char magic[8];
+	uint64_t num_names;
+	uint64_t num_buckets;
+	uint64_t buckets_off;
+	uint64_t slots_off;
+	uint64_t records_off;
+	uint64_t records_len;
+	uint64_t reserved;
+};
+
+_Static_assert(sizeof(struct zone_header) == HEADER_SIZE, "zone header must be 64 bytes");
+
+/* A name being compiled
+- hash: hash_name() of the name
+- name: Offset of the lowercased name in the table's names
+- slot: Its slot once its bucket is placed
+- addrs: Its addresses */
+struct zone_entry{
+	uint64_t hash;
+	uint32_t name;
+	uint32_t slot;
+	struct addr_list addrs;
+};
+
+/* An entry sorted by its bucket */
+struct zone_key{
+	uint64_t bucket;
+	uint32_t entry;
+};
+
+/* A bucket being placed; its names are keys first..first+size-1 */
+struct zone_bucket{
+	uint64_t index;
+	uint32_t first;
+	uint32_t size;
+};
+
+/* Compile-time table of names
+- entries/num/cap: The names, in the order first seen
+- names/names_len/names_cap: Their text, each ending on a NUL
+- index/mask: Open-addressing index of the entries by hash; UINT32_MAX is empty */
+struct zone_table{
+	struct zone_entry *entries;
+	uint64_t num;
+	uint64_t cap;
+	char *names;
+	size_t names_len;
+	size_t names_cap;
+	uint32_t *index;
+	uint64_t mask;
+};
+
+/* Mix a 64-bit value so every bit of the result depends on every bit of x */
+static uint64_t mix(uint64_t x){
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+/* Map a mixed value onto 0..n-1 with a multiply rather than a divide */
+static uint64_t reduce(uint64_t x, uint64_t n){
+	return (uint64_t)(((unsigned __int128)x * n) >> 64);
+}
+
+static uint64_t bucket_of(uint64_t hash, uint64_t num_buckets){
+	return reduce(mix(hash), num_buckets);
+}
+
+static uint64_t slot_of(uint64_t hash, uint32_t seed, uint64_t num_names){
+	return reduce(mix(hash + (seed + 1ULL) * 0x9e3779b97f4a7c15ULL), num_names);
+}
+
+/* Keep the index of t at most half full. Returns 0, or -1 if out of memory */
+static int grow_index(struct zone_table *t){
+	uint64_t mask = t->mask ? t->mask * 2 + 1 : 1023;
+	uint32_t *index = malloc((mask + 1) * sizeof(*index));
+
+	if(index == NULL){
+		return -1;
+	}
+	memset(index, 0xff, (mask + 1) * sizeof(*index));
+	for(uint64_t i = 0; i < t->num; i++){
+		uint64_t j = t->entries[i].hash & mask;
+		while(index[j] != UINT32_MAX){
+			j = (j + 1) & mask;
+		}
+		index[j] = i;
+	}
+	free(t->index);
+	t->index = index;
+	t->mask = mask;
+	return 0;
+}
+
+/* Find name in t, adding it if it is new. Returns NULL if out of memory or t is full */
+static struct zone_entry *table_get(struct zone_table *t, const char *name){
+	uint64_t hash = hash_name(name);
+	size_t len = strlen(name) + 1;
+
+	if(((t->num + 1) * 2 > t->mask + 1 && grow_index(t) != 0) || t->num >= UINT32_MAX){
+		return NULL;
+	}
+	uint64_t j = hash & t->mask;
+	for(; t->index[j] != UINT32_MAX; j = (j + 1) & t->mask){
+		struct zone_entry *e = &t->entries[t->index[j]];
+		if(e->hash == hash && strcmp(t->names + e->name, name) == 0){
+			return e;
+		}
+	}
+	if(t->num == t->cap){
+		uint64_t cap = t->cap ? t->cap * 2 : 1024;
+		struct zone_entry *entries = realloc(t->entries, cap * sizeof(*entries));
+		if(entries == NULL){
+			return NULL;
+		}
+		t->entries = entries;
+		t->cap = cap;
+	}
+	if(t->names_len + len > UINT32_MAX){
+		return NULL;
+	}
+	if(t->names_len + len > t->names_cap){
+		size_t cap = t->names_cap ? t->names_cap * 2 : 65536;
+		char *names = realloc(t->names, cap);
+		if(names == NULL){
+			return NULL;
+		}
+		t->names = names;
+		t->names_cap = cap;
+	}
+	struct zone_entry *e = &t->entries[t->num];
+	e->hash = hash;
+	e->name = t->names_len;
+	e->addrs.num = 0;
+	e->addrs.timed_out = 0;
+	memcpy(t->names + t->names_len, name, len);
+	t->names_len += len;
+	t->index[j] = t->num++;
+	return e;
+}
+
+/* Parse the hosts-style file into t. Returns 0, or -1 */
+static int read_hosts(const char *path, struct zone_table *t){
+	FILE *fp = fopen(path, "r");
+	char *line = NULL;
+	size_t n = 0;
+	long num_line = 0;
+	int ret = 0;
+
+	if(fp == NULL){
+		fprintf(stderr, "Error opening %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	while(ret == 0 && getline(&line, &n, fp) != -1){
+		struct ip_addr addr;
+		char *save, *tok;
+		num_line++;
+		line[strcspn(line, "#\r\n")] = 0;
+		if((tok = strtok_r(line, " \t", &save)) == NULL){
+			continue;
+		}
+		memset(&addr, 0, sizeof(addr));
+		if(inet_pton(AF_INET, tok, &addr.v4) == 1){
+			addr.family = AF_INET;
+		}
+		else if(inet_pton(AF_INET6, tok, &addr.v6) == 1){
+			addr.family = AF_INET6;
+		}
+		else{
+			fprintf(stderr, "%s:%ld: %s is not an address; line skipped\n", path, num_line, tok);
+			continue;
+		}
+		while((tok = strtok_r(NULL, " \t", &save)) != NULL){
+			size_t len = strlen(tok);
+			if(len > MAX_ZONE_NAME){
+				fprintf(stderr, "%s:%ld: name too long; skipped\n", path, num_line);
+				continue;
+			}
+			for(size_t i = 0; i < len; i++){
+				tok[i] = tolower((unsigned char)tok[i]);
+			}
+			struct zone_entry *e = table_get(t, tok);
+			if(e == NULL){
+				fprintf(stderr, "Out of memory reading %s\n", path);
+				ret = -1;
+				break;
+			}
+			int dup = 0;
+			for(int i = 0; i < e->addrs.num && !dup; i++){
+				dup = e->addrs.addrs[i].family == addr.family && (addr.family == AF_INET
+					? e->addrs.addrs[i].v4.s_addr == addr.v4.s_addr
+					: memcmp(&e->addrs.addrs[i].v6, &addr.v6, 16) == 0);
+			}
+			if(!dup && e->addrs.num < UTIL_MAX_ADDRS){
+				e->addrs.addrs[e->addrs.num++] = addr;
+			}
+		}
+	}
+	free(line);
+	fclose(fp);
+	return ret;
+}
+
+static int by_bucket(const void *a, const void *b){
+	const struct zone_key *x = a, *y = b;
+	return x->bucket < y->bucket ? -1 : x->bucket > y->bucket;
+}
+
+static int by_size(const void *a, const void *b){
+	const struct zone_bucket *x = a, *y = b;
+	return x->size > y->size ? -1 : x->size < y->size;
+}
+
+/* Find a seed for every bucket and a slot for every name. Returns 0, or -1 if two names share a hash */
+static int place(struct zone_table *t, uint64_t num_buckets, uint32_t *seeds){
+	uint64_t n = t->num;
+	struct zone_key *keys = malloc(n * sizeof(*keys));
+	struct zone_bucket *buckets = calloc(num_buckets, sizeof(*buckets));
+	unsigned char *taken = calloc(n, 1);
+	uint64_t tried[ZONE_BUCKET_SIZE * 8];
+	int ret = -1;
+
+	if(keys == NULL || buckets == NULL || taken == NULL){
+		fprintf(stderr, "Out of memory placing names\n");
+		goto out;
+	}
+
+	/* Sort the names by bucket, then the buckets by size */
+	for(uint64_t i = 0; i < n; i++){
+		keys[i].bucket = bucket_of(t->entries[i].hash, num_buckets);
+		keys[i].entry = i;
+	}
+	qsort(keys, n, sizeof(*keys), by_bucket);
+	for(uint64_t i = 0; i < num_buckets; i++){
+		buckets[i].index = i;
+	}
+	for(uint64_t i = 0; i < n; i++){
+		struct zone_bucket *b = &buckets[keys[i].bucket];
+		if(b->size == 0){
+			b->first = i;
+		}
+		b->size++;
+	}
+	qsort(buckets, num_buckets, sizeof(*buckets), by_size);
+
+	for(uint64_t i = 0; i < num_buckets && buckets[i].size > 0; i++){
+		struct zone_bucket *b = &buckets[i];
+		struct zone_key *k = &keys[b->first];
+		if(b->size > sizeof(tried) / sizeof(tried[0])){
+			fprintf(stderr, "Too many names share a bucket\n");
+			goto out;
+		}
+		for(uint32_t x = 1; x < b->size; x++){
+			for(uint32_t y = 0; y < x; y++){
+				struct zone_entry *ex = &t->entries[k[x].entry], *ey = &t->entries[k[y].entry];
+				if(ex->hash == ey->hash){
+					fprintf(stderr, "%s and %s have the same hash\n", t->names + ex->name, t->names + ey->name);
+					goto out;
+				}
+			}
+		}
+
+		/* The first seed that sends every name of the bucket to a free slot of its own */
+		for(uint32_t seed = 0; ; seed++){
+			uint32_t x;
+			for(x = 0; x < b->size; x++){
+				tried[x] = slot_of(t->entries[k[x].entry].hash, seed, n);
+				int clash = taken[tried[x]];
+				for(uint32_t y = 0; y < x && !clash; y++){
+					clash = tried[y] == tried[x];
+				}
+				if(clash){
+					break;
+				}
+			}
+			if(x == b->size){
+				for(x = 0; x < b->size; x++){
+					taken[tried[x]] = 1;
+					t->entries[k[x].entry].slot = tried[x];
+				}
+				seeds[b->index] = seed;
+				break;
+			}
+		}
+	}
+	ret = 0;
+
+out:
+	free(keys);
+	free(buckets);
+	free(taken);
+	return ret;
+}
+
+static size_t encode(unsigned char *out, const struct zone_table *t, const struct zone_entry *e){
+	const char *name = t->names + e->name;
+	size_t len = strlen(name), pos = 2;
+	out[0] = len;
+	out[1] = e->addrs.num;
+	memcpy(out + pos, name, len);
+	pos += len;
+	for(int i = 0; i < e->addrs.num; i++){
+		const struct ip_addr *a = &e->addrs.addrs[i];
+		out[pos++] = a->family == AF_INET6 ? 6 : 4;
+		memcpy(out + pos, a->family == AF_INET6 ? (const void *)&a->v6 : (const void *)&a->v4, a->family == AF_INET6 ? 16 : 4);
+		pos += a->family == AF_INET6 ? 16 : 4;
+	}
+	return pos;
+}
+
+static int write_all(FILE *fp, const void *data, size_t len){
+	return fwrite(data, 1, len, fp) == len ? 0 : -1;
+}
+
+int zone_compile(const char *hosts_path, const char *db_path, uint64_t *num_names){
+	struct zone_table t = {0};
+	struct zone_header h;
+	uint32_t *seeds = NULL, *slots = NULL, *order = NULL;
+	unsigned char rec[RECORD_MAX];
+	char tmp[4096];
+	FILE *fp = NULL;
+	int ret = -1;
+
+	if(read_hosts(hosts_path, &t) != 0){
+		goto out;
+	}
+	if(t.num == 0){
+		fprintf(stderr, "%s holds no names\n", hosts_path);
+		goto out;
+	}
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, ZONE_MAGIC, sizeof(h.magic));
+	h.num_names = t.num;
+	h.num_buckets = (t.num + ZONE_BUCKET_SIZE - 1) / ZONE_BUCKET_SIZE;
+	seeds = calloc(h.num_buckets, sizeof(*seeds));
+	slots = calloc(h.num_names, sizeof(*slots));
+	order = calloc(h.num_names, sizeof(*order));
+	if(seeds == NULL || slots == NULL || order == NULL){
+		fprintf(stderr, "Out of memory compiling %s\n", hosts_path);
+		goto out;
+	}
+	if(place(&t, h.num_buckets, seeds) != 0){
+		goto out;
+	}
+
+	/* Records go in slot order; the slots are a permutation of the names */
+	for(uint64_t i = 0; i < t.num; i++){
+		order[t.entries[i].slot] = i;
+	}
+	h.buckets_off = HEADER_SIZE;
+	h.slots_off = h.buckets_off + h.num_buckets * sizeof(*seeds);
+	h.records_off = h.slots_off + h.num_names * sizeof(*slots);
+	for(uint64_t i = 0; i < t.num; i++){
+		slots[i] = h.records_len;
+		h.records_len += encode(rec, &t, &t.entries[order[i]]);
+		if(h.records_len > UINT32_MAX){
+			fprintf(stderr, "%s is too large for a zone database\n", hosts_path);
+			goto out;
+		}
+	}
+
+	/* Write a temporary file and rename it over the old database, so a lookup never sees half a file */
+	snprintf(tmp, sizeof(tmp), "%s.tmp", db_path);
+	if((fp = fopen(tmp, "w")) == NULL){
+		fprintf(stderr, "Error opening %s: %s\n", tmp, strerror(errno));
+		goto out;
+	}
+	int bad = write_all(fp, &h, sizeof(h)) || write_all(fp, seeds, h.num_buckets * sizeof(*seeds))
+		|| write_all(fp, slots, h.num_names * sizeof(*slots));
+	for(uint64_t i = 0; i < t.num && !bad; i++){
+		bad = write_all(fp, rec, encode(rec, &t, &t.entries[order[i]]));
+	}
+	if(fflush(fp) != 0 || fsync(fileno(fp)) != 0){
+		bad = 1;
+	}
+	if(fclose(fp) != 0 || bad || rename(tmp, db_path) != 0){
+		fprintf(stderr, "Error writing %s: %s\n", db_path, strerror(errno));
+		unlink(tmp);
+		goto out;
+	}
+	*num_names = t.num;
+	ret = 0;
+
+out:
+	free(seeds);
+	free(slots);
+	free(order);
+	free(t.entries);
+	free(t.names);
+	free(t.index);
+	return ret;
+}
+
+
+int zone_open(const char *path, struct zone_db *db){
+	struct stat st;
+	const struct zone_header *h;
+	int fd = open(path, O_RDONLY);
+
+	memset(db, 0, sizeof(*db));
+	if(fd < 0){
+		return -1;
+	}
+	if(fstat(fd, &st) != 0 || st.st_size < HEADER_SIZE){
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED){
+		return -1;
+	}
+
+	/* Check that every part lies inside the file, so a lookup never has to */
+	h = map;
+	uint64_t size = st.st_size;
+	if(memcmp(h->magic, ZONE_MAGIC, sizeof(h->magic)) != 0 || h->num_names == 0 || h->num_buckets == 0
+		|| h->buckets_off != HEADER_SIZE || h->num_buckets > (size - HEADER_SIZE) / sizeof(uint32_t)
+		|| h->slots_off != h->buckets_off + h->num_buckets * sizeof(uint32_t)
+		|| h->num_names > (size - h->slots_off) / sizeof(uint32_t)
+		|| h->records_off != h->slots_off + h->num_names * sizeof(uint32_t)
+		|| h->records_len > size - h->records_off){
+		munmap(map, st.st_size);
+		errno = EINVAL;
+		return -1;
+	}
+	db->map = map;
+	db->size = st.st_size;
+	db->num_names = h->num_names;
+	db->num_buckets = h->num_buckets;
+	db->buckets = (const uint32_t *)(db->map + h->buckets_off);
+	db->slots = (const uint32_t *)(db->map + h->slots_off);
+	db->records = db->map + h->records_off;
+	db->records_len = h->records_len;
+	return 0;
+}
+
+int zone_find(const struct zone_db *db, const char *name, struct addr_list *addrs){
+	uint64_t hash = hash_name(name);
+	uint32_t seed = db->buckets[bucket_of(hash, db->num_buckets)];
+	uint64_t off = db->slots[slot_of(hash, seed, db->num_names)];
+	size_t len = strlen(name);
+
+	/* Every name lands on some record; it is only the answer if it holds this name */
+	if(off + 2 + len > db->records_len){
+		return -1;
+	}
+	const unsigned char *p = db->records + off;
+	if(p[0] != len || strncasecmp((const char *)p + 2, name, len) != 0){
+		return -1;
+	}
+	uint64_t pos = off + 2 + len;
+	addrs->num = 0;
+	addrs->timed_out = 0;
+	for(int i = 0; i < p[1] && i < UTIL_MAX_ADDRS && pos < db->records_len; i++){
+		struct ip_addr *a = &addrs->addrs[addrs->num];
+		size_t size = db->records[pos] == 6 ? 16 : 4;
+		if(pos + 1 + size > db->records_len){
+			break;
+		}
+		a->family = size == 16 ? AF_INET6 : AF_INET;
+		memcpy(size == 16 ? (void *)&a->v6 : (void *)&a->v4, db->records + pos + 1, size);
+		pos += 1 + size;
+		addrs->num++;
+	}
+	return 0;
+}
+
+void zone_close(struct zone_db *db){
+	if(db->map != NULL){
+		munmap((void *)db->map, db->size);
+	}
+	memset(db, 0, sizeof(*db));
+}
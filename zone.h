@@ -0,0 +1,77 @@
+/*
+ * File: zone.h
+ * Project: CSCI 3753 Programming Assignment 3
+ * Description:
+ * 	This file contains declarations of the local zone database: a
+ *      hosts-style file ("address name [alias...]" per line) compiled
+ *      once by zone-compile into a file that is mapped and answers a
+ *      name with two hash probes and no allocation. Resolvers ask it
+ *      before the cache and the real resolver; only names it does not
+ *      hold go on.
+ *
+ *      The file is laid out to be mapped and queried in place:
+ *
+ *      - A 64-byte header
+ *      - The buckets: a 4-byte seed per bucket
+ *      - The slots: a 4-byte record offset per name
+ *      - The records: a 1-byte name length, a 1-byte num of addresses,
+ *        the lowercased name without a NUL, then per address a 1-byte
+ *        family (4 or 6) and its 4 or 16 bytes in network byte order
+ *
+ *      The buckets and slots make a minimal perfect hash: a name's
+ *      bucket is picked by its hash, and the bucket's seed sends every
+ *      name of the bucket to its own slot, with exactly one slot per
+ *      name. A name that is not in the file also lands on some slot,
+ *      so the record there is compared before it is trusted. Everything
+ *      is in host byte order.
+ *
+ */
+
+#ifndef ZONE_H
+#define ZONE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "util.h"
+
+/* Define macros:
+- ZONE_MAGIC: First 8 bytes of a zone database
+- ZONE_BUCKET_SIZE: Mean num of names per bucket; more makes smaller files and slower compiles */
+#define ZONE_MAGIC "MLZONE1\n"
+#define ZONE_BUCKET_SIZE 4
+
+/* A zone database mapped for lookups */
+struct zone_db{
+	const unsigned char *map;
+	size_t size;
+	uint64_t num_names;
+	uint64_t num_buckets;
+	const uint32_t *buckets;
+	const uint32_t *slots;
+	const unsigned char *records;
+	uint64_t records_len;
+};
+
+/* Compile the hosts-style file at hosts_path into a zone database at
+ * db_path, replacing it in one step. Blank lines and text after "#"
+ * are skipped; a name given more than once keeps every address, up to
+ * UTIL_MAX_ADDRS. Stores the num of names in *num_names. Returns 0, or
+ * -1 with a message on stderr
+ */
+int zone_compile(const char *hosts_path, const char *db_path, uint64_t *num_names);
+
+/* Map the zone database at path. Returns 0, or -1 if it cannot be read
+ * or is not a zone database
+ */
+int zone_open(const char *path, struct zone_db *db);
+
+/* Find name, ignoring case, and copy its addresses into addrs.
+ * Returns 0, or -1 if name is not in the database
+ */
+int zone_find(const struct zone_db *db, const char *name, struct addr_list *addrs);
+
+/* Unmap a zone database */
+void zone_close(struct zone_db *db);
+
+#endif